@@ -0,0 +1,521 @@
+// Needed for clock_gettime, pread and the CPU affinity calls
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "rle_simd.h"
+#include "rle_summary.h"
+#include "rle_analyzer.h"
+#include "rle_pool.h"
+#include "rle_volume.h"
+
+// Batch analysis: every volume of a manifest through a three-stage pipeline.
+//
+//   reader   one thread, loads the volumes in manifest order (windowing
+//            16-bit data on the way, rle_volume.h)
+//   scan     the main thread, splits a volume into chunks and scans them on
+//            the worker pool like pthreads_final.c, then stitches the chunk
+//            summaries in order
+//   writer   one thread, writes a CSV and/or JSON row per volume
+//
+// The stages are connected by bounded queues, so the reader loads volume
+// k+1 while volume k is being scanned. Every loaded volume is charged to a
+// buffer budget (--budget), and the reader waits until the scan has freed
+// enough of it; memory in flight therefore stays under the budget, except
+// that a single volume larger than the whole budget is still loaded once
+// nothing else is in flight.
+
+// Threshold for 8-bit volumes, as in the other programs
+#define THRESHOLD_U8 25
+
+#define MIN_N RLE_SUMMARY_MIN_N
+#define MAX_N RLE_SUMMARY_MAX_N
+#define RLE_VARIANTS RLE_SUMMARY_VARIANTS
+
+// Same chunking as pthreads_final.c
+#define CHUNK_VOXELS ((size_t)1 << 20)
+#define CACHE_LINE 64
+
+// Volumes waiting between two stages (the budget is the real limit)
+#define QUEUE_DEPTH 8
+
+// Default --budget in MB
+#define DEFAULT_BUDGET_MB 1024
+
+typedef struct {
+    size_t index;               // position in the manifest
+    const char *name;           // manifest entry
+    RleVolumeDesc desc;
+    const char *error;          // NULL if the volume was analyzed
+    uint8_t *voxels;
+    size_t bytes;               // charged to the budget while loaded
+    double read_s, scan_s;
+    RleSummary sum;
+} Study;
+
+// Bounded FIFO of studies. pop() returns NULL once the queue is closed and
+// empty.
+typedef struct {
+    Study *items[QUEUE_DEPTH];
+    size_t head, count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} StudyQueue;
+
+static void queue_init(StudyQueue *q) {
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(StudyQueue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static void queue_push(StudyQueue *q, Study *s) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == QUEUE_DEPTH) pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[(q->head + q->count) % QUEUE_DEPTH] = s;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static Study *queue_pop(StudyQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) pthread_cond_wait(&q->not_empty, &q->lock);
+    Study *s = NULL;
+    if (q->count > 0) {
+        s = q->items[q->head];
+        q->head = (q->head + 1) % QUEUE_DEPTH;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return s;
+}
+
+static void queue_close(StudyQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Bytes of loaded volumes not yet scanned
+typedef struct {
+    size_t limit, used, peak;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+} Budget;
+
+static void budget_acquire(Budget *b, size_t bytes) {
+    pthread_mutex_lock(&b->lock);
+    while (b->used > 0 && b->used + bytes > b->limit) pthread_cond_wait(&b->freed, &b->lock);
+    b->used += bytes;
+    if (b->used > b->peak) b->peak = b->used;
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void budget_release(Budget *b, size_t bytes) {
+    pthread_mutex_lock(&b->lock);
+    b->used -= bytes;
+    pthread_cond_signal(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+}
+
+double get_time(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        perror("clock_gettime");
+        exit(1);
+    }
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// --- Reader stage ---
+
+typedef struct {
+    char **names;
+    size_t count;
+    Budget *budget;
+    StudyQueue *out;
+    const RleVolumeParams *params;
+} ReaderArgs;
+
+static void read_study(Study *s, const RleVolumeParams *params, Budget *budget) {
+    if (strlen(s->name) >= RLE_VOLUME_PATH) {
+        s->error = "manifest entry too long";
+        return;
+    }
+    s->error = rle_volume_open(s->name, params, &s->desc);
+    if (s->error) return;
+
+    s->bytes = (size_t)rle_volume_voxels(&s->desc);
+    budget_acquire(budget, s->bytes);
+
+    double start = get_time();
+    int fd = open(s->desc.path, O_RDONLY);
+    s->voxels = (fd >= 0) ? malloc(s->bytes ? s->bytes : 1) : NULL;
+    if (!s->voxels || rle_volume_pread(fd, &s->desc, 0, s->bytes, s->voxels) != 0) {
+        s->error = s->voxels ? "cannot read the voxels" : "cannot open or allocate the volume";
+        free(s->voxels);
+        s->voxels = NULL;
+        budget_release(budget, s->bytes);
+    }
+    if (fd >= 0) close(fd);
+    s->read_s = get_time() - start;
+}
+
+static void *reader_main(void *arg) {
+    ReaderArgs *r = (ReaderArgs *)arg;
+    for (size_t i = 0; i < r->count; ++i) {
+        Study *s = calloc(1, sizeof(Study));
+        if (!s) {
+            fprintf(stderr, "Error: cannot allocate a study.\n");
+            exit(1);
+        }
+        s->index = i;
+        s->name = r->names[i];
+        read_study(s, r->params, r->budget);
+        queue_push(r->out, s);
+    }
+    queue_close(r->out);
+    return NULL;
+}
+
+// --- Scan stage ---
+
+typedef struct {
+    RleSummary sum;
+} __attribute__((aligned(CACHE_LINE))) ChunkData;
+
+typedef struct {
+    const uint8_t *voxels;
+    size_t num_voxels;
+    uint8_t threshold;
+    ChunkData *chunks;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} ScanJob;
+
+static void scan_worker(int worker, void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    (void)worker;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+
+        size_t start = c * CHUNK_VOXELS;
+        size_t end = (c == job->num_chunks - 1) ? job->num_voxels : start + CHUNK_VOXELS;
+        job->chunks[c].sum = rle_analyze_range(job->voxels, NULL, start, end, job->threshold, NULL);
+    }
+}
+
+// Scans one loaded study. 'chunks' holds room for 'cap' chunks and grows
+// with the largest volume.
+static void scan_study(RlePool *pool, int num_threads, Study *s, ChunkData **chunks, size_t *cap) {
+    ScanJob job;
+    job.voxels = s->voxels;
+    job.num_voxels = s->bytes;
+    job.threshold = s->desc.threshold;
+    job.num_chunks = (s->bytes + CHUNK_VOXELS - 1) / CHUNK_VOXELS;
+    atomic_init(&job.next_chunk, 0);
+
+    if (job.num_chunks > *cap) {
+        free(*chunks);
+        *chunks = aligned_alloc(CACHE_LINE, job.num_chunks * sizeof(ChunkData));
+        if (!*chunks) {
+            fprintf(stderr, "Error: cannot allocate the chunk table.\n");
+            exit(1);
+        }
+        *cap = job.num_chunks;
+    }
+    job.chunks = *chunks;
+
+    double start = get_time();
+    rle_pool_run(pool, num_threads, scan_worker, &job);
+
+    // Stitch the chunks in order, as analyze_results() does
+    rle_summary_init(&s->sum);
+    for (size_t c = 0; c < job.num_chunks; ++c) s->sum = rle_summary_merge(&s->sum, &job.chunks[c].sum);
+    s->scan_s = get_time() - start;
+}
+
+// --- Writer stage ---
+
+typedef struct {
+    StudyQueue *in;
+    FILE *csv, *json;
+    size_t done, failed;
+    uint64_t voxels;
+} WriterArgs;
+
+static int best_variant(const RleSummary *sum) {
+    int best = 0;
+    for (int v = 1; v < RLE_VARIANTS; ++v) {
+        if (sum->costs[v] < sum->costs[best]) best = v;
+    }
+    return best;
+}
+
+// Writes 's' as a JSON string: the manifest entry may hold any character.
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", (unsigned char)*s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void write_row(WriterArgs *w, const Study *s) {
+    const RleVolumeDesc *d = &s->desc;
+    int ok = s->error == NULL;
+    int best = ok ? best_variant(&s->sum) : 0;
+
+    if (ok) {
+        printf("[%zu] %s: %ux%ux%u %s, best N=%d %lu bits (%.2f MB), read %.3f s, scan %.3f s\n", s->index,
+               s->name, d->x, d->y, d->z, rle_volume_type_name(d->type), best + MIN_N, s->sum.costs[best],
+               (double)s->sum.costs[best] / 8.0 / 1024.0 / 1024.0, s->read_s, s->scan_s);
+    } else {
+        printf("[%zu] %s: %s\n", s->index, s->name, s->error);
+    }
+
+    if (w->csv) {
+        // The name is quoted, with any quote in it doubled
+        fprintf(w->csv, "%zu,\"", s->index);
+        for (const char *c = s->name; *c; ++c) {
+            if (*c == '"') fputc('"', w->csv);
+            fputc(*c, w->csv);
+        }
+        fprintf(w->csv, "\",%s,%u,%u,%u,%s,%lu,%lu,%d,%lu", ok ? "ok" : "error", d->x, d->y, d->z,
+                rle_volume_type_name(d->type), ok ? rle_volume_voxels(d) : 0, ok ? s->sum.runs : 0,
+                ok ? best + MIN_N : 0, ok ? s->sum.costs[best] : 0);
+        for (int v = 0; v < RLE_VARIANTS; ++v) fprintf(w->csv, ",%lu", ok ? s->sum.costs[v] : 0);
+        fprintf(w->csv, ",%.6f,%.6f\n", s->read_s, s->scan_s);
+    }
+
+    if (w->json) {
+        fprintf(w->json, "{\"index\": %zu, \"path\": ", s->index);
+        json_string(w->json, s->name);
+        if (ok) {
+            fprintf(w->json, ", \"status\": \"ok\", \"size\": [%u, %u, %u], \"type\": \"%s\", \"runs\": %lu, "
+                             "\"best_n\": %d, \"best_bits\": %lu, \"bits\": [",
+                    d->x, d->y, d->z, rle_volume_type_name(d->type), s->sum.runs, best + MIN_N,
+                    s->sum.costs[best]);
+            for (int v = 0; v < RLE_VARIANTS; ++v) fprintf(w->json, "%s%lu", v ? ", " : "", s->sum.costs[v]);
+            fprintf(w->json, "], \"read_s\": %.6f, \"scan_s\": %.6f}\n", s->read_s, s->scan_s);
+        } else {
+            fprintf(w->json, ", \"status\": \"error\", \"error\": ");
+            json_string(w->json, s->error);
+            fprintf(w->json, "}\n");
+        }
+    }
+}
+
+static void *writer_main(void *arg) {
+    WriterArgs *w = (WriterArgs *)arg;
+    Study *s;
+    while ((s = queue_pop(w->in)) != NULL) {
+        write_row(w, s);
+        if (s->error) {
+            w->failed++;
+        } else {
+            w->done++;
+            w->voxels += rle_volume_voxels(&s->desc);
+        }
+        free(s);
+    }
+    return NULL;
+}
+
+// --- Driver ---
+
+// Reads the manifest: one volume (raw file or .mhd/.mha/.nrrd/.nhdr header)
+// per line, blank lines and lines starting with '#' skipped. Lines are read
+// whole, whatever their length; an entry too long for a path becomes an
+// error row in read_study(). Returns the number of entries, -1 on error.
+static long read_manifest(const char *path, char ***names) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    size_t count = 0, cap = 64;
+    *names = malloc(cap * sizeof(char *));
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (*names && getline(&line, &line_cap, f) >= 0) {
+        char *entry = rle_volume_trim(line);
+        if (*entry == '\0' || *entry == '#') continue;
+        if (count == cap) {
+            char **grown = realloc(*names, 2 * cap * sizeof(char *));
+            if (!grown) break;
+            *names = grown;
+            cap *= 2;
+        }
+        if (!((*names)[count] = strdup(entry))) break;
+        count++;
+    }
+    int err = !*names || !feof(f);
+    free(line);
+    fclose(f);
+    return err ? -1 : (long)count;
+}
+
+static FILE *open_output(const char *path) {
+    if (!path) return NULL;
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: cannot write %s.\n", path);
+        exit(1);
+    }
+    return f;
+}
+
+int main(int argc, char **argv) {
+    const char *manifest = NULL, *csv = NULL, *json = NULL;
+    int num_threads = 0, pin = 0, bad = argc < 2;
+    long budget_mb = DEFAULT_BUDGET_MB;
+    RleVolumeParams params;
+    rle_volume_params_init(&params, THRESHOLD_U8);
+
+    for (int i = 1; i < argc && !bad; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+            bad = num_threads < 1 || num_threads > RLE_POOL_MAX;
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget_mb = atol(argv[++i]);
+            bad = budget_mb < 1;
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            pin = 1;
+        } else if (argv[i][0] != '-' && !manifest) {
+            manifest = argv[i];
+        } else {
+            bad = rle_volume_parse_arg(argc, argv, &i, &params) <= 0;
+        }
+    }
+    if (bad || !manifest) {
+        fprintf(stderr, "Usage: %s MANIFEST [--threads T] [--budget MB] [--csv FILE] [--json FILE] [--pin]\n"
+                        "       [--threshold T] [--window LO,HI]\n",
+                argv[0]);
+        return 1;
+    }
+
+    char **names = NULL;
+    long count = read_manifest(manifest, &names);
+    if (count < 0) {
+        fprintf(stderr, "Error: cannot read the manifest %s.\n", manifest);
+        return 1;
+    }
+
+    // Default: one worker per CPU we may run on
+    if (num_threads == 0) {
+        cpu_set_t allowed;
+        num_threads = 1;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) num_threads = CPU_COUNT(&allowed);
+        if (num_threads > RLE_POOL_MAX) num_threads = RLE_POOL_MAX;
+    }
+
+    RlePool pool;
+    if (rle_pool_start(&pool, num_threads, pin) != 0) {
+        fprintf(stderr, "Error: cannot start the worker threads.\n");
+        return 1;
+    }
+
+    WriterArgs writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.csv = open_output(csv);
+    writer.json = open_output(json);
+    if (writer.csv) {
+        fprintf(writer.csv, "index,path,status,x,y,z,type,voxels,runs,best_n,best_bits");
+        for (int n = MIN_N; n <= MAX_N; ++n) fprintf(writer.csv, ",bits_n%d", n);
+        fprintf(writer.csv, ",read_s,scan_s\n");
+    }
+
+    Budget budget;
+    memset(&budget, 0, sizeof(budget));
+    budget.limit = (size_t)budget_mb << 20;
+    pthread_mutex_init(&budget.lock, NULL);
+    pthread_cond_init(&budget.freed, NULL);
+
+    StudyQueue loaded, scanned;
+    queue_init(&loaded);
+    queue_init(&scanned);
+    writer.in = &scanned;
+    ReaderArgs reader = { names, (size_t)count, &budget, &loaded, &params };
+
+    printf("Batch of %ld volumes, %d scan threads, %ld MB buffer budget, %s kernel\n", count, num_threads,
+           budget_mb, RLE_SIMD_NAME);
+
+    double start = get_time();
+    pthread_t reader_tid, writer_tid;
+    if (pthread_create(&reader_tid, NULL, reader_main, &reader) != 0 ||
+        pthread_create(&writer_tid, NULL, writer_main, &writer) != 0) {
+        fprintf(stderr, "Error: cannot start the pipeline threads.\n");
+        return 1;
+    }
+
+    // The scan stage, in manifest order
+    ChunkData *chunks = NULL;
+    size_t chunk_cap = 0;
+    double scan_total = 0.0, read_total = 0.0;
+    Study *s;
+    while ((s = queue_pop(&loaded)) != NULL) {
+        if (!s->error) {
+            scan_study(&pool, num_threads, s, &chunks, &chunk_cap);
+            free(s->voxels);
+            s->voxels = NULL;
+            budget_release(&budget, s->bytes);
+            scan_total += s->scan_s;
+        }
+        read_total += s->read_s;
+        queue_push(&scanned, s);
+    }
+    queue_close(&scanned);
+
+    pthread_join(reader_tid, NULL);
+    pthread_join(writer_tid, NULL);
+    double elapsed = get_time() - start;
+
+    printf("\n--- Batch Summary ---\n");
+    printf("Volumes: %zu analyzed, %zu failed\n", writer.done, writer.failed);
+    printf(">> Wall Time: %.6f seconds (read %.6f s, scan %.6f s summed over volumes)\n", elapsed, read_total,
+           scan_total);
+    if (elapsed > 0.0) {
+        printf(">> Throughput: %.2f volumes/s, %.2f GB/s of voxels\n", (double)writer.done / elapsed,
+               (double)writer.voxels / elapsed / 1e9);
+    }
+    printf("Peak loaded: %.1f MB of %ld MB\n", (double)budget.peak / 1024.0 / 1024.0, budget_mb);
+
+    int status = writer.failed ? 2 : 0;
+    if ((writer.csv && fclose(writer.csv) != 0) || (writer.json && fclose(writer.json) != 0)) {
+        fprintf(stderr, "Error: cannot finish the output files.\n");
+        status = 1;
+    }
+
+    rle_pool_stop(&pool);
+    queue_destroy(&loaded);
+    queue_destroy(&scanned);
+    pthread_mutex_destroy(&budget.lock);
+    pthread_cond_destroy(&budget.freed);
+    free(chunks);
+    for (long i = 0; i < count; ++i) free(names[i]);
+    free(names);
+    return status;
+}
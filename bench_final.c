@@ -0,0 +1,440 @@
+// Needed for clock_gettime and sched_getaffinity
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+
+#include "rle_simd.h"
+#include "rle_hist.h"
+#include "rle_mask.h"
+#include "rle_summary.h"
+#include "rle_analyzer.h"
+#include "rle_pool.h"
+#include "rle_phantom.h"
+
+// Benchmark harness: every shared-memory engine on synthetic phantoms
+// (rle_phantom.h), warm-up runs plus timed repeats, median and p95.
+//
+// The engines call the same kernels as the programs: the scalar reference
+// loop (rle_summary.h) and the SIMD, histogram and bit mask scans of
+// seq_final.c, and the chunk scan of pthreads_final.c on the worker pool at
+// every thread count (rle_analyzer.h). Their buffers are allocated before
+// anything is timed, so the figures are the scan alone; the mask engine
+// scans a mask built once per phantom. Every run is checked against the
+// scalar costs. The MPI engines take the phantoms written by --write through
+// their --input option.
+
+#define THRESHOLD 25
+
+// We are testing RLE bit-widths from N=2 up to N=17
+#define MIN_N RLE_SUMMARY_MIN_N
+#define MAX_N RLE_SUMMARY_MAX_N
+#define RLE_VARIANTS RLE_SUMMARY_VARIANTS
+
+// Same chunking as pthreads_final.c
+#define CHUNK_VOXELS ((size_t)1 << 20)
+#define CACHE_LINE 64
+
+// Longest --threads list and most repeats
+#define MAX_CONFIGS 16
+#define MAX_REPEATS 1000
+
+// The phantom being measured
+uint8_t *volume = NULL;
+size_t num_voxels = 0;
+
+typedef struct {
+    const char *phantom;
+    const char *engine;
+    int threads;
+    int repeats;
+    uint64_t runs;
+    double median, p95, min;
+} BenchResult;
+
+double get_time(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        perror("clock_gettime");
+        exit(1);
+    }
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// --- Engines. The buffers live in a BenchState allocated once in main();
+// an engine's reset() prepares it for the next run, outside the timer. ---
+
+// Pool engine: every chunk summary is on its own cache line, the chunks are
+// stitched in order at the end, as in analyze_results().
+typedef struct {
+    RleSummary sum;
+} __attribute__((aligned(CACHE_LINE))) BenchChunk;
+
+typedef struct {
+    RleHist hist;           // hist: cleared before every run
+    RleMask mask;           // mask: built once per phantom, like seq_final.c
+                            // times the build apart from the scan
+    BenchChunk *chunks;     // pool: one per CHUNK_VOXELS
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} BenchState;
+
+// Each engine fills costs[] and returns the number of runs.
+static uint64_t engine_scalar(BenchState *st, RlePool *pool, int threads, uint64_t *costs) {
+    (void)st;
+    (void)pool;
+    (void)threads;
+    RleSummary sum = rle_summary_scan_scalar(volume, num_voxels, THRESHOLD);
+    memcpy(costs, sum.costs, sizeof(sum.costs));
+    return sum.runs;
+}
+
+static uint64_t engine_simd(BenchState *st, RlePool *pool, int threads, uint64_t *costs) {
+    (void)st;
+    (void)pool;
+    (void)threads;
+    RleSummary sum = rle_analyze_range(volume, NULL, 0, num_voxels, THRESHOLD, NULL);
+    memcpy(costs, sum.costs, sizeof(sum.costs));
+    return sum.runs;
+}
+
+static void reset_hist(BenchState *st) {
+    rle_hist_clear(&st->hist);
+}
+
+static uint64_t engine_hist(BenchState *st, RlePool *pool, int threads, uint64_t *costs) {
+    (void)pool;
+    (void)threads;
+    RleSummary sum = rle_analyze_range(volume, NULL, 0, num_voxels, THRESHOLD, &st->hist);
+    rle_hist_costs(&st->hist, MIN_N, MAX_N, costs);
+    return sum.runs;
+}
+
+static uint64_t engine_mask(BenchState *st, RlePool *pool, int threads, uint64_t *costs) {
+    (void)pool;
+    (void)threads;
+    RleSummary sum = rle_analyze_range(NULL, &st->mask, 0, num_voxels, THRESHOLD, NULL);
+    memcpy(costs, sum.costs, sizeof(sum.costs));
+    return sum.runs;
+}
+
+static void pool_worker(int worker, void *arg) {
+    BenchState *st = (BenchState *)arg;
+    (void)worker;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&st->next_chunk, 1, memory_order_relaxed);
+        if (c >= st->num_chunks) break;
+
+        size_t start = c * CHUNK_VOXELS;
+        size_t end = (c == st->num_chunks - 1) ? num_voxels : start + CHUNK_VOXELS;
+        st->chunks[c].sum = rle_analyze_range(volume, NULL, start, end, THRESHOLD, NULL);
+    }
+}
+
+static void reset_pool(BenchState *st) {
+    atomic_store(&st->next_chunk, 0);
+}
+
+static uint64_t engine_pool(BenchState *st, RlePool *pool, int threads, uint64_t *costs) {
+    rle_pool_run(pool, threads, pool_worker, st);
+
+    RleSummary total;
+    rle_summary_init(&total);
+    for (size_t c = 0; c < st->num_chunks; ++c) total = rle_summary_merge(&total, &st->chunks[c].sum);
+
+    memcpy(costs, total.costs, sizeof(total.costs));
+    return total.runs;
+}
+
+typedef uint64_t (*engine_fn)(BenchState *st, RlePool *pool, int threads, uint64_t *costs);
+typedef void (*reset_fn)(BenchState *st);
+
+static const struct {
+    const char *name;
+    engine_fn run;
+    reset_fn reset;         // NULL: nothing to reset
+    int threaded;
+} engines[] = {
+    { "scalar", engine_scalar, NULL, 0 },
+    { "simd", engine_simd, NULL, 0 },
+    { "hist", engine_hist, reset_hist, 0 },
+    { "mask", engine_mask, NULL, 0 },
+    { "pool", engine_pool, reset_pool, 1 },
+};
+
+#define NUM_ENGINES ((int)(sizeof(engines) / sizeof(engines[0])))
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median, p95 (nearest rank) and minimum of 'n' times, sorted in place.
+static void summarize(double *t, int n, BenchResult *r) {
+    qsort(t, (size_t)n, sizeof(double), cmp_double);
+    r->median = (n % 2) ? t[n / 2] : 0.5 * (t[n / 2 - 1] + t[n / 2]);
+    int rank = (95 * n + 99) / 100;
+    r->p95 = t[rank > 0 ? rank - 1 : 0];
+    r->min = t[0];
+}
+
+// Warm-up runs, then 'repeats' timed runs, each checked against 'ref'. Only
+// the engine call itself is timed.
+static int measure(BenchState *st, RlePool *pool, int e, int threads, int warmup, int repeats,
+                   const uint64_t *ref, BenchResult *r) {
+    double times[MAX_REPEATS];
+    uint64_t costs[RLE_VARIANTS];
+
+    for (int i = 0; i < warmup + repeats; ++i) {
+        if (engines[e].reset) engines[e].reset(st);
+
+        double start = get_time();
+        r->runs = engines[e].run(st, pool, threads, costs);
+        double end = get_time();
+
+        if (memcmp(costs, ref, sizeof(costs)) != 0) {
+            fprintf(stderr, "Error: %s with %d threads differs from the scalar reference.\n",
+                    engines[e].name, threads);
+            return 1;
+        }
+        if (i >= warmup) times[i - warmup] = end - start;
+    }
+
+    r->engine = engines[e].name;
+    r->threads = threads;
+    r->repeats = repeats;
+    summarize(times, repeats, r);
+    return 0;
+}
+
+static double gb_per_s(const BenchResult *r) {
+    return (double)num_voxels / r->median / 1e9;
+}
+
+static void print_result(const BenchResult *r) {
+    printf("%-8s %-7s %7d %11.6f %11.6f %8.2f %10.1f\n", r->phantom, r->engine, r->threads, r->median,
+           r->p95, gb_per_s(r), (double)r->runs / r->median / 1e6);
+}
+
+static int write_csv(const char *path, const BenchResult *res, int count) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    fprintf(f, "phantom,engine,threads,voxels,runs,repeats,median_s,p95_s,min_s,gb_per_s,runs_per_s,simd\n");
+    for (int i = 0; i < count; ++i) {
+        const BenchResult *r = &res[i];
+        fprintf(f, "%s,%s,%d,%zu,%lu,%d,%.9f,%.9f,%.9f,%.4f,%.1f,%s\n", r->phantom, r->engine, r->threads,
+                num_voxels, r->runs, r->repeats, r->median, r->p95, r->min, gb_per_s(r),
+                (double)r->runs / r->median, RLE_SIMD_NAME);
+    }
+    return fclose(f) != 0;
+}
+
+static int write_json(const char *path, const BenchResult *res, int count, const uint32_t *dims,
+                      uint64_t seed, int warmup) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 1;
+    fprintf(f, "{\n  \"simd\": \"%s\",\n  \"compiler\": \"%s\",\n", RLE_SIMD_NAME, __VERSION__);
+    fprintf(f, "  \"size\": [%u, %u, %u],\n  \"seed\": %lu,\n  \"warmup\": %d,\n  \"results\": [\n",
+            dims[0], dims[1], dims[2], seed, warmup);
+    for (int i = 0; i < count; ++i) {
+        const BenchResult *r = &res[i];
+        fprintf(f, "    {\"phantom\": \"%s\", \"engine\": \"%s\", \"threads\": %d, \"voxels\": %zu, "
+                   "\"runs\": %lu, \"repeats\": %d, \"median_s\": %.9f, \"p95_s\": %.9f, \"min_s\": %.9f, "
+                   "\"gb_per_s\": %.4f, \"runs_per_s\": %.1f}%s\n",
+                r->phantom, r->engine, r->threads, num_voxels, r->runs, r->repeats, r->median, r->p95,
+                r->min, gb_per_s(r), (double)r->runs / r->median, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) != 0;
+}
+
+// Writes the phantom as DIR/<name>.raw with a NRRD header DIR/<name>.nhdr,
+// for the programs' --input option.
+static int write_phantom(const char *dir, const char *name, const uint32_t *dims) {
+    char path[4096];
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 1;
+
+    snprintf(path, sizeof(path), "%s/%s.raw", dir, name);
+    FILE *f = fopen(path, "wb");
+    if (!f) return 1;
+    int err = fwrite(volume, 1, num_voxels, f) != num_voxels;
+    err |= fclose(f) != 0;
+
+    snprintf(path, sizeof(path), "%s/%s.nhdr", dir, name);
+    f = fopen(path, "w");
+    if (!f) return 1;
+    fprintf(f, "NRRD0004\n# rle-ct-image %s phantom\ntype: uint8\ndimension: 3\nsizes: %u %u %u\n"
+               "encoding: raw\ndata file: %s.raw\n", name, dims[0], dims[1], dims[2], name);
+    err |= fclose(f) != 0;
+    return err;
+}
+
+// Parses "1,2,4" into 'list'. Returns the number of entries, 0 on error.
+static int parse_list(const char *text, int *list) {
+    int count = 0;
+    const char *p = text;
+    while (*p && count < MAX_CONFIGS) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1 || v > RLE_POOL_MAX) return 0;
+        list[count++] = (int)v;
+        if (*end == ',') end++;
+        else if (*end) return 0;
+        p = end;
+    }
+    return *p ? 0 : count;
+}
+
+// "air,spheres" into a kind mask. Returns 0 on error.
+static int parse_phantoms(const char *text) {
+    int mask = 0;
+    while (*text) {
+        size_t len = strcspn(text, ",");
+        int k = rle_phantom_parse(text, len);
+        if (k < 0) return 0;
+        mask |= 1 << k;
+        text += len;
+        if (*text == ',') text++;
+    }
+    return mask;
+}
+
+int main(int argc, char **argv) {
+    uint32_t dims[3] = { 512, 512, 128 };
+    int phantoms = (1 << RLE_PHANTOM_COUNT) - 1;
+    int threads[MAX_CONFIGS];
+    int num_threads = 0;
+    int warmup = 2, repeats = 10, pin = 0;
+    uint64_t seed = 1;
+    const char *csv = NULL, *json = NULL, *write_dir = NULL;
+    int bad = 0;
+
+    for (int i = 1; i < argc && !bad; ++i) {
+        if (strcmp(argv[i], "--phantom") == 0 && i + 1 < argc) {
+            bad = (phantoms = parse_phantoms(argv[++i])) == 0;
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            bad = sscanf(argv[++i], "%ux%ux%u", &dims[0], &dims[1], &dims[2]) != 3 ||
+                  !dims[0] || !dims[1] || !dims[2];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            bad = (num_threads = parse_list(argv[++i], threads)) == 0;
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+            bad = warmup < 0;
+        } else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+            bad = repeats < 1 || repeats > MAX_REPEATS;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+            write_dir = argv[++i];
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            pin = 1;
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fprintf(stderr, "Usage: %s [--phantom air,noisy,spheres] [--size XxYxZ] [--threads T1,T2,..]\n"
+                        "       [--warmup W] [--repeats R] [--seed S] [--csv FILE] [--json FILE]\n"
+                        "       [--write DIR] [--pin]\n", argv[0]);
+        return 1;
+    }
+
+    // Default thread counts: powers of two up to the CPUs we may run on
+    if (num_threads == 0) {
+        cpu_set_t allowed;
+        int cpus = 1;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) cpus = CPU_COUNT(&allowed);
+        for (int v = 1; v < cpus && num_threads < MAX_CONFIGS - 1; v *= 2) threads[num_threads++] = v;
+        threads[num_threads++] = cpus;
+    }
+    int max_threads = 1;
+    for (int i = 0; i < num_threads; ++i) {
+        if (threads[i] > max_threads) max_threads = threads[i];
+    }
+
+    RlePool pool;
+    if (rle_pool_start(&pool, max_threads, pin) != 0) {
+        fprintf(stderr, "Error: cannot start the worker threads.\n");
+        return 1;
+    }
+
+    num_voxels = (size_t)dims[0] * dims[1] * dims[2];
+    volume = malloc(num_voxels);
+    int max_results = RLE_PHANTOM_COUNT * NUM_ENGINES * MAX_CONFIGS;
+    BenchResult *results = malloc((size_t)max_results * sizeof(BenchResult));
+    if (!volume || !results) {
+        fprintf(stderr, "Error: cannot allocate %zu voxels.\n", num_voxels);
+        return 1;
+    }
+    int count = 0;
+
+    // Engine buffers, the same size for every phantom
+    BenchState st;
+    st.num_chunks = (num_voxels + CHUNK_VOXELS - 1) / CHUNK_VOXELS;
+    st.chunks = aligned_alloc(CACHE_LINE, st.num_chunks * sizeof(BenchChunk));
+    if (!st.chunks || rle_hist_init(&st.hist) != 0 || rle_mask_alloc(&st.mask, num_voxels) != 0) {
+        fprintf(stderr, "Error: cannot allocate the engine buffers.\n");
+        return 1;
+    }
+    atomic_init(&st.next_chunk, 0);
+
+    printf("Phantoms %ux%ux%u, seed %lu, %d warm-up + %d timed runs, %s kernel\n",
+           dims[0], dims[1], dims[2], seed, warmup, repeats, RLE_SIMD_NAME);
+    printf("%-8s %-7s %7s %11s %11s %8s %10s\n", "phantom", "engine", "threads", "median s", "p95 s",
+           "GB/s", "Mruns/s");
+
+    for (int k = 0; k < RLE_PHANTOM_COUNT; ++k) {
+        if (!(phantoms & (1 << k))) continue;
+        rle_phantom_generate((RlePhantomKind)k, dims[0], dims[1], dims[2], THRESHOLD, seed, volume);
+        if (write_dir && write_phantom(write_dir, rle_phantom_names[k], dims) != 0) {
+            fprintf(stderr, "Error: cannot write the %s phantom to %s.\n", rle_phantom_names[k], write_dir);
+            return 1;
+        }
+
+        rle_mask_build(&st.mask, volume, 0, num_voxels, THRESHOLD);
+
+        uint64_t ref[RLE_VARIANTS];
+        engine_scalar(&st, &pool, 1, ref);
+
+        for (int e = 0; e < NUM_ENGINES; ++e) {
+            for (int t = 0; t < (engines[e].threaded ? num_threads : 1); ++t) {
+                BenchResult *r = &results[count];
+                r->phantom = rle_phantom_names[k];
+                if (measure(&st, &pool, e, engines[e].threaded ? threads[t] : 1, warmup, repeats, ref, r) != 0) {
+                    return 1;
+                }
+                print_result(r);
+                count++;
+            }
+        }
+    }
+
+    if (csv && write_csv(csv, results, count) != 0) {
+        fprintf(stderr, "Error: cannot write %s.\n", csv);
+        return 1;
+    }
+    if (json && write_json(json, results, count, dims, seed, warmup) != 0) {
+        fprintf(stderr, "Error: cannot write %s.\n", json);
+        return 1;
+    }
+
+    rle_pool_stop(&pool);
+    rle_mask_free(&st.mask);
+    rle_hist_free(&st.hist);
+    free(st.chunks);
+    free(results);
+    free(volume);
+    return 0;
+}
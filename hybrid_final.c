@@ -0,0 +1,340 @@
+// Needed for clock_gettime and the CPU affinity calls
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <mpi.h>
+
+#include "rle_simd.h"
+#include "rle_analyzer.h"
+#include "rle_summary.h"
+#include "rle_pool.h"
+#include "rle_volume.h"
+#include "rle_prof.h"
+
+// Hybrid engine: one MPI rank per node (or socket), and inside every rank a
+// team of threads scanning the rank's slab.
+//
+// Seams between chunks of one rank are stitched locally by folding the chunk
+// summaries; seams between ranks are stitched by one MPI_Reduce with the same
+// merge operator (rle_summary.h). Only the main thread of a rank calls MPI.
+
+// Threshold for 8-bit volumes
+#define THRESHOLD_U8 25
+
+// The volume being scanned, c8.raw unless --input names another file.
+// 16-bit volumes are windowed to 0/1 while they are read (rle_volume.h).
+RleVolumeDesc input;
+#define NUM_VOXELS rle_volume_voxels(&input)
+#define THRESHOLD (input.threshold)
+
+// We are testing RLE bit-widths from N=2 up to N=17
+#define MIN_N RLE_SUMMARY_MIN_N
+#define MAX_N RLE_SUMMARY_MAX_N
+#define RLE_VARIANTS RLE_SUMMARY_VARIANTS
+
+// Same chunking as pthreads_final.c
+#define CHUNK_VOXELS ((uint64_t)1 << 20)
+#define CACHE_LINE 64
+
+// MPI-IO reads at most this much per call, so counts fit in an int
+#define IO_BLOCK ((uint64_t)1 << 30)
+
+// Longest --ranks / --threads list
+#define MAX_CONFIGS 16
+
+// This rank's part of the volume
+uint8_t *slab = NULL;
+uint64_t slab_len = 0;
+
+// Every chunk summary on its own cache line, see pthreads_final.c
+typedef struct {
+    uint64_t start_index;
+    uint64_t end_index;
+    RleSummary sum;
+} __attribute__((aligned(CACHE_LINE))) ChunkData;
+
+typedef struct {
+    ChunkData *chunks;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} ScanJob;
+
+static void process_chunk(ChunkData *data) {
+    data->sum = rle_analyze_range(slab, NULL, data->start_index, data->end_index, THRESHOLD, NULL);
+}
+
+static void scan_worker(int worker, void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    (void)worker;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+        process_chunk(&job->chunks[c]);
+    }
+}
+
+// Scans the slab with 'num_threads' workers and stitches the thread-level
+// seams, so the result is the summary of the whole slab.
+static RleSummary scan_slab(RlePool *pool, int num_threads, ChunkData *chunks, size_t num_chunks) {
+    ScanJob job;
+    job.chunks = chunks;
+    job.num_chunks = num_chunks;
+    atomic_init(&job.next_chunk, 0);
+
+    RLE_PROF_BEGIN(RLE_PROF_SCAN);
+    rle_pool_run(pool, num_threads, scan_worker, &job);
+    RLE_PROF_END(RLE_PROF_SCAN);
+
+    RLE_PROF_BEGIN(RLE_PROF_STITCH);
+    RleSummary sum;
+    rle_summary_init(&sum);
+    for (size_t c = 0; c < num_chunks; ++c) sum = rle_summary_merge(&sum, &chunks[c].sum);
+    RLE_PROF_END(RLE_PROF_STITCH);
+    return sum;
+}
+
+// Collective read of voxels [offset, offset + count) on 'comm'. Every rank
+// makes the same number of calls, with a zero count once its part is done.
+// 16-bit voxels are read into a staging buffer a block at a time and
+// windowed into the slab. Returns 0 on success.
+static int read_slab(MPI_Comm comm, uint64_t offset, uint64_t count, uint64_t max_count) {
+    MPI_File fh;
+    if (MPI_File_open(comm, input.path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) return 1;
+
+    uint64_t vb = rle_volume_voxel_bytes(&input);
+    uint64_t block = rle_volume_windowed(&input) ? RLE_VOLUME_BLOCK : IO_BLOCK;
+    uint8_t *raw = rle_volume_windowed(&input) ? (uint8_t *)malloc(block * vb) : NULL;
+    int err = rle_volume_windowed(&input) && !raw;
+
+    for (uint64_t done = 0; done < max_count; done += block) {
+        uint64_t n = (done < count && !err) ? count - done : 0;
+        if (n > block) n = block;
+
+        MPI_Status status;
+        int got = 0;
+        MPI_File_read_at_all(fh, (MPI_Offset)(input.offset + (offset + done) * vb),
+                             raw ? raw : slab + (n ? done : 0), (int)(n * vb), MPI_UNSIGNED_CHAR, &status);
+        MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &got);
+        if ((uint64_t)got != n * vb) err = 1;
+        if (raw && n && !err) rle_volume_convert(&input, raw, (size_t)n, slab + done);
+    }
+
+    free(raw);
+    MPI_File_close(&fh);
+    return err;
+}
+
+// Parses "1,2,4" into 'list', every entry 1..max. Returns the number of
+// entries, 0 on error.
+static int parse_list(const char *text, int max, int *list) {
+    int count = 0;
+    const char *p = text;
+    while (*p && count < MAX_CONFIGS) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1 || v > max) return 0;
+        list[count++] = (int)v;
+        if (*end == ',') end++;
+        else if (*end) return 0;
+        p = end;
+    }
+    return *p ? 0 : count;
+}
+
+// 1, 2, 4, ... up to 'max', and 'max' itself
+static int powers_of_two(int max, int *list) {
+    int count = 0;
+    for (int v = 1; v < max && count < MAX_CONFIGS - 1; v *= 2) list[count++] = v;
+    list[count++] = max;
+    return count;
+}
+
+static void print_results(const uint64_t *costs) {
+    printf("\n--- Final RLE Analysis ---\n");
+    for (int n = MIN_N; n <= MAX_N; ++n) {
+        int packet_bits = n + 1;
+        double mb = (double)costs[n - MIN_N] / 8.0 / 1024.0 / 1024.0;
+        printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
+               n, packet_bits, costs[n - MIN_N], mb);
+    }
+}
+
+int main(int argc, char **argv) {
+    // Only the main thread of every rank talks to MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, nprocs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+
+    int ranks[MAX_CONFIGS], threads[MAX_CONFIGS];
+    int num_ranks = 0, num_threads = 0;
+    int pin = 0;
+    int bad = 0;
+    const char *input_path = "c8.raw";
+    RleVolumeParams params;
+    rle_volume_params_init(&params, THRESHOLD_U8);
+
+    for (int i = 1; i < argc && !bad; ++i) {
+        if (strcmp(argv[i], "--ranks") == 0 && i + 1 < argc) {
+            num_ranks = parse_list(argv[++i], nprocs, ranks);
+            bad = num_ranks == 0;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = parse_list(argv[++i], RLE_POOL_MAX, threads);
+            bad = num_threads == 0;
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            pin = 1;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else {
+            bad = rle_volume_parse_arg(argc, argv, &i, &params) <= 0;
+        }
+    }
+    if (bad) {
+        if (rank == 0) {
+            fprintf(stderr, "Usage: %s [--ranks R1,R2,..] [--threads T1,T2,..] [--pin] [--input FILE|HEADER.mhd|HEADER.nrrd]\n"
+                            "          [--threshold T] [--window LO,HI]\n",
+                    argv[0]);
+            fprintf(stderr, "Rank counts can be at most the mpirun -np count (%d), thread counts at most %d.\n",
+                    nprocs, RLE_POOL_MAX);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    const char *err = rle_volume_open(input_path, &params, &input);
+    if (err) {
+        if (rank == 0) fprintf(stderr, "Error: %s: %s.\n", input_path, err);
+        MPI_Finalize();
+        return 1;
+    }
+    if (rank == 0) rle_volume_print(&input);
+
+    // Defaults: powers of two up to all ranks, and up to the CPUs this rank
+    // may run on (one rank per node or socket gets the whole node or socket)
+    if (num_ranks == 0) num_ranks = powers_of_two(nprocs, ranks);
+    if (num_threads == 0) {
+        cpu_set_t allowed;
+        int cpus = 1;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) cpus = CPU_COUNT(&allowed);
+        num_threads = powers_of_two(cpus, threads);
+    }
+
+    int max_threads = 1;
+    for (int i = 0; i < num_threads; ++i) {
+        if (threads[i] > max_threads) max_threads = threads[i];
+    }
+
+    // One pool per rank, started before any timer runs
+    RlePool pool;
+    if (rle_pool_start(&pool, max_threads, pin) != 0) {
+        fprintf(stderr, "Rank %d: cannot start %d worker threads.\n", rank, max_threads);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (pin && rank == 0) {
+        printf("Pinned %d workers per rank%s.\n", max_threads, pool.pinned ? "" : " (failed, running unpinned)");
+    }
+
+    double times[MAX_CONFIGS][MAX_CONFIGS];
+    uint64_t first_costs[RLE_VARIANTS];
+    int mismatch = 0;
+
+    for (int ri = 0; ri < num_ranks; ++ri) {
+        int r = ranks[ri];
+
+        // The first r ranks take part, the others wait for the next rank count
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, rank < r ? 0 : MPI_UNDEFINED, rank, &comm);
+        if (comm == MPI_COMM_NULL) continue;
+
+        // Same 64-bit split as mpi_final.c
+        uint64_t base = NUM_VOXELS / (uint64_t)r;
+        uint64_t rem = NUM_VOXELS % (uint64_t)r;
+        uint64_t offset = (uint64_t)rank * base + ((uint64_t)rank < rem ? (uint64_t)rank : rem);
+        slab_len = base + ((uint64_t)rank < rem ? 1 : 0);
+
+        RLE_PROF_BEGIN(RLE_PROF_LOAD);
+        slab = (uint8_t *)malloc(slab_len ? slab_len : 1);
+        if (!slab || read_slab(comm, offset, slab_len, base + (rem ? 1 : 0)) != 0) {
+            fprintf(stderr, "Rank %d: cannot read its part of %s.\n", rank, input.path);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        RLE_PROF_END(RLE_PROF_LOAD);
+
+        size_t num_chunks = (size_t)((slab_len + CHUNK_VOXELS - 1) / CHUNK_VOXELS);
+        ChunkData *chunks = aligned_alloc(CACHE_LINE, (num_chunks + 1) * sizeof(ChunkData));
+        if (!chunks) {
+            fprintf(stderr, "Rank %d: cannot allocate the chunk table.\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (size_t c = 0; c < num_chunks; ++c) {
+            chunks[c].start_index = c * CHUNK_VOXELS;
+            chunks[c].end_index = (c == num_chunks - 1) ? slab_len : (c + 1) * CHUNK_VOXELS;
+        }
+
+        MPI_Datatype summary_type = rle_summary_mpi_type();
+        MPI_Op stitch_op = rle_summary_mpi_op();
+
+        for (int ti = 0; ti < num_threads; ++ti) {
+            MPI_Barrier(comm);
+            double start = MPI_Wtime();
+
+            // Thread-level seams first, then the rank-level reduction
+            RleSummary local = scan_slab(&pool, threads[ti], chunks, num_chunks);
+            RleSummary total;
+            RLE_PROF_BEGIN(RLE_PROF_STITCH);
+            MPI_Reduce(&local, &total, 1, summary_type, stitch_op, 0, comm);
+            RLE_PROF_END(RLE_PROF_STITCH);
+
+            double end = MPI_Wtime();
+
+            if (rank == 0) {
+                times[ri][ti] = end - start;
+                if (ri == 0 && ti == 0) {
+                    memcpy(first_costs, total.costs, sizeof(first_costs));
+                } else if (memcmp(first_costs, total.costs, sizeof(first_costs)) != 0) {
+                    fprintf(stderr, "Mismatch with %d ranks x %d threads.\n", r, threads[ti]);
+                    mismatch = 1;
+                }
+            }
+        }
+
+        MPI_Op_free(&stitch_op);
+        MPI_Type_free(&summary_type);
+        MPI_Comm_free(&comm);
+        free(chunks);
+        free(slab);
+        slab = NULL;
+    }
+
+    RLE_PROF_BEGIN(RLE_PROF_REPORT);
+    if (rank == 0) {
+        print_results(first_costs);
+
+        // Rows are rank counts, columns thread counts per rank
+        printf("\n=== Scaling table: seconds (speedup vs %d x %d) ===\n", ranks[0], threads[0]);
+        printf("ranks \\ threads");
+        for (int ti = 0; ti < num_threads; ++ti) printf(" %17d", threads[ti]);
+        printf("\n");
+        for (int ri = 0; ri < num_ranks; ++ri) {
+            printf("%15d", ranks[ri]);
+            for (int ti = 0; ti < num_threads; ++ti) {
+                printf("  %.6f (%5.2fx)", times[ri][ti], times[0][0] / times[ri][ti]);
+            }
+            printf("\n");
+        }
+        if (mismatch) fprintf(stderr, "Error: not all configurations gave the same costs.\n");
+    }
+    RLE_PROF_END(RLE_PROF_REPORT);
+    RLE_PROF_REPORT_MPI(MPI_COMM_WORLD, 0);
+    RLE_PROF_CLOSE();
+
+    rle_pool_stop(&pool);
+    MPI_Finalize();
+    // Only rank 0 compares the configurations, its status fails the job
+    return (rank == 0 && mismatch) ? 1 : 0;
+}
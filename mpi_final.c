@@ -5,46 +5,132 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "rle_hist.h"
+#include "rle_analyzer.h"
+#include "rle_summary.h"
+#include "rle_sweep.h"
+#include "rle_adapt.h"
+#include "rle_codes.h"
+#include "rle_volume.h"
+#include "rle_prof.h"
+
+// --mpiio cita po blokoch tejto velkosti (musi sa zmestit do int pre MPI)
+#define IO_BLOCK ((uint64_t)64 * 1024 * 1024)
+
 int main(int argc, char **argv) {
-    const int NX = 1024;
-    const int NY = 1024;
-    const int NZ = 314;
-    const uint8_t THRESH = 25;
+    // prah pre 8-bitove data, 16-bitove sa pri citani oknuju na 0/1 (rle_volume.h)
+    const uint8_t THRESH_U8 = 25;
 
     MPI_Init(&argc, &argv);
     int rank, nprocs;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
 
-    const uint64_t NV = (uint64_t)NX * (uint64_t)NY * (uint64_t)NZ;
+    // --hist: pocas skenu sa iba pocitaju dlzky runov, bity sa pocitaju az na konci
+    // --mpiio: kazdy proces si cita iba svoj kus suboru (MPI-IO), ziadny Scatterv
+    // --sweep T1,T2,..: tabulka bitov pre vsetky prahy naraz, jeden prechod cez data
+    // --adaptive BLOK: bity aj pre kazdy blok zvlast a najlepsie N pre kazdy blok
+    // --input SUBOR: iny objem nez c8.raw, aj s hlavickou .mhd alebo .nrrd
+    // --threshold T, --window LO,HI: prah pre 8-bitove a okno pre 16-bitove data
+    int use_hist = 0;
+    int use_mpiio = 0;
+    uint8_t sweep_thr[RLE_SWEEP_MAX];
+    int sweep_count = 0;
+    uint64_t adapt_block = 0;
+    const char *adapt_arg = NULL;
+    const char *input_path = "c8.raw";
+    RleVolumeParams params;
+    rle_volume_params_init(&params, THRESH_U8);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--hist") == 0) {
+            use_hist = 1;
+        } else if (strcmp(argv[i], "--mpiio") == 0) {
+            use_mpiio = 1;
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc &&
+                   (sweep_count = rle_sweep_parse(argv[i + 1], sweep_thr)) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc) {
+            // rozmery rezu su zname az po otvoreni objemu
+            adapt_arg = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (rle_volume_parse_arg(argc, argv, &i, &params) > 0) {
+            // --threshold alebo --window
+        } else {
+            if (rank == 0) fprintf(stderr, "Pouzitie: %s [--hist | --sweep T1,T2,.. | --adaptive slice|rows:K|VOXELY] [--mpiio] [--input SUBOR] [--threshold T] [--window LO,HI]\n", argv[0]);
+            MPI_Finalize();
+            return 1;
+        }
+    }
+
+    // hlavicku si cita kazdy proces sam, je to par riadkov
+    RleVolumeDesc input;
+    const char *err = rle_volume_open(input_path, &params, &input);
+    if (err) {
+        if (rank == 0) fprintf(stderr, "%s: %s\n", input_path, err);
+        MPI_Finalize();
+        return 1;
+    }
+    const uint8_t THRESH = input.threshold;
+    const size_t VB = rle_volume_voxel_bytes(&input);
+    if (adapt_arg && rle_adapt_parse(adapt_arg, input.x, input.y, &adapt_block) != 0) {
+        if (rank == 0) fprintf(stderr, "Zly blok pre --adaptive: %s\n", adapt_arg);
+        MPI_Finalize();
+        return 1;
+    }
+    // --sweep potrebuje povodne hodnoty, nie okno 0/1
+    if (sweep_count > 0 && rle_volume_windowed(&input)) {
+        if (rank == 0) fprintf(stderr, "--sweep funguje iba s 8-bitovymi datami\n");
+        MPI_Finalize();
+        return 1;
+    }
+    if (rank == 0) rle_volume_print(&input);
+
+    if (use_hist + (sweep_count > 0) + (adapt_block > 0) > 1) {
+        if (rank == 0) fprintf(stderr, "--hist, --sweep a --adaptive sa nedaju kombinovat\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    const uint64_t NV = rle_volume_voxels(&input);
     uint8_t *full_buf = NULL;
 
-    // root nacita cely subor do pamate
-    if (rank == 0) {
-        FILE *f = fopen("c8.raw", "rb");
-        if (!f) {
-            fprintf(stderr, "Nepodarilo sa otvorit subor %s\n", argv[1]);
+    // rozdelenie segmentov, vsetko v 64 bitoch
+    uint64_t base = NV / nprocs;
+    uint64_t rem = NV % nprocs;
+    uint64_t my_count = base + ((uint64_t)rank < rem ? 1 : 0);
+    uint64_t my_offset = (uint64_t)rank * base + ((uint64_t)rank < rem ? (uint64_t)rank : rem);
+
+    // Scatterv berie int pocty a posuny, nad 2 GB by to pretieklo
+    if (!use_mpiio && NV > (uint64_t)INT32_MAX) {
+        if (rank == 0) fprintf(stderr, "Obraz ma viac ako 2 GB, pouzi --mpiio\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    // root nacita cely subor do pamate (16-bitove voxely uz ako okno 0/1)
+    if (rank == 0 && !use_mpiio) {
+        RLE_PROF_BEGIN(RLE_PROF_LOAD);
+        int fd = open(input.path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Nepodarilo sa otvorit subor %s\n", input.path);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
         full_buf = (uint8_t*)malloc((size_t)NV);
         if (!full_buf) {
             fprintf(stderr, "Nedostatok pamate pre nacitanie obrazu (%" PRIu64 " bytes)\n", NV);
-            fclose(f);
+            close(fd);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        size_t read = fread(full_buf, 1, (size_t)NV, f);
-        if (read != (size_t)NV) {
-            fprintf(stderr, "Chyba pri nacitani súboru: prečítané %zu namiesto %" PRIu64 "\n", read, NV);
-            fclose(f);
+        if (rle_volume_pread(fd, &input, 0, (size_t)NV, full_buf) != 0) {
+            fprintf(stderr, "Chyba pri citani suboru %s\n", input.path);
+            close(fd);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        fclose(f);
+        close(fd);
+        RLE_PROF_END(RLE_PROF_LOAD);
     }
 
-    // rozdelenie segmentov
-    uint64_t base = NV / nprocs;
-    uint64_t rem = NV % nprocs;
-
     int *sendcounts = (int*)malloc(nprocs * sizeof(int));
     int *displs = (int*)malloc(nprocs * sizeof(int));
     if (!sendcounts || !displs) {
@@ -53,7 +139,7 @@ int main(int argc, char **argv) {
     }
 
     uint64_t offset = 0;
-    for (int i = 0; i < nprocs; ++i) {
+    for (int i = 0; i < nprocs && !use_mpiio; ++i) {
         uint64_t cnt = base + (i < (int)rem ? 1 : 0);
         sendcounts[i] = (int)cnt;
         displs[i] = (int)offset;
@@ -61,148 +147,244 @@ int main(int argc, char **argv) {
     }
 
     // pre istotu barrier, potom sa zacne merat cas
+    // (pri --mpiio je v case aj citanie suboru)
     MPI_Barrier(MPI_COMM_WORLD);
     double t_start = MPI_Wtime();
+    double io_wait = 0.0;
 
-    // buffer pre kazdy proces
-    int recvcount = sendcounts[rank];
-    uint8_t *local_buf = NULL;
-    if (recvcount > 0) {
-        local_buf = (uint8_t*)malloc((size_t)recvcount);
-        if (!local_buf) {
-            fprintf(stderr, "Process %d: nedostatok pamate pre local_buf\n", rank);
+    // pre kazdu L v [2..17] budeme pocitat lokalny pocet bitov
+    const int Lmin = 2;
+    const int Lmax = 17;
+    const int NL = Lmax - Lmin + 1; // 16
+
+    RleHist hist;
+    if (use_hist && rle_hist_init(&hist) != 0) {
+        fprintf(stderr, "Process %d: nedostatok pamate pre histogram\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // stav skenu (rle_analyzer.h), otvoreny run sa prenasa z jedneho bloku
+    // do dalsieho, pri --hist sa runy iba pocitaju do histogramu
+    RleAnalyzer an;
+    rle_begin(&an, THRESH);
+    if (use_hist) rle_count_into(&an, &hist);
+
+    // pri --sweep sa data posielaju do RleSweep namiesto analyzatora
+    RleSweep sweep;
+    if (sweep_count > 0) rle_sweep_begin(&sweep, sweep_thr, sweep_count);
+
+    // pri --adaptive ide sken cez RleBlockScan, ktory runy orezava na
+    // hraniciach blokov. Kazdy proces ma pole suhrnov vsetkych blokov,
+    // vyplni iba tie, do ktorych zasahuje jeho segment.
+    uint64_t num_blocks = adapt_block ? rle_adapt_num_blocks(NV, adapt_block) : 0;
+    RleSummary *blocks = NULL;
+    RleBlockScan block_scan;
+    if (adapt_block) {
+        blocks = (RleSummary*)malloc(num_blocks * sizeof(RleSummary));
+        if (!blocks) {
+            fprintf(stderr, "Process %d: nedostatok pamate pre bloky\n", rank);
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
+        for (uint64_t b = 0; b < num_blocks; ++b) rle_summary_init(&blocks[b]);
+        rle_block_scan_begin(&block_scan, blocks, adapt_block, my_offset, THRESH);
     }
 
-    // MPI_Scatterv pre distribuciu bytov
-    MPI_Scatterv(full_buf, sendcounts, displs, MPI_UNSIGNED_CHAR,
-                 local_buf, recvcount, MPI_UNSIGNED_CHAR,
-                 0, MPI_COMM_WORLD);
+    uint8_t *local_buf = NULL;
+    if (use_mpiio) {
+        // citanie sa prekryva so skenom, cely cyklus ide do fazy scan
+        RLE_PROF_BEGIN(RLE_PROF_SCAN);
+        // kazdy proces cita svoj rozsah [my_offset, my_offset + my_count)
+        // po blokoch. Kym sa skenuje blok k, blok k+1 sa uz cita
+        // (MPI_File_iread_at_all), takze sken nezacina az po nacitani vsetkeho.
+        // 16-bitove voxely sa citaju do io_buf a po blokoch oknuju do win_buf
+        MPI_File fh;
+        if (MPI_File_open(MPI_COMM_WORLD, input.path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+            if (rank == 0) fprintf(stderr, "Nepodarilo sa otvorit subor %s\n", input.path);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        MPI_Offset file_size = 0;
+        MPI_File_get_size(fh, &file_size);
+        if ((uint64_t)file_size < input.offset + NV * VB) {
+            if (rank == 0) fprintf(stderr, "Subor %s je kratsi ako %" PRIu64 " bytes\n", input.path, input.offset + NV * VB);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-    if (rank == 0) {
-        free(full_buf);
-        full_buf = NULL;
-    }
+        // collective volania musia urobit vsetky procesy rovnako vela krat,
+        // takze pocet blokov sa rata z najvacsieho segmentu
+        uint64_t max_count = base + (rem ? 1 : 0);
+        uint64_t nblocks = (max_count + IO_BLOCK - 1) / IO_BLOCK;
+        size_t buf_size = (size_t)(my_count < IO_BLOCK ? my_count : IO_BLOCK);
+        uint8_t *io_buf[2];
+        io_buf[0] = (uint8_t*)malloc(buf_size * VB + 1);
+        io_buf[1] = (uint8_t*)malloc(buf_size * VB + 1);
+        uint8_t *win_buf = rle_volume_windowed(&input) ? (uint8_t*)malloc(buf_size + 1) : NULL;
+        if (!io_buf[0] || !io_buf[1] || (rle_volume_windowed(&input) && !win_buf)) {
+            fprintf(stderr, "Process %d: nedostatok pamate pre citanie\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-    // pre kazdu L v [2..17] budeme pocitat lokalny pocet bitov
-    const int Lmin = 2;
-    const int Lmax = 17;
-    const int NL = Lmax - Lmin + 1; // 16
-    uint64_t *local_bits = (uint64_t*)malloc(NL * sizeof(uint64_t));
-    for (int i = 0; i < NL; ++i) local_bits[i] = 0ULL;
-
-    uint8_t first_sym = 0, last_sym = 0;
-    uint64_t first_len = 0, last_len = 0;
-    int have_data = (recvcount > 0) ? 1 : 0;
-
-    if (have_data) {
-        uint8_t prev_bit = (local_buf[0] > THRESH) ? 1 : 0;
-        uint64_t runlen = 1;
-        for (int i = 1; i < recvcount; ++i) {
-            uint8_t b = (local_buf[i] > THRESH) ? 1 : 0;
-            if (b == prev_bit) {
-                runlen++;
+        MPI_Request req;
+        uint64_t blk_len = (my_count < IO_BLOCK) ? my_count : IO_BLOCK;
+        MPI_File_iread_at_all(fh, (MPI_Offset)(input.offset + my_offset * VB), io_buf[0], (int)(blk_len * VB),
+                              MPI_UNSIGNED_CHAR, &req);
+
+        for (uint64_t k = 0; k < nblocks; ++k) {
+            uint64_t done = k * IO_BLOCK;
+            uint64_t n = (done < my_count) ? my_count - done : 0;
+            if (n > IO_BLOCK) n = IO_BLOCK;
+
+            double t_wait = MPI_Wtime();
+            MPI_Status status;
+            MPI_Wait(&req, &status);
+            io_wait += MPI_Wtime() - t_wait;
+
+            int got = 0;
+            MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &got);
+            if ((uint64_t)got != n * VB) {
+                fprintf(stderr, "Process %d: precitane %d namiesto %" PRIu64 " bytes\n", rank, got, n * VB);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+
+            // dalsi blok sa cita, kym skenujeme tento
+            if (k + 1 < nblocks) {
+                uint64_t next_done = done + IO_BLOCK;
+                uint64_t next_n = (next_done < my_count) ? my_count - next_done : 0;
+                if (next_n > IO_BLOCK) next_n = IO_BLOCK;
+                MPI_File_iread_at_all(fh, (MPI_Offset)(input.offset + (my_offset + next_done) * VB),
+                                      io_buf[(k + 1) & 1], (int)(next_n * VB), MPI_UNSIGNED_CHAR, &req);
+            }
+
+            uint8_t *data = io_buf[k & 1];
+            if (win_buf) {
+                rle_volume_convert(&input, data, (size_t)n, win_buf);
+                data = win_buf;
+            }
+            if (sweep_count > 0) {
+                rle_sweep_feed(&sweep, data, (size_t)n);
+            } else if (adapt_block) {
+                rle_block_scan_feed(&block_scan, data, n);
             } else {
-                // pridat do local_bits pre kazde L
-                for (int L = Lmin; L <= Lmax; ++L) {
-                    uint64_t maxlen = ((1ULL << L) - 1ULL);
-                    uint64_t npackets = (runlen + maxlen - 1ULL) / maxlen;
-                    local_bits[L - Lmin] += npackets * (uint64_t)(L + 1);
-                }
-                // ak to je prvy run nastavit tieto veci
-                if (first_len == 0) {
-                    first_sym = prev_bit;
-                    first_len = runlen;
-                }
-                // reset
-                prev_bit = b;
-                runlen = 1;
+                rle_feed(&an, data, (size_t)n);
             }
         }
-        // posledny run
-        for (int L = Lmin; L <= Lmax; ++L) {
-            uint64_t maxlen = ((1ULL << L) - 1ULL);
-            uint64_t npackets = (runlen + maxlen - 1ULL) / maxlen;
-            local_bits[L - Lmin] += npackets * (uint64_t)(L + 1);
+
+        MPI_File_close(&fh);
+        RLE_PROF_END(RLE_PROF_SCAN);
+        free(io_buf[0]);
+        free(io_buf[1]);
+        free(win_buf);
+    } else {
+        // buffer pre kazdy proces
+        int recvcount = sendcounts[rank];
+        if (recvcount > 0) {
+            local_buf = (uint8_t*)malloc((size_t)recvcount);
+            if (!local_buf) {
+                fprintf(stderr, "Process %d: nedostatok pamate pre local_buf\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
         }
-        // ak ma segment iba jeden run tak pre istotu setnut tu ako fallabck
-        if (first_len == 0) {
-            first_sym = prev_bit;
-            first_len = runlen;
+
+        // MPI_Scatterv pre distribuciu bytov
+        RLE_PROF_BEGIN(RLE_PROF_LOAD);
+        MPI_Scatterv(full_buf, sendcounts, displs, MPI_UNSIGNED_CHAR,
+                     local_buf, recvcount, MPI_UNSIGNED_CHAR,
+                     0, MPI_COMM_WORLD);
+
+        if (rank == 0) {
+            free(full_buf);
+            full_buf = NULL;
         }
+        RLE_PROF_END(RLE_PROF_LOAD);
 
-        last_sym = prev_bit;
-        last_len = runlen;
-    } else {
-        // ziadne data
-        first_sym = 255;
-        last_sym = 255;
-        first_len = 0;
-        last_len = 0;
-    }
-
-    uint64_t *gather_bits = NULL;
-    uint8_t *gather_first_sym = NULL;
-    uint8_t *gather_last_sym = NULL;
-    uint64_t *gather_first_len = NULL;
-    uint64_t *gather_last_len = NULL;
-
-    if (rank == 0) {
-        gather_bits = (uint64_t*)malloc(nprocs * NL * sizeof(uint64_t));
-        gather_first_sym = (uint8_t*)malloc(nprocs * sizeof(uint8_t));
-        gather_last_sym = (uint8_t*)malloc(nprocs * sizeof(uint8_t));
-        gather_first_len = (uint64_t*)malloc(nprocs * sizeof(uint64_t));
-        gather_last_len = (uint64_t*)malloc(nprocs * sizeof(uint64_t));
-        if (!gather_bits || !gather_first_sym || !gather_last_sym || !gather_first_len || !gather_last_len) {
-            fprintf(stderr, "Root: nedostatok pamate pre zhromaždovanie.\n");
-            MPI_Abort(MPI_COMM_WORLD, 1);
+        RLE_PROF_BEGIN(RLE_PROF_SCAN);
+        if (sweep_count > 0) {
+            rle_sweep_feed(&sweep, local_buf, (size_t)recvcount);
+        } else if (adapt_block) {
+            rle_block_scan_feed(&block_scan, local_buf, (uint64_t)recvcount);
+        } else {
+            rle_feed(&an, local_buf, (size_t)recvcount);
         }
+        RLE_PROF_END(RLE_PROF_SCAN);
     }
 
-    MPI_Gather(local_bits, NL, MPI_UNSIGNED_LONG_LONG,
-               gather_bits, NL, MPI_UNSIGNED_LONG_LONG,
-               0, MPI_COMM_WORLD);
+    // suhrn segmentu tohto procesu: bity pre kazde L, pocet runov a okrajove runy
+    RLE_PROF_BEGIN(RLE_PROF_STITCH);
+    RleSummary local_sum = rle_finish(&an);
 
-    MPI_Gather(&first_sym, 1, MPI_UNSIGNED_CHAR, gather_first_sym, 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-    MPI_Gather(&last_sym, 1, MPI_UNSIGNED_CHAR, gather_last_sym, 1, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-    MPI_Gather(&first_len, 1, MPI_UNSIGNED_LONG_LONG, gather_first_len, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
-    MPI_Gather(&last_len, 1, MPI_UNSIGNED_LONG_LONG, gather_last_len, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    // pri --hist sa bity spocitaju az teraz, raz z histogramu
+    if (use_hist && !local_sum.empty) rle_hist_costs(&hist, Lmin, Lmax, local_sum.costs);
 
-    // root upravi sucet lokalnych bitov a spojenia medzi procesmi
-    if (rank == 0) {
-        uint64_t total_bits[NL];
-        for (int i = 0; i < NL; ++i) total_bits[i] = 0ULL;
+    // pri --adaptive su suhrnom segmentu jeho kusy blokov zlucene za sebou,
+    // zlucenie spoji aj runy orezane na hraniciach blokov
+    if (adapt_block && my_count > 0) {
+        rle_block_scan_finish(&block_scan);
+        uint64_t b_first = my_offset / adapt_block;
+        uint64_t b_last = (my_offset + my_count - 1) / adapt_block;
+        for (uint64_t b = b_first; b <= b_last; ++b) local_sum = rle_summary_merge(&local_sum, &blocks[b]);
+    }
 
-        for (int p = 0; p < nprocs; ++p) {
-            for (int i = 0; i < NL; ++i) {
-                total_bits[i] += gather_bits[p * NL + i];
-            }
-        }
+    // jeden MPI_Reduce so zlucovanim suhrnov (rle_summary_merge) namiesto
+    // piatich MPI_Gather a prechodu cez spoje na roote. Operacia je
+    // asociativna, takze MPI ju moze robit v strome, ale nie komutativna,
+    // procesy sa zlucuju v poradi rankov.
+    MPI_Datatype summary_type = rle_summary_mpi_type();
+    MPI_Op stitch_op = rle_summary_mpi_op();
+
+    // pri --sweep ide naraz pole suhrnov, jeden pre kazdy prah,
+    // operacia ich zlucuje po prvkoch
+    RleSummary total_sum;
+    RleSummary sweep_totals[RLE_SWEEP_MAX];
+    uint64_t code_costs[RLE_CODE_MAX_VARIANTS];
+    if (sweep_count > 0) {
+        rle_sweep_finish(&sweep);
+        MPI_Reduce(sweep.sum, sweep_totals, sweep_count, summary_type, stitch_op, 0, MPI_COMM_WORLD);
+    } else if (use_hist) {
+        // pri --hist aj ostatne kody dlzok runov (rle_codes.h): bity kazdeho
+        // procesu z jeho histogramu idu spolu so suhrnom, a ta ista
+        // redukcia opravi aj ich spoje, tiez v strome
+        MPI_Datatype codes_type = rle_codes_mpi_type();
+        MPI_Op codes_op = rle_codes_mpi_op();
+        RleCodeSummary local_codes, total_codes;
+        memset(&local_codes, 0, sizeof(local_codes));
+        local_codes.sum = local_sum;
+        rle_codes_from_hist(&hist, local_codes.costs);
+        MPI_Reduce(&local_codes, &total_codes, 1, codes_type, codes_op, 0, MPI_COMM_WORLD);
+        total_sum = total_codes.sum;
+        memcpy(code_costs, total_codes.costs, sizeof(code_costs));
+        MPI_Op_free(&codes_op);
+        MPI_Type_free(&codes_type);
+    } else {
+        MPI_Reduce(&local_sum, &total_sum, 1, summary_type, stitch_op, 0, MPI_COMM_WORLD);
+    }
 
-        // upravy pre overflow (idk jak to nazvat (p a p+1))
-        for (int p = 0; p < nprocs - 1; ++p) {
-            uint8_t sA = gather_last_sym[p];
-            uint8_t sB = gather_first_sym[p+1];
-            if (sA == 255 || sB == 255) continue; // niektory proces nemal data
-            if (sA == sB) {
-                uint64_t lenA = gather_last_len[p];
-                uint64_t lenB = gather_first_len[p+1];
-                uint64_t merged = lenA + lenB;
-                for (int L = Lmin; L <= Lmax; ++L) {
-                    uint64_t maxlen = ((1ULL << L) - 1ULL);
-                    uint64_t packA = (lenA + maxlen - 1ULL) / maxlen;
-                    uint64_t packB = (lenB + maxlen - 1ULL) / maxlen;
-                    uint64_t packM = (merged + maxlen - 1ULL) / maxlen;
-                    uint64_t penalty = (packA + packB);
-                    uint64_t gain = packM;
-                    uint64_t delta_bits = (gain > penalty) ? (gain - penalty) * (uint64_t)(L + 1) : (penalty - gain) * (uint64_t)(L + 1);
-                    // actually need to subtract penalty*(L+1) then add gain*(L+1)
-                    total_bits[L - Lmin] -= (penalty * (uint64_t)(L + 1));
-                    total_bits[L - Lmin] += (packM * (uint64_t)(L + 1));
-                }
+    // bloky sa zlucuju po prvkoch, blok rozdeleny medzi procesy sa tak zlepi
+    RleSummary *all_blocks = NULL;
+    if (adapt_block) {
+        if (rank == 0) {
+            all_blocks = (RleSummary*)malloc(num_blocks * sizeof(RleSummary));
+            if (!all_blocks) {
+                fprintf(stderr, "Nedostatok pamate pre bloky\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
             }
         }
+        MPI_Reduce(blocks, all_blocks, (int)num_blocks, summary_type, stitch_op, 0, MPI_COMM_WORLD);
+    }
+
+    MPI_Op_free(&stitch_op);
+    MPI_Type_free(&summary_type);
+    RLE_PROF_END(RLE_PROF_STITCH);
+
+    RLE_PROF_BEGIN(RLE_PROF_REPORT);
+
+    if (rank == 0 && sweep_count > 0) {
+        double elapsed = MPI_Wtime() - t_start;
+
+        printf("=== Sweeping %d thresholds with %d MPI processess ===\n", sweep_count, nprocs);
+        rle_sweep_print(sweep_thr, sweep_count, sweep_totals);
+        printf(">> Computation Time: %.6f seconds%s\n", elapsed,
+               use_mpiio ? " (including MPI-IO read)" : "");
+    } else if (rank == 0) {
+        uint64_t *total_bits = total_sum.costs;
 
         // koniec pocitania, stopneme casovac
         double t_end = MPI_Wtime();
@@ -217,23 +399,46 @@ int main(int argc, char **argv) {
             printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
                 L, packet_bits, bits, mb);
         }
-        printf(">> Computation Time: %.6f seconds\n", elapsed);
+        printf(">> Computation Time: %.6f seconds%s\n", elapsed,
+               use_mpiio ? " (including MPI-IO read)" : "");
+
+        if (use_hist) {
+            uint64_t best = total_bits[0];
+            for (int i = 1; i < NL; ++i) if (total_bits[i] < best) best = total_bits[i];
+            rle_codes_print(code_costs, best);
+        }
+
+        if (adapt_block) {
+            RleAdaptPlan plan;
+            if (rle_adapt_plan(all_blocks, num_blocks, adapt_block, &plan) != 0) {
+                fprintf(stderr, "Nedostatok pamate pre plan\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            rle_adapt_print(&plan, total_bits);
+            rle_adapt_free(&plan);
+        }
     }
 
+    // najdlhsie cakanie na disk zo vsetkych procesov
+    if (use_mpiio) {
+        double max_wait = 0.0;
+        MPI_Reduce(&io_wait, &max_wait, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0) printf(">> I/O Wait (slowest rank): %.6f seconds\n", max_wait);
+    }
+    RLE_PROF_END(RLE_PROF_REPORT);
+
+    // pri -DRLE_PROF root vypise fazy kazdeho procesu a nerovnovahu medzi nimi
+    RLE_PROF_REPORT_MPI(MPI_COMM_WORLD, 0);
+    RLE_PROF_CLOSE();
+
     // cleanup na konci programu a nech tu neni tak prazdno komentarovo :D
     if (local_buf) free(local_buf);
-    free(local_bits);
     free(sendcounts);
     free(displs);
 
-    // cleanup pre rank 0... nech neni predosli koment osamely :D
-    if (rank == 0) {
-        free(gather_bits);
-        free(gather_first_sym);
-        free(gather_last_sym);
-        free(gather_first_len);
-        free(gather_last_len);
-    }
+    if (use_hist) rle_hist_free(&hist);
+    free(blocks);
+    free(all_blocks);
 
     MPI_Finalize();
     return 0;
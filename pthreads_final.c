@@ -1,46 +1,128 @@
-// Needed for clock_gettime
-#define _POSIX_C_SOURCE 199309L
+// Needed for clock_gettime, posix_madvise and the CPU affinity calls
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <time.h>
 #include <string.h>
+#include <stdatomic.h>
 
-#define X 1024
-#define Y 1024
-#define Z 314
-#define NUM_VOXELS ((size_t)X * Y * Z)
-#define THRESHOLD 25
+#include "rle_simd.h"
+#include "rle_hist.h"
+#include "rle_encode.h"
+#include "rle_decode.h"
+#include "rle_io.h"
+#include "rle_summary.h"
+#include "rle_pool.h"
+#include "rle_mask.h"
+#include "rle_sweep.h"
+#include "rle_order.h"
+#include "rle_adapt.h"
+#include "rle_codes.h"
+#include "rle_gray.h"
+#include "rle_volume.h"
+#include "rle_predict.h"
+#include "rle_analyzer.h"
+#include "rle_prof.h"
+
+// Threshold for 8-bit volumes
+#define THRESHOLD_U8 25
+
+// The volume being scanned, c8.raw unless --input names another file.
+// 16-bit volumes are windowed to 0/1 on load and scanned at threshold 0.
+RleVolumeDesc input;
+#define X (input.x)
+#define Y (input.y)
+#define Z (input.z)
+#define NUM_VOXELS ((size_t)rle_volume_voxels(&input))
+#define THRESHOLD (input.threshold)
 
 // We are testing RLE bit-widths from N=2 up to N=17
 #define MIN_N 2
 #define MAX_N 17
 #define RLE_VARIANTS (MAX_N - MIN_N + 1)
 
+// Work is handed out in chunks of this many voxels. 1 MB keeps a chunk in L2
+// and gives a few hundred chunks, enough for slow threads to be balanced out.
+#define CHUNK_VOXELS ((size_t)1 << 20)
+
+// The pool is created once with the largest thread count we test
+#define MAX_THREADS 16
+
+// Size of a cache line, per-chunk data is aligned to it
+#define CACHE_LINE 64
+
 uint8_t *volume = NULL;
 
+// Set by --hist: threads only count run lengths, costs are computed at the end
+int use_hist = 0;
+
+// Set by --encode: after the analysis, write the stream for the cheapest N
+int use_encode = 0;
+
+// Set by --decode: index the encoded stream and decode it back in parallel
+int use_decode = 0;
+
+// Set by --mmap: map the file instead of reading it, and skip the warm-up pass
+int use_mmap = 0;
+
+// Set by --numa: pin every worker to a core and let each worker load (and so
+// first-touch) the part of the volume it is going to scan
+int use_numa = 0;
+
+// Set by --mask: threshold the volume once into a 1-bit mask, every scan
+// and encode after that reads the mask instead of the volume
+int use_mask = 0;
+RleMask mask;
+
+// Set by --sweep: cost tables for all these thresholds in one pass,
+// instead of the analysis for THRESHOLD
+uint8_t sweep_thr[RLE_SWEEP_MAX];
+int sweep_count = 0;
+
+// Set by --orders: after the analysis, also cost the volume scanned along Y,
+// along Z and in Morton and Hilbert order
+int use_orders = 0;
+
+// Set by --adaptive BLOCK: chunks are also cut at every block edge, and the
+// chunk summaries are folded per block for the adaptive N planner
+uint64_t adapt_block = 0;
+RleSummary *adapt_blocks = NULL;
+
+// Set by --gray: also cost (and with --encode write) the raw byte values as
+// PackBits, quantised to the top gray_bits bits (--gray-bits)
+int use_gray = 0;
+int gray_bits = 8;
+
+// Set by --predict: also cost the volume coded as the XOR of every row with
+// the row above and of every slice with the slice before (rle_predict.h)
+int use_predict = 0;
+
+// --predict hands out whole slices, about this many voxels per chunk. The
+// first slice of a chunk needs the slice before it thresholded once more,
+// so chunks are a few slices long.
+#define PREDICT_CHUNK_VOXELS ((size_t)4 << 20)
+
 // We don't want to store millions of run structs.
-// Instead, each thread keeps its own local stats to avoid locking.
+// Instead, each chunk gets its own summary, written only by the thread that
+// scanned it, so no locking is needed.
+// Every summary starts on its own cache line, so two threads updating the
+// costs of neighbouring chunks never write to the same line.
 typedef struct {
     size_t start_index;
     size_t end_index;
 
-    // These fields are crucial for the "stitching" phase later.
-    // We need to know exactly how a chunk starts and ends to merge runs across threads.
-    uint8_t first_val;
-    size_t first_len;
-    uint8_t last_val;
-    size_t last_len;
-
-    size_t total_runs_count;
-
+    // Costs, run count and the edge runs of the chunk. The edge runs are
+    // crucial for the "stitching" phase later (see rle_summary.h).
     // Accumulate costs locally here.
     // If we updated a global array, the mutex contention would kill performance.
-    uint64_t bit_costs[RLE_VARIANTS];
+    RleSummary sum;
 
-    pthread_t tid;
-} ThreadData;
+    // Run-length histogram of the thread scanning this chunk,
+    // only used in --hist mode (NULL otherwise)
+    RleHist *hist;
+} __attribute__((aligned(CACHE_LINE))) ChunkData;
 
 double get_time(void) {
     struct timespec ts;
@@ -51,20 +133,47 @@ double get_time(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-int load_volume(const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) return 1;
+// Reads the volume described by 'input', windowing 16-bit voxels on the way.
+int load_volume(void) {
+    int fd = open(input.path, O_RDONLY);
+    if (fd < 0) return 1;
 
     volume = malloc(NUM_VOXELS);
-    if (!volume) { fclose(f); return 1; }
+    if (!volume) { close(fd); return 1; }
 
-    if (fread(volume, 1, NUM_VOXELS, f) != NUM_VOXELS) {
-        free(volume); fclose(f); return 1;
+    if (rle_volume_pread(fd, &input, 0, NUM_VOXELS, volume) != 0) {
+        free(volume); close(fd); return 1;
     }
-    fclose(f);
+    close(fd);
     return 0;
 }
 
+// Maps the file instead of copying it into a malloc'd buffer. Pages are read
+// on first touch, by whichever thread scans them, so the first test also
+// pays for the I/O. 8-bit volumes only; a header in front of the voxels is
+// mapped too and skipped.
+int map_volume(void) {
+    int fd = open(input.path, O_RDONLY);
+    if (fd < 0) return 1;
+
+    // Pages past the end of the file would fault with SIGBUS on first touch,
+    // so a file that shrank since rle_volume_open() is an error here
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < input.offset + NUM_VOXELS) {
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, input.offset + NUM_VOXELS, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    posix_madvise(map, input.offset + NUM_VOXELS, POSIX_MADV_SEQUENTIAL);
+    volume = (uint8_t *)map + input.offset;
+    return 0;
+}
+
+#ifdef RLE_SCALAR
 // Calculates how many bits a run of length 'L' takes up.
 // If the run is longer than the packet capacity (2^n - 1), we need multiple packets.
 static uint64_t calc_bits_for_run(size_t length, int n_bits) {
@@ -75,14 +184,43 @@ static uint64_t calc_bits_for_run(size_t length, int n_bits) {
     return packets * (n_bits + 1);
 }
 
-void *process_chunk(void *arg) {
-    ThreadData *data = (ThreadData *)arg;
+// A run inside the chunk just closed.
+static void chunk_add_run(void *arg, size_t len) {
+    ChunkData *data = (ChunkData *)arg;
+    RleSummary *sum = &data->sum;
 
-    if (data->start_index >= data->end_index) return NULL;
+    // If this was the very first run in the chunk, save its length
+    // so we can check it against the previous chunk later.
+    if (sum->runs == 0) {
+        sum->first_len = len;
+    }
+
+    if (data->hist) {
+        // Deferred mode: just count it, no divides in the hot loop
+        rle_hist_add(data->hist, len, 1);
+    } else {
+        // Calculate the cost for this run across all N variants
+        for (int n = MIN_N; n <= MAX_N; ++n) {
+            sum->costs[n - MIN_N] += calc_bits_for_run(len, n);
+        }
+    }
+
+    sum->runs++;
+}
+#endif
 
-    memset(data->bit_costs, 0, sizeof(data->bit_costs));
-    data->total_runs_count = 0;
+void process_chunk(ChunkData *data) {
+    if (data->start_index >= data->end_index) return;
 
+#ifndef RLE_SCALAR
+    // Vectorized scan through the analyzer (see rle_analyzer.h). Build with
+    // -DRLE_SCALAR to get the original per-voxel loop below as a reference.
+    // Chunks start at multiples of 64, so every chunk starts on a mask word.
+    data->sum = rle_analyze_range(volume, use_mask ? &mask : NULL, data->start_index, data->end_index,
+                                  THRESHOLD, data->hist);
+#else
+    rle_summary_init(&data->sum);
+    data->sum.empty = 0;
     size_t idx = data->start_index;
 
     // Initialize the very first run manually.
@@ -91,7 +229,7 @@ void *process_chunk(void *arg) {
     size_t current_len = 1;
     idx++;
 
-    data->first_val = current_val;
+    data->sum.first_val = current_val;
 
     // Scan through the rest of the assigned chunk
     for (; idx < data->end_index; ++idx) {
@@ -101,19 +239,7 @@ void *process_chunk(void *arg) {
             current_len++;
         } else {
             // The run just finished.
-
-            // If this was the very first run in the chunk, save its length
-            // so we can check it against the previous thread later.
-            if (data->total_runs_count == 0) {
-                data->first_len = current_len;
-            }
-
-            // Calculate the cost for this run across all N variants
-            for (int n = MIN_N; n <= MAX_N; ++n) {
-                data->bit_costs[n - MIN_N] += calc_bits_for_run(current_len, n);
-            }
-
-            data->total_runs_count++;
+            chunk_add_run(data, current_len);
 
             // Start the new run
             current_val = next_val;
@@ -122,120 +248,1226 @@ void *process_chunk(void *arg) {
     }
 
     // Handle the trailing run.
-    // If the whole chunk was just one massive run, first_len needs setting here.
-    if (data->total_runs_count == 0) {
-        data->first_len = current_len;
+    // If the whole chunk was just one massive run, first_len gets set here.
+    chunk_add_run(data, current_len);
+
+    // Save the details of the final run for stitching with the next chunk.
+    data->sum.last_val = current_val;
+    data->sum.last_len = current_len;
+    data->sum.single_run = (data->sum.runs == 1);
+#endif
+}
+
+void analyze_results(const ChunkData *chunks, size_t num_chunks, RleHist **hists, int num_hists,
+                     uint64_t *final_bit_counts) {
+    // Fold the chunk summaries in index order, no matter which threads
+    // scanned them. rle_summary_merge() is the stitching logic: if a run
+    // continued across a boundary it replaces the two split runs by one,
+    // and a chunk that is one single run keeps the merged run open.
+    // mpi_final.c stitches its ranks with the same function.
+    // In --hist mode the other run-length codes (rle_codes.h) get the same
+    // seam corrections, their run costs come from the histogram below.
+    RLE_PROF_BEGIN(RLE_PROF_STITCH);
+    RleSummary total;
+    rle_summary_init(&total);
+    uint64_t code_costs[RLE_CODE_MAX_VARIANTS] = { 0 };
+    for (size_t t = 0; t < num_chunks; ++t) {
+        if (use_hist) rle_codes_seam(code_costs, &total, &chunks[t].sum);
+        total = rle_summary_merge(&total, &chunks[t].sum);
     }
 
-    for (int n = MIN_N; n <= MAX_N; ++n) {
-        data->bit_costs[n - MIN_N] += calc_bits_for_run(current_len, n);
+    // Histogram mode: the chunks charged no costs during the scan, so the
+    // fold above only holds the seam corrections (as wrapped-around
+    // deltas). The cost of every scanned run comes from the per-thread
+    // counts, merged by simple addition.
+    if (use_hist) {
+        RleHist *merged = hists[0];
+        for (int t = 1; t < num_hists; ++t) {
+            rle_hist_merge(merged, hists[t]);
+        }
+        uint64_t run_costs[RLE_VARIANTS];
+        rle_hist_costs(merged, MIN_N, MAX_N, run_costs);
+        for (int i = 0; i < RLE_VARIANTS; ++i) total.costs[i] += run_costs[i];
+
+        uint64_t hist_codes[RLE_CODE_MAX_VARIANTS];
+        rle_codes_from_hist(merged, hist_codes);
+        for (int v = 0; v < rle_codes_variants(); ++v) code_costs[v] += hist_codes[v];
     }
 
-    data->total_runs_count++;
+    memcpy(final_bit_counts, total.costs, RLE_VARIANTS * sizeof(uint64_t));
+    RLE_PROF_END(RLE_PROF_STITCH);
 
-    // Save the details of the final run for stitching with the next thread.
-    data->last_val = current_val;
-    data->last_len = current_len;
+    RLE_PROF_BEGIN(RLE_PROF_REPORT);
+    printf("\n--- Final RLE Analysis ---\n");
+    for (int n = MIN_N; n <= MAX_N; ++n) {
+        int packet_bits = n + 1;
+        double mb = (double)final_bit_counts[n - MIN_N] / 8.0 / 1024.0 / 1024.0;
+        printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
+               n, packet_bits, final_bit_counts[n - MIN_N], mb);
+    }
 
-    return NULL;
+    if (use_hist) {
+        uint64_t best = final_bit_counts[0];
+        for (int i = 1; i < RLE_VARIANTS; ++i) if (final_bit_counts[i] < best) best = final_bit_counts[i];
+        rle_codes_print(code_costs, best);
+    }
+    RLE_PROF_END(RLE_PROF_REPORT);
 }
 
-void analyze_results(ThreadData *threads, int num_threads) {
-    uint64_t final_bit_counts[RLE_VARIANTS] = {0};
-    size_t total_runs = 0;
+size_t count_chunks(size_t voxels) {
+    return (voxels + CHUNK_VOXELS - 1) / CHUNK_VOXELS;
+}
 
-    // Step 1: Naive Sum
-    // Just add up what every thread found individually.
-    for (int t = 0; t < num_threads; ++t) {
-        total_runs += threads[t].total_runs_count;
-        for (int i = 0; i < RLE_VARIANTS; ++i) {
-            final_bit_counts[i] += threads[t].bit_costs[i];
+// Chunk boundaries of the scan and the encoder: every CHUNK_VOXELS, and with
+// --adaptive also every block edge, so no chunk spans two blocks. Writes
+// count + 1 starts (the last one is NUM_VOXELS) unless 'starts' is NULL, and
+// returns the number of chunks.
+size_t cut_chunks(size_t *starts) {
+    size_t count = 0;
+    for (size_t pos = 0; pos < NUM_VOXELS; ++count) {
+        if (starts) starts[count] = pos;
+        size_t next = (pos / CHUNK_VOXELS + 1) * CHUNK_VOXELS;
+        if (adapt_block) {
+            size_t edge = (pos / adapt_block + 1) * adapt_block;
+            if (edge < next) next = edge;
         }
+        pos = next < NUM_VOXELS ? next : NUM_VOXELS;
     }
+    if (starts) starts[count] = NUM_VOXELS;
+    return count;
+}
+
+typedef struct {
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} MaskJob;
 
-    // Step 2: Boundary Correction (The Stitching Logic)
-    // We check the seam between Thread T and Thread T+1.
-    for (int t = 0; t < num_threads - 1; ++t) {
-        ThreadData *curr = &threads[t];
-        ThreadData *next = &threads[t+1];
+void mask_worker(int worker, void *arg) {
+    MaskJob *job = (MaskJob *)arg;
+    (void)worker;
 
-        // If the run continued across the boundary (same value), we have a false split.
-        if (curr->last_val == next->first_val) {
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
 
-            // Merge the two runs into one.
-            total_runs--;
+        size_t end = (c == job->num_chunks - 1) ? NUM_VOXELS : (c + 1) * CHUNK_VOXELS;
+        rle_mask_build(&mask, volume, c * CHUNK_VOXELS, end, THRESHOLD);
+    }
+}
 
-            for (int n = MIN_N; n <= MAX_N; ++n) {
-                int idx = n - MIN_N;
+// --mask: thresholds the whole volume into 'mask', one chunk at a time.
+void build_mask(RlePool *pool, int num_threads) {
+    MaskJob job;
+    job.num_chunks = count_chunks(NUM_VOXELS);
+    atomic_init(&job.next_chunk, 0);
+    rle_pool_run(pool, num_threads, mask_worker, &job);
+}
 
-                // Subtract the cost of the two separate, smaller runs...
-                uint64_t cost_separate = calc_bits_for_run(curr->last_len, n) +
-                                         calc_bits_for_run(next->first_len, n);
+// Static split used in --numa mode: worker w of 'num_workers' owns chunks
+// [*first, *last). The same split decides who loads and who scans a chunk.
+void worker_chunks(size_t num_chunks, int worker, int num_workers, size_t *first, size_t *last) {
+    *first = num_chunks * (size_t)worker / (size_t)num_workers;
+    *last = num_chunks * (size_t)(worker + 1) / (size_t)num_workers;
+}
 
-                // ...and add the cost of the single, longer merged run.
-                uint64_t cost_merged   = calc_bits_for_run(curr->last_len + next->first_len, n);
+typedef struct {
+    int fd;
+    int num_workers;
+    atomic_int failed;
+} PlaceJob;
 
-                final_bit_counts[idx] = final_bit_counts[idx] - cost_separate + cost_merged;
-            }
+// Reads this worker's chunks straight into fresh pages. The worker is the
+// first to touch them, so the kernel puts them on the worker's NUMA node.
+void place_worker(int worker, void *arg) {
+    PlaceJob *job = (PlaceJob *)arg;
+    size_t num_chunks = count_chunks(NUM_VOXELS);
+    size_t first, last;
+    worker_chunks(num_chunks, worker, job->num_workers, &first, &last);
+
+    size_t off = first * CHUNK_VOXELS;
+    size_t end = (last == num_chunks) ? NUM_VOXELS : last * CHUNK_VOXELS;
+    if (off < end && rle_volume_pread(job->fd, &input, off, end - off, volume + off) != 0) {
+        atomic_store(&job->failed, 1);
+    }
+}
+
+// --numa: drops the current copy of the volume and lets workers
+// 0..num_threads-1 load their own part of it again. Called before every
+// scaling test, outside the timed region, since the owner of a chunk depends
+// on the thread count. 16-bit volumes are windowed by the loading workers.
+// Returns 0 on success.
+int place_volume(RlePool *pool, int num_threads) {
+    if (volume) munmap(volume, NUM_VOXELS);
+
+    // Anonymous pages get no physical memory until someone writes to them
+    volume = mmap(NULL, NUM_VOXELS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (volume == MAP_FAILED) {
+        volume = NULL;
+        return 1;
+    }
+
+    PlaceJob job;
+    job.fd = open(input.path, O_RDONLY);
+    if (job.fd < 0) {
+        munmap(volume, NUM_VOXELS);
+        volume = NULL;
+        return 1;
+    }
+    job.num_workers = num_threads;
+    atomic_init(&job.failed, 0);
+
+    rle_pool_run(pool, num_threads, place_worker, &job);
+
+    close(job.fd);
+    return atomic_load(&job.failed);
+}
+
+// Shared by the workers during one run_parallel_test().
+// Chunks are claimed with a single atomic counter, so a thread that is slowed
+// down (SMT sibling, noisy neighbour) simply ends up taking fewer of them.
+// In --numa mode every worker scans only the chunks it loaded instead, since
+// taking someone else's chunk would mean reading remote memory.
+typedef struct {
+    ChunkData *chunks;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+    int num_workers;
+    RleHist **hists;        // one per worker in --hist mode
+} ScanJob;
+
+// Every worker allocates and clears its own histogram, so in --numa mode it
+// lives on the worker's node.
+void hist_init_worker(int worker, void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    job->hists[worker] = malloc(sizeof(RleHist));
+    if (!job->hists[worker] || rle_hist_init(job->hists[worker]) != 0) {
+        fprintf(stderr, "Error: cannot allocate the run-length histograms.\n");
+        exit(1);
+    }
+}
+
+void scan_worker(int worker, void *arg) {
+    ScanJob *job = (ScanJob *)arg;
+    RleHist *hist = use_hist ? job->hists[worker] : NULL;
+
+    if (use_numa) {
+        size_t first, last;
+        worker_chunks(job->num_chunks, worker, job->num_workers, &first, &last);
+        for (size_t c = first; c < last; ++c) {
+            job->chunks[c].hist = hist;
+            process_chunk(&job->chunks[c]);
         }
+        return;
     }
 
-    printf("\n--- Final RLE Analysis ---\n");
-    for (int n = MIN_N; n <= MAX_N; ++n) {
-        int packet_bits = n + 1;
-        double mb = (double)final_bit_counts[n - MIN_N] / 8.0 / 1024.0 / 1024.0;
-        printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
-               n, packet_bits, final_bit_counts[n - MIN_N], mb);
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+
+        job->chunks[c].hist = hist;
+        process_chunk(&job->chunks[c]);
     }
 }
 
-void run_parallel_test(int num_threads) {
+void run_parallel_test(RlePool *pool, int num_threads, uint64_t *final_bit_counts) {
     printf("\n=== Testing with %d threads ===\n", num_threads);
 
-    ThreadData *data = calloc(num_threads, sizeof(ThreadData));
-    size_t chunk_size = NUM_VOXELS / num_threads;
+    ScanJob job;
+    job.num_chunks = cut_chunks(NULL);
+    job.chunks = aligned_alloc(CACHE_LINE, job.num_chunks * sizeof(ChunkData));
+    size_t *starts = malloc((job.num_chunks + 1) * sizeof(size_t));
+    if (!job.chunks || !starts) {
+        fprintf(stderr, "Error: cannot allocate the chunk table.\n");
+        exit(1);
+    }
+    memset(job.chunks, 0, job.num_chunks * sizeof(ChunkData));
+    job.num_workers = num_threads;
+    job.hists = NULL;
+    atomic_init(&job.next_chunk, 0);
 
     // Assign chunks
-    for (int i = 0; i < num_threads; ++i) {
-        data[i].start_index = i * chunk_size;
-        data[i].end_index = (i == num_threads - 1) ? NUM_VOXELS : (i + 1) * chunk_size;
+    cut_chunks(starts);
+    for (size_t c = 0; c < job.num_chunks; ++c) {
+        job.chunks[c].start_index = starts[c];
+        job.chunks[c].end_index = starts[c + 1];
+    }
+    free(starts);
+
+    if (use_hist) {
+        job.hists = calloc(num_threads, sizeof(RleHist *));
+        rle_pool_run(pool, num_threads, hist_init_worker, &job);
     }
 
     double start = get_time();
 
-    // Launch
-    for (int i = 0; i < num_threads; ++i) {
-        pthread_create(&data[i].tid, NULL, process_chunk, &data[i]);
+    RLE_PROF_RESET(RLE_PROF_SCAN);
+    RLE_PROF_BEGIN(RLE_PROF_SCAN);
+    rle_pool_run(pool, num_threads, scan_worker, &job);
+    RLE_PROF_END(RLE_PROF_SCAN);
+
+    // Aggregate and fix boundaries
+    analyze_results(job.chunks, job.num_chunks, job.hists, num_threads, final_bit_counts);
+
+    // Every chunk lies inside one block, so its summary is a piece of that
+    // block's cost vector. Pieces stitch like chunks, runs stay clipped at
+    // the block edges.
+    if (adapt_block) {
+        RLE_PROF_BEGIN(RLE_PROF_STITCH);
+        size_t num_blocks = rle_adapt_num_blocks(NUM_VOXELS, adapt_block);
+        for (size_t b = 0; b < num_blocks; ++b) rle_summary_init(&adapt_blocks[b]);
+        for (size_t c = 0; c < job.num_chunks; ++c) {
+            RleSummary *block = &adapt_blocks[job.chunks[c].start_index / adapt_block];
+            *block = rle_summary_merge(block, &job.chunks[c].sum);
+        }
+        RLE_PROF_END(RLE_PROF_STITCH);
     }
 
-    // Wait
-    for (int i = 0; i < num_threads; ++i) {
-        pthread_join(data[i].tid, NULL);
+    double end = get_time();
+
+    printf(">> Computation Time: %.6f seconds\n", end - start);
+    RLE_PROF_REPORT_THREADS(RLE_PROF_SCAN);
+
+    for (int i = 0; use_hist && i < num_threads; ++i) {
+        rle_hist_free(job.hists[i]);
+        free(job.hists[i]);
     }
+    free(job.hists);
+    free(job.chunks);
+}
 
-    // Aggregate and fix boundaries
-    analyze_results(data, num_threads);
+// --sweep: every chunk gets one summary per threshold, chunk c's are at
+// sums[c * sweep_count ..]
+typedef struct {
+    RleSummary *sums;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+    int num_workers;
+} SweepJob;
+
+void sweep_chunk(RleSummary *sums, size_t start_index, size_t end_index) {
+    RleSweep sweep;
+    rle_sweep_begin(&sweep, sweep_thr, sweep_count);
+    rle_sweep_feed(&sweep, volume + start_index, end_index - start_index);
+    rle_sweep_finish(&sweep);
+    memcpy(sums, sweep.sum, sweep_count * sizeof(RleSummary));
+}
+
+void sweep_worker(int worker, void *arg) {
+    SweepJob *job = (SweepJob *)arg;
+    size_t first = 0, last = 0;
+    if (use_numa) worker_chunks(job->num_chunks, worker, job->num_workers, &first, &last);
+
+    for (;;) {
+        size_t c;
+        if (use_numa) {
+            if (first == last) break;
+            c = first++;
+        } else {
+            c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+            if (c >= job->num_chunks) break;
+        }
+
+        size_t end = (c == job->num_chunks - 1) ? NUM_VOXELS : (c + 1) * CHUNK_VOXELS;
+        sweep_chunk(&job->sums[c * sweep_count], c * CHUNK_VOXELS, end);
+    }
+}
+
+// Same as run_parallel_test(), for every threshold of the sweep at once.
+// The chunk seams are stitched per threshold into totals[0 .. sweep_count).
+void run_sweep_test(RlePool *pool, int num_threads, RleSummary *totals) {
+    printf("\n=== Sweeping %d thresholds with %d threads ===\n", sweep_count, num_threads);
+
+    SweepJob job;
+    job.num_chunks = count_chunks(NUM_VOXELS);
+    job.sums = malloc(job.num_chunks * sweep_count * sizeof(RleSummary));
+    if (!job.sums) {
+        fprintf(stderr, "Error: cannot allocate the sweep summaries.\n");
+        exit(1);
+    }
+    job.num_workers = num_threads;
+    atomic_init(&job.next_chunk, 0);
+
+    double start = get_time();
+
+    rle_pool_run(pool, num_threads, sweep_worker, &job);
+
+    for (int t = 0; t < sweep_count; ++t) {
+        rle_summary_init(&totals[t]);
+        for (size_t c = 0; c < job.num_chunks; ++c) {
+            totals[t] = rle_summary_merge(&totals[t], &job.sums[c * sweep_count + t]);
+        }
+    }
 
     double end = get_time();
 
     printf(">> Computation Time: %.6f seconds\n", end - start);
+    free(job.sums);
+}
 
-    free(data);
+// --orders: the chunks of one scan order, see rle_order.h. Every worker has
+// its own gather buffer.
+typedef struct {
+    const RleVolume *vol;
+    RleOrder order;
+    RleSummary *sums;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+    uint8_t **buffers;
+} OrderJob;
+
+void order_worker(int worker, void *arg) {
+    OrderJob *job = (OrderJob *)arg;
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+        job->sums[c] = rle_order_scan_chunk(job->vol, job->order, c, THRESHOLD, job->buffers[worker]);
+    }
 }
 
-int main(void) {
-    if (load_volume("c8.raw") != 0) {
-        fprintf(stderr, "Make sure c8.raw exists (1024x1024x314).\n");
+// Costs of the whole volume scanned in 'order', chunk seams stitched in the
+// order's own sequence. Returns the time taken.
+double run_order_test(RlePool *pool, int num_threads, const RleVolume *vol, RleOrder order,
+                      uint8_t **buffers, RleSummary *total) {
+    OrderJob job;
+    job.vol = vol;
+    job.order = order;
+    job.num_chunks = rle_order_chunks(vol, order);
+    job.sums = malloc(job.num_chunks * sizeof(RleSummary));
+    if (!job.sums) {
+        fprintf(stderr, "Error: cannot allocate the order summaries.\n");
+        exit(1);
+    }
+    job.buffers = buffers;
+    atomic_init(&job.next_chunk, 0);
+
+    double start = get_time();
+
+    rle_pool_run(pool, num_threads, order_worker, &job);
+
+    rle_summary_init(total);
+    for (size_t c = 0; c < job.num_chunks; ++c) *total = rle_summary_merge(total, &job.sums[c]);
+
+    double end = get_time();
+    free(job.sums);
+    return end - start;
+}
+
+// --gray: one PackBits chunk scan per chunk. With bodies set, every chunk
+// also writes the packets only it can decide.
+typedef struct {
+    RleGrayChunk *chunks;
+    RleByteBuf *bodies;
+    size_t *starts;         // cut_chunks()
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} GrayJob;
+
+void gray_worker(int worker, void *arg) {
+    GrayJob *job = (GrayJob *)arg;
+    uint8_t q = rle_gray_quant_mask(gray_bits);
+    (void)worker;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+
+        size_t first = job->starts[c];
+        rle_gray_chunk_scan(&job->chunks[c], volume + first, job->starts[c + 1] - first, q,
+                            job->bodies ? &job->bodies[c] : NULL);
+    }
+}
+
+// Grayscale PackBits size of the volume, over the same chunks as
+// run_parallel_test(). The chunks are joined in order, which decides the
+// runs and literal stretches crossing the seams (see rle_gray.h). With
+// 'out' set the stream is written into it as well. Returns the size in bytes.
+uint64_t run_gray_test(RlePool *pool, int num_threads, RleByteBuf *out) {
+    GrayJob job;
+    job.num_chunks = cut_chunks(NULL);
+    job.chunks = malloc(job.num_chunks * sizeof(RleGrayChunk));
+    job.starts = malloc((job.num_chunks + 1) * sizeof(size_t));
+    job.bodies = out ? calloc(job.num_chunks, sizeof(RleByteBuf)) : NULL;
+    if (!job.chunks || !job.starts || (out && !job.bodies)) {
+        fprintf(stderr, "Error: cannot allocate the grayscale chunks.\n");
+        exit(1);
+    }
+    cut_chunks(job.starts);
+    for (size_t c = 0; out && c < job.num_chunks; ++c) {
+        if (rle_bb_init(&job.bodies[c], CHUNK_VOXELS / 4) != 0) {
+            fprintf(stderr, "Error: cannot allocate the grayscale buffers.\n");
+            exit(1);
+        }
+    }
+    atomic_init(&job.next_chunk, 0);
+
+    double start = get_time();
+
+    rle_pool_run(pool, num_threads, gray_worker, &job);
+
+    double mid = get_time();
+
+    RleGrayJoin join;
+    rle_gray_join_begin(&join, volume, rle_gray_quant_mask(gray_bits), out);
+    for (size_t c = 0; c < job.num_chunks; ++c) {
+        rle_gray_join_chunk(&join, &job.chunks[c].sum, job.starts[c], job.starts[c + 1],
+                            out ? &job.bodies[c] : NULL);
+    }
+    rle_gray_join_finish(&join);
+
+    double end = get_time();
+
+    printf("%s %2d threads: %.6f seconds (scan %.6f + join %.6f)\n", out ? "Encode" : "Cost  ",
+           num_threads, end - start, mid - start, end - mid);
+
+    for (size_t c = 0; out && c < job.num_chunks; ++c) rle_bb_free(&job.bodies[c]);
+    free(job.bodies);
+    free(job.starts);
+    free(job.chunks);
+    return join.bytes;
+}
+
+// --predict: chunk c covers slices [c * slices, (c + 1) * slices).
+// Every worker has its own rolling window.
+typedef struct {
+    RleSummary (*sums)[RLE_PREDICT_MODES];
+    uint64_t *windows[MAX_THREADS];
+    uint32_t slices;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} PredictJob;
+
+void predict_worker(int worker, void *arg) {
+    PredictJob *job = (PredictJob *)arg;
+    const size_t slice = (size_t)X * Y;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+
+        uint32_t z0 = (uint32_t)c * job->slices;
+        uint32_t z1 = z0 + job->slices < Z ? z0 + job->slices : Z;
+
+        RlePredict p;
+        rle_predict_begin(&p, X, Y, THRESHOLD, job->windows[worker]);
+        if (z0 > 0) rle_predict_prime(&p, volume + (z0 - 1) * slice);
+        for (uint32_t z = z0; z < z1; ++z) rle_predict_slice(&p, volume + z * slice);
+        rle_predict_finish(&p);
+        memcpy(job->sums[c], p.sum, sizeof(p.sum));
+    }
+}
+
+// Costs the plain, row XOR and slice XOR streams in one pass, parallel over
+// Z, and stitches the chunks in order into sums[].
+void run_predict_test(RlePool *pool, int num_threads, RleSummary *sums) {
+    const size_t slice = (size_t)X * Y;
+    PredictJob job;
+    job.slices = (uint32_t)(PREDICT_CHUNK_VOXELS / slice ? PREDICT_CHUNK_VOXELS / slice : 1);
+    job.num_chunks = (Z + job.slices - 1) / job.slices;
+    job.sums = malloc(job.num_chunks * sizeof(*job.sums));
+    int failed = !job.sums;
+    for (int w = 0; w < num_threads; ++w) {
+        job.windows[w] = malloc(rle_predict_window_words(X, Y) * sizeof(uint64_t));
+        failed = failed || !job.windows[w];
+    }
+    if (failed) {
+        fprintf(stderr, "Error: cannot allocate the prediction windows.\n");
+        exit(1);
+    }
+    atomic_init(&job.next_chunk, 0);
+
+    double start = get_time();
+
+    rle_pool_run(pool, num_threads, predict_worker, &job);
+
+    for (int m = 0; m < RLE_PREDICT_MODES; ++m) {
+        rle_summary_init(&sums[m]);
+        for (size_t c = 0; c < job.num_chunks; ++c) sums[m] = rle_summary_merge(&sums[m], &job.sums[c][m]);
+    }
+
+    double end = get_time();
+    printf("Predict %2d threads: %.6f seconds (%.1f MB/s)\n", num_threads, end - start,
+           (double)NUM_VOXELS / 1024.0 / 1024.0 / (end - start));
+
+    for (int w = 0; w < num_threads; ++w) free(job.windows[w]);
+    free(job.sums);
+}
+
+typedef struct {
+    RleEncChunk *chunks;
+    size_t *starts;
+    size_t num_chunks;
+    atomic_size_t next_chunk;
+} EncodeJob;
+
+void encode_chunk(RleEncChunk *c, size_t start_index, size_t end_index) {
+    if (start_index >= end_index) return;
+
+    c->first_val = use_mask ? rle_mask_get(&mask, start_index)
+                            : ((volume[start_index] > THRESHOLD) ? 1 : 0);
+    c->cur_val = c->first_val;
+
+    RleOpenRun run = { c->first_val, 0 };
+    if (use_mask) {
+        rle_mask_scan(&mask, start_index, end_index, &run, rle_chunk_encode_run, c);
+    } else {
+        rle_scan_range(volume + start_index, end_index - start_index,
+                       THRESHOLD, &run, rle_chunk_encode_run, c);
+    }
+    rle_chunk_finish(c, run.val, run.len);
+}
+
+void encode_worker(int worker, void *arg) {
+    EncodeJob *job = (EncodeJob *)arg;
+    (void)worker;
+
+    for (;;) {
+        size_t c = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (c >= job->num_chunks) break;
+
+        encode_chunk(&job->chunks[c], job->starts[c], job->starts[c + 1]);
+    }
+}
+
+// Encodes the volume with 'n_bits' using the same chunks as
+// run_parallel_test(). Each chunk is written into its own buffer,
+// and the buffers are joined at the seams into 'out' (see rle_join_chunks).
+// With a 'plan' every block gets its own N instead (the adaptive stream of
+// rle_adapt.h): the chunks of a block are joined with the block's N, and
+// the block edges get their flag bits.
+// Returns 0 if the stream has the predicted size.
+int run_parallel_encode(RlePool *pool, int num_threads, int n_bits, const RleAdaptPlan *plan,
+                         uint64_t expected_bits, RleBitWriter *out) {
+    if (plan) {
+        printf("\n=== Encoding adaptive N with %d threads ===\n", num_threads);
+    } else {
+        printf("\n=== Encoding N=%d with %d threads ===\n", n_bits, num_threads);
+    }
+
+    EncodeJob job;
+    job.num_chunks = cut_chunks(NULL);
+    job.chunks = calloc(job.num_chunks, sizeof(RleEncChunk));
+    job.starts = malloc((job.num_chunks + 1) * sizeof(size_t));
+    if (!job.chunks || !job.starts) {
+        fprintf(stderr, "Error: cannot allocate the encoder chunks.\n");
+        exit(1);
+    }
+    cut_chunks(job.starts);
+    atomic_init(&job.next_chunk, 0);
+
+    for (size_t c = 0; c < job.num_chunks; ++c) {
+        job.chunks[c].n_bits = plan ? plan->n[job.starts[c] / plan->block_voxels] : n_bits;
+        // Size each buffer from the predicted total so it rarely has to grow
+        if (rle_bw_init(&job.chunks[c].body, expected_bits / 64 / job.num_chunks + 1) != 0) {
+            fprintf(stderr, "Error: cannot allocate the encoder buffers.\n");
+            exit(1);
+        }
+    }
+    if (rle_bw_init(out, expected_bits / 64 + 1) != 0) {
+        fprintf(stderr, "Error: cannot allocate the output buffer.\n");
+        exit(1);
+    }
+
+    double start = get_time();
+
+    rle_pool_run(pool, num_threads, encode_worker, &job);
+
+    double mid = get_time();
+
+    // Serial part: seam runs + bit-shifted copy of every body
+    if (plan) {
+        size_t first = 0;
+        for (uint64_t b = 0; b < plan->num_blocks; ++b) {
+            size_t last = first;
+            while (last < job.num_chunks && job.starts[last] / plan->block_voxels == b) last++;
+            if (b > 0) rle_adapt_put_edge(out, plan, b);
+            rle_join_chunks(job.chunks + first, (int)(last - first), plan->n[b], out);
+            first = last;
+        }
+    } else {
+        rle_join_chunks(job.chunks, (int)job.num_chunks, n_bits, out);
+    }
+
+    double end = get_time();
+
+    uint64_t bits = rle_bw_bits(out);
+    printf(">> Encode Time: %.6f seconds (scan %.6f + join %.6f), %.1f MB/s\n",
+           end - start, mid - start, end - mid,
+           (double)NUM_VOXELS / 1024.0 / 1024.0 / (end - start));
+    int status = 0;
+    if (bits != expected_bits) {
+        fprintf(stderr, "Error: encoded %lu bits, the cost model predicted %lu.\n",
+                bits, expected_bits);
+        status = 1;
+    }
+
+    for (size_t c = 0; c < job.num_chunks; ++c) rle_bw_free(&job.chunks[c].body);
+    free(job.chunks);
+    free(job.starts);
+    return status;
+}
+
+typedef struct {
+    const RleStream *stream;
+    const RleIndex *index;
+    uint64_t first;
+    uint64_t last;
+    uint8_t *out;
+    atomic_size_t next_piece;
+    atomic_int status;
+} DecodeJob;
+
+// Pieces are one index step long, so every piece starts right at an index
+// entry and no thread has to skip packets to reach its start.
+void decode_worker(int worker, void *arg) {
+    DecodeJob *job = (DecodeJob *)arg;
+    uint64_t step = job->index->step;
+    uint64_t base = job->first - job->first % step;
+    (void)worker;
+
+    for (;;) {
+        size_t k = atomic_fetch_add_explicit(&job->next_piece, 1, memory_order_relaxed);
+        uint64_t a = base + k * step;
+        if (a >= job->last) break;
+
+        uint64_t b = a + step < job->last ? a + step : job->last;
+        if (a < job->first) a = job->first;
+
+        if (rle_decode_range(job->stream, job->index, a, b, job->out + (a - job->first)) != 0) {
+            atomic_store(&job->status, 1);
+        }
+    }
+}
+
+// Decodes voxels [first, last) into out using the worker pool.
+// Every piece seeks on its own through the index, so there is no serial part.
+int parallel_decode(RlePool *pool, const RleStream *stream, const RleIndex *index,
+                    uint64_t first, uint64_t last, uint8_t *out, int num_threads) {
+    DecodeJob job;
+    job.stream = stream;
+    job.index = index;
+    job.first = first;
+    job.last = last;
+    job.out = out;
+    atomic_init(&job.next_piece, 0);
+    atomic_init(&job.status, 0);
+
+    rle_pool_run(pool, num_threads, decode_worker, &job);
+
+    return atomic_load(&job.status);
+}
+
+// Compares decoded voxels with the thresholded source volume.
+int check_decoded(const uint8_t *out, uint64_t first, uint64_t last) {
+    for (uint64_t i = first; i < last; ++i) {
+        if (out[i - first] != ((volume[i] > THRESHOLD) ? 1 : 0)) return 1;
+    }
+    return 0;
+}
+
+// Decodes the full volume, one slice and a 16-slice slab, and reports
+// throughput in decoded voxels (= output MB) per second. Returns 0 if every
+// range matches the volume.
+int run_decode_test(RlePool *pool, const RleStream *stream, const RleIndex *index,
+                    uint8_t *out, int num_threads) {
+    printf("\n=== Decoding with %d threads ===\n", num_threads);
+
+    const uint64_t slice = (uint64_t)X * Y;
+    struct { const char *name; uint64_t first; uint64_t last; } ranges[] = {
+        { "Full volume", 0, NUM_VOXELS },
+        { "Slice z=Z/2", (Z / 2) * slice, (Z / 2 + 1) * slice },
+        { "Slab 16 slices", (Z / 4) * slice, (Z / 4 + 16) * slice },
+    };
+    if (ranges[2].last > NUM_VOXELS) ranges[2].last = NUM_VOXELS;
+
+    int failed = 0;
+    for (int r = 0; r < 3; ++r) {
+        double start = get_time();
+        int status = parallel_decode(pool, stream, index, ranges[r].first, ranges[r].last,
+                                     out, num_threads);
+        double end = get_time();
+
+        uint64_t voxels = ranges[r].last - ranges[r].first;
+        if (status == 0) status = check_decoded(out, ranges[r].first, ranges[r].last);
+
+        printf(">> %-15s %.6f seconds (%.1f MB/s)%s\n", ranges[r].name, end - start,
+               (double)voxels / 1024.0 / 1024.0 / (end - start),
+               status ? "  MISMATCH" : "");
+        failed |= status;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    const char *input_path = "c8.raw";
+    const char *adapt_arg = NULL;
+    char out_name[RLE_VOLUME_PATH + 16];    // outputs go next to the volume
+    int status = 0;
+    RleVolumeParams params;
+    rle_volume_params_init(&params, THRESHOLD_U8);
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--hist") == 0) {
+            use_hist = 1;
+        } else if (strcmp(argv[i], "--encode") == 0) {
+            use_encode = 1;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            use_mmap = 1;
+        } else if (strcmp(argv[i], "--numa") == 0) {
+            use_numa = 1;
+        } else if (strcmp(argv[i], "--mask") == 0) {
+            use_mask = 1;
+        } else if (strcmp(argv[i], "--orders") == 0) {
+            use_orders = 1;
+        } else if (strcmp(argv[i], "--predict") == 0) {
+            use_predict = 1;
+        } else if (strcmp(argv[i], "--gray") == 0) {
+            use_gray = 1;
+        } else if (strcmp(argv[i], "--gray-bits") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= 8) {
+            use_gray = 1;
+            gray_bits = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc) {
+            // Parsed once the slice size is known
+            adapt_arg = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (rle_volume_parse_arg(argc, argv, &i, &params) > 0) {
+            // --threshold or --window
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc &&
+                   (sweep_count = rle_sweep_parse(argv[i + 1], sweep_thr)) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--decode") == 0) {
+            // Decoding works on the stream the encoder just produced
+            use_encode = 1;
+            use_decode = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--hist] [--mmap | --numa] [--mask] [--orders] [--predict] [--gray [--gray-bits B]] [--encode] [--decode]\n"
+                            "       %s --adaptive slice|rows:K|VOXELS [--mmap] [--mask] [--orders] [--encode] [--decode]\n"
+                            "       %s --sweep T1,T2,.. [--mmap | --numa] [--orders]\n"
+                            "Every mode also takes --input FILE|HEADER.mhd|HEADER.nrrd (default c8.raw),\n"
+                            "--threshold T for 8-bit volumes and --window LO,HI for 16-bit ones.\n",
+                    argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    const char *err = rle_volume_open(input_path, &params, &input);
+    if (err) {
+        fprintf(stderr, "Error: %s: %s.\n", input_path, err);
+        return 1;
+    }
+    if (adapt_arg && rle_adapt_parse(adapt_arg, X, Y, &adapt_block) != 0) {
+        fprintf(stderr, "Error: bad --adaptive block '%s' for %ux%u slices.\n", adapt_arg, X, Y);
+        return 1;
+    }
+    // These read the stored voxel values, not the 0/1 window
+    if (rle_volume_windowed(&input) && (use_mmap || use_gray || sweep_count > 0)) {
+        fprintf(stderr, "Error: --mmap, --gray and --sweep need an 8-bit volume.\n");
+        return 1;
+    }
+    if (use_mmap && use_numa) {
+        fprintf(stderr, "Error: --mmap and --numa cannot be combined.\n");
+        return 1;
+    }
+    // --numa reloads the volume for every test, the mask is built only once
+    if (use_mask && use_numa) {
+        fprintf(stderr, "Error: --mask and --numa cannot be combined.\n");
+        return 1;
+    }
+    // The sweep has its own scan and its own output
+    if (sweep_count > 0 && (use_hist || use_mask || use_encode)) {
+        fprintf(stderr, "Error: --sweep cannot be combined with --hist, --mask, --encode or --decode.\n");
+        return 1;
+    }
+    // The prediction table is compared with the plain analysis
+    if (use_predict && sweep_count > 0) {
+        fprintf(stderr, "Error: --predict cannot be combined with --sweep.\n");
         return 1;
     }
+    // Block costs come from the chunk summaries, which hold no costs in
+    // --hist mode; --numa splits the plain chunks between the workers
+    if (adapt_block && (use_hist || use_numa || sweep_count > 0)) {
+        fprintf(stderr, "Error: --adaptive cannot be combined with --hist, --numa or --sweep.\n");
+        return 1;
+    }
+    // Mask chunks have to start on a mask word
+    if (adapt_block && use_mask && !rle_adapt_mask_ok(adapt_block)) {
+        fprintf(stderr, "Error: --mask needs an --adaptive block that is a multiple of 64 voxels, not %lu.\n",
+                adapt_block);
+        return 1;
+    }
+#ifdef RLE_SCALAR
+    if (use_mask) {
+        fprintf(stderr, "Error: the RLE_SCALAR build always scans the volume, --mask is not available.\n");
+        return 1;
+    }
+#endif
 
-    // Warmup pass: touch all the memory pages so page faults don't skew the timing.
-    volatile uint64_t sum = 0;
-    for(size_t i=0; i<NUM_VOXELS; i++) sum += volume[i];
+    double load_start = get_time();
+
+    // Start the workers once, before any timer runs
+    RlePool pool;
+    if (rle_pool_start(&pool, MAX_THREADS, use_numa) != 0) {
+        fprintf(stderr, "Error: cannot start the worker threads.\n");
+        return 1;
+    }
+    if (use_numa) {
+        if (pool.pinned) {
+            printf("Pinned %d workers to %d CPUs on %d NUMA nodes.\n", pool.size, pool.num_cpus,
+                   pool.num_nodes);
+        } else {
+            fprintf(stderr, "Warning: could not pin the workers, running unpinned.\n");
+        }
+    }
+
+    rle_volume_print(&input);
+
+    // With --numa the workers load the volume themselves, before every test
+    if (!use_numa) {
+        RLE_PROF_BEGIN(RLE_PROF_LOAD);
+        if ((use_mmap ? map_volume() : load_volume()) != 0) {
+            fprintf(stderr, "Error: cannot read %s (%ux%ux%u).\n", input.path, X, Y, Z);
+            return 1;
+        }
+        RLE_PROF_END(RLE_PROF_LOAD);
+
+        // Warmup pass: touch all the memory pages so page faults don't skew the timing.
+        // With --mmap we want the I/O in the measurement, so there is none.
+        if (!use_mmap) {
+            RLE_PROF_BEGIN(RLE_PROF_WARMUP);
+            volatile uint64_t sum = 0;
+            for(size_t i=0; i<NUM_VOXELS; i++) sum += volume[i];
+            RLE_PROF_END(RLE_PROF_WARMUP);
+        }
+    }
+
+    if (use_mask) {
+        if (rle_mask_alloc(&mask, NUM_VOXELS) != 0) {
+            fprintf(stderr, "Error: cannot allocate the bit mask.\n");
+            return 1;
+        }
+        double start = get_time();
+        build_mask(&pool, MAX_THREADS);
+        printf(">> Mask Build Time: %.6f seconds with %d threads (%.1f MB)\n", get_time() - start,
+               MAX_THREADS, (double)mask.nwords * 8.0 / 1024.0 / 1024.0);
+    }
+
+    if (adapt_block) {
+        adapt_blocks = malloc(rle_adapt_num_blocks(NUM_VOXELS, adapt_block) * sizeof(RleSummary));
+        if (!adapt_blocks) {
+            fprintf(stderr, "Error: cannot allocate the block summaries.\n");
+            return 1;
+        }
+    }
 
     int tests[] = {1, 2, 4, 8, 16};
-    for (int i = 0; i < 5; ++i) run_parallel_test(tests[i]);
+    // Every thread count scans the same chunks, so the costs are the same
+    uint64_t bit_costs[RLE_VARIANTS];
+    RleSummary sweep_totals[RLE_SWEEP_MAX];
+    RleSummary sweep_first[RLE_SWEEP_MAX];
+    for (int i = 0; i < 5; ++i) {
+        if (use_numa) {
+            RLE_PROF_BEGIN(RLE_PROF_LOAD);
+            if (place_volume(&pool, tests[i]) != 0) {
+                fprintf(stderr, "Error: cannot read %s (%ux%ux%u).\n", input.path, X, Y, Z);
+                return 1;
+            }
+            RLE_PROF_END(RLE_PROF_LOAD);
+        }
 
-    free(volume);
-    return 0;
+        if (sweep_count > 0) {
+            run_sweep_test(&pool, tests[i], sweep_totals);
+            if (i == 0) {
+                memcpy(sweep_first, sweep_totals, sizeof(sweep_totals));
+            } else {
+                for (int t = 0; t < sweep_count; ++t) {
+                    if (memcmp(sweep_first[t].costs, sweep_totals[t].costs, sizeof(sweep_first[t].costs)) != 0) {
+                        printf("Threshold %d DIFFERS FROM the 1-thread sweep.\n", sweep_thr[t]);
+                        status = 1;
+                    }
+                }
+            }
+        } else {
+            run_parallel_test(&pool, tests[i], bit_costs);
+        }
+
+        if (i == 0) {
+            printf(">> End-to-end Time (%s + first scan): %.6f seconds\n",
+                   use_mmap ? "mmap" : use_numa ? "per-worker load" : "load + warm-up",
+                   get_time() - load_start);
+        }
+    }
+
+    if (sweep_count > 0) rle_sweep_print(sweep_thr, sweep_count, sweep_first);
+
+    if (use_predict) {
+        printf("\n=== Predictive RLE (XOR with the row above / slice before) ===\n");
+        RleSummary predict[RLE_PREDICT_MODES];
+        RleSummary predict_first[RLE_PREDICT_MODES];
+        for (int i = 0; i < 5; ++i) {
+            run_predict_test(&pool, tests[i], predict);
+            if (i == 0) {
+                memcpy(predict_first, predict, sizeof(predict));
+            } else {
+                for (int m = 0; m < RLE_PREDICT_MODES; ++m) {
+                    if (memcmp(predict_first[m].costs, predict[m].costs, sizeof(predict[m].costs)) != 0) {
+                        printf("%s costs DIFFER FROM the 1-thread run.\n", rle_predict_names[m]);
+                        status = 1;
+                    }
+                }
+            }
+        }
+        rle_predict_print(predict_first);
+        int same = memcmp(predict_first[RLE_PREDICT_PLAIN].costs, bit_costs, sizeof(bit_costs)) == 0;
+        printf("Plain stream %s the analysis.\n", same ? "matches" : "DIFFERS FROM");
+        if (!same) status = 1;
+    }
+
+    if (use_gray) {
+        printf("\n=== Grayscale PackBits, %d bits/voxel ===\n", gray_bits);
+        uint64_t gray_bytes = 0;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t bytes = run_gray_test(&pool, tests[i], NULL);
+            if (i > 0 && bytes != gray_bytes) {
+                printf("Size DIFFERS FROM the 1-thread run.\n");
+                status = 1;
+            }
+            gray_bytes = bytes;
+        }
+
+        // Quantised voxels are still stored one per byte, literals included
+        double raw = (double)NUM_VOXELS;
+        printf("\n--- Grayscale PackBits ---\n");
+        printf("Raw:      %12.0f bytes (%.2f MB)\n", raw, raw / 1024.0 / 1024.0);
+        printf("PackBits: %12lu bytes (%.2f MB), ratio %.3f\n", gray_bytes,
+               (double)gray_bytes / 1024.0 / 1024.0, (double)gray_bytes / raw);
+
+        if (use_encode) {
+            RleByteBuf reference, out;
+            if (rle_bb_init(&reference, gray_bytes + 1) != 0 || rle_bb_init(&out, gray_bytes + 1) != 0) {
+                fprintf(stderr, "Error: cannot allocate the grayscale output.\n");
+                return 1;
+            }
+            run_gray_test(&pool, 1, &reference);
+            run_gray_test(&pool, MAX_THREADS, &out);
+            int same = out.len == reference.len && memcmp(out.data, reference.data, out.len) == 0;
+            printf("PackBits stream %s the 1-thread encode.\n", same ? "matches" : "DIFFERS FROM");
+            if (!same) status = 1;
+            if (reference.len != gray_bytes) {
+                fprintf(stderr, "Error: encoded %zu bytes, the cost model predicted %lu.\n",
+                        reference.len, gray_bytes);
+                status = 1;
+            }
+
+            int err = rle_volume_output_path(input_path, ".pkb", out_name, sizeof(out_name));
+            FILE *f = err ? NULL : fopen(out_name, "wb");
+            err = !f || fwrite(reference.data, 1, reference.len, f) != reference.len;
+            if (f && fclose(f) != 0) err = 1;
+            if (err) {
+                fprintf(stderr, "Error: cannot write %s.\n", out_name);
+            } else {
+                printf("Wrote %s (%zu bytes).\n", out_name, reference.len);
+            }
+
+            if (use_decode) {
+                uint8_t *dec = malloc(NUM_VOXELS);
+                if (!dec) {
+                    fprintf(stderr, "Error: cannot allocate the decode buffer.\n");
+                    return 1;
+                }
+                uint8_t q = rle_gray_quant_mask(gray_bits);
+                double start = get_time();
+                int bad = rle_gray_decode(reference.data, reference.len, dec, NUM_VOXELS) != 0;
+                double end = get_time();
+                for (size_t v = 0; !bad && v < NUM_VOXELS; ++v) bad = dec[v] != (volume[v] & q);
+                printf(">> PackBits Decode Time: %.6f seconds (1 thread), %s\n", end - start,
+                       bad ? "MISMATCH" : "matches the volume");
+                if (bad) status = 1;
+                free(dec);
+            }
+            rle_bb_free(&out);
+            rle_bb_free(&reference);
+        }
+    }
+
+    RleAdaptPlan plan;
+    if (adapt_block) {
+        double start = get_time();
+        if (rle_adapt_plan(adapt_blocks, rle_adapt_num_blocks(NUM_VOXELS, adapt_block), adapt_block, &plan) != 0) {
+            fprintf(stderr, "Error: cannot allocate the adaptive plan.\n");
+            return 1;
+        }
+        rle_adapt_print(&plan, bit_costs);
+        printf(">> Planning Time: %.6f seconds\n", get_time() - start);
+    }
+
+    if (use_orders) {
+        RleVolume vol;
+        rle_order_init(&vol, volume, X, Y, Z);
+
+        uint8_t *buffers[MAX_THREADS];
+        for (int w = 0; w < MAX_THREADS; ++w) {
+            buffers[w] = malloc(rle_order_buffer_size(&vol));
+            if (!buffers[w]) {
+                fprintf(stderr, "Error: cannot allocate the gather buffers.\n");
+                return 1;
+            }
+        }
+
+        printf("\n=== Scan orders (seconds) ===\n");
+        printf("%-8s", "Order");
+        for (int i = 0; i < 5; ++i) printf(" %7d thr", tests[i]);
+        printf("\n");
+
+        RleSummary order_totals[RLE_ORDER_COUNT];
+        for (int o = 0; o < RLE_ORDER_COUNT; ++o) {
+            printf("%-8s", rle_order_names[o]);
+            for (int i = 0; i < 5; ++i) {
+                RleSummary total;
+                double t = run_order_test(&pool, tests[i], &vol, (RleOrder)o, buffers, &total);
+                printf(" %11.6f", t);
+                fflush(stdout);
+                if (i == 0) {
+                    order_totals[o] = total;
+                } else if (memcmp(total.costs, order_totals[o].costs, sizeof(total.costs)) != 0) {
+                    printf(" (DIFFERS FROM 1 thread)");
+                    status = 1;
+                }
+            }
+            printf("\n");
+        }
+
+        // X order is the plain analysis again, chunked by slice
+        if (sweep_count == 0 && memcmp(order_totals[RLE_ORDER_X].costs, bit_costs, sizeof(bit_costs)) != 0) {
+            printf("X order DIFFERS FROM the chunked analysis.\n");
+            status = 1;
+        }
+        rle_order_print(order_totals);
+
+        for (int w = 0; w < MAX_THREADS; ++w) free(buffers[w]);
+    }
+
+    if (use_encode) {
+        int best_n = MIN_N;
+        for (int n = MIN_N; n <= MAX_N; ++n) {
+            if (bit_costs[n - MIN_N] < bit_costs[best_n - MIN_N]) best_n = n;
+        }
+
+        // The 1-thread encode is the serial reference, every other thread
+        // count has to produce exactly the same stream.
+        RleBitWriter reference;
+        status |= run_parallel_encode(&pool, 1, best_n, NULL, bit_costs[best_n - MIN_N], &reference);
+
+        for (int i = 1; i < 5; ++i) {
+            RleBitWriter out;
+            status |= run_parallel_encode(&pool, tests[i], best_n, NULL, bit_costs[best_n - MIN_N], &out);
+            int same = out.nwords == reference.nwords && out.acc_bits == reference.acc_bits &&
+                       out.acc == reference.acc &&
+                       memcmp(out.words, reference.words, out.nwords * sizeof(uint64_t)) == 0;
+            printf("Stream %s the 1-thread encode.\n", same ? "matches" : "DIFFERS FROM");
+            if (!same) status = 1;
+            rle_bw_free(&out);
+        }
+
+        RleHeader hdr = rle_volume_header(&input, best_n, rle_bw_bits(&reference));
+        if (rle_volume_output_path(input_path, ".rle", out_name, sizeof(out_name)) != 0 ||
+            rle_write_file(out_name, hdr, &reference) != 0) {
+            fprintf(stderr, "Error: cannot write %s.\n", out_name);
+        } else {
+            printf("Wrote %s (%lu bits).\n", out_name, rle_bw_bits(&reference));
+        }
+
+        if (use_decode) {
+            RleStream stream;
+            RleIndex index;
+            uint8_t *out = malloc(NUM_VOXELS);
+            if (!out || rle_stream_from_writer(&stream, hdr, &reference) != 0) {
+                fprintf(stderr, "Error: cannot allocate the decode buffers.\n");
+                exit(1);
+            }
+
+            // 16 index entries per slice: every slice start has one, and a
+            // single slice can still be split across threads
+            double start = get_time();
+            uint64_t step = (uint64_t)X * Y / 16;
+            if (rle_build_index(&stream, step ? step : 1, &index) != 0) {
+                fprintf(stderr, "Error: cannot index the encoded stream.\n");
+                exit(1);
+            }
+            double end = get_time();
+            printf("\n>> Index Time: %.6f seconds (%lu entries)\n", end - start, index.count);
+
+            if (rle_volume_output_path(input_path, ".rle.idx", out_name, sizeof(out_name)) != 0 ||
+                rle_write_index(out_name, &index) != 0) {
+                fprintf(stderr, "Error: cannot write %s.\n", out_name);
+            } else {
+                printf("Wrote %s.\n", out_name);
+            }
+
+            for (int i = 0; i < 5; ++i) status |= run_decode_test(&pool, &stream, &index, out, tests[i]);
+
+            rle_index_free(&index);
+            rle_stream_free(&stream);
+            free(out);
+        }
+        rle_bw_free(&reference);
+
+        if (adapt_block) {
+            RleBitWriter adaptive, check;
+            status |= run_parallel_encode(&pool, 1, 0, &plan, plan.bits, &adaptive);
+            status |= run_parallel_encode(&pool, MAX_THREADS, 0, &plan, plan.bits, &check);
+            int same = check.nwords == adaptive.nwords && check.acc_bits == adaptive.acc_bits &&
+                       check.acc == adaptive.acc &&
+                       memcmp(check.words, adaptive.words, check.nwords * sizeof(uint64_t)) == 0;
+            printf("Adaptive stream %s the 1-thread encode.\n", same ? "matches" : "DIFFERS FROM");
+            if (!same) status = 1;
+            rle_bw_free(&check);
+
+            RleHeader ahdr = rle_volume_header(&input, plan.n[0], rle_bw_bits(&adaptive));
+            if (rle_volume_output_path(input_path, ".rla", out_name, sizeof(out_name)) != 0 ||
+                rle_adapt_write_file(out_name, ahdr, adapt_block, &adaptive) != 0) {
+                fprintf(stderr, "Error: cannot write %s.\n", out_name);
+            } else {
+                printf("Wrote %s (%lu bits).\n", out_name, rle_bw_bits(&adaptive));
+            }
+
+            if (use_decode) {
+                RleStream stream;
+                uint8_t *out = malloc(NUM_VOXELS);
+                if (!out || rle_stream_from_writer(&stream, ahdr, &adaptive) != 0) {
+                    fprintf(stderr, "Error: cannot allocate the decode buffers.\n");
+                    exit(1);
+                }
+                double start = get_time();
+                int bad = rle_adapt_decode(&stream, adapt_block, out) != 0;
+                double end = get_time();
+                bad = bad || check_decoded(out, 0, NUM_VOXELS) != 0;
+                printf("\n>> Adaptive Decode Time: %.6f seconds (1 thread), %s\n", end - start,
+                       bad ? "MISMATCH" : "matches the volume");
+                if (bad) status = 1;
+                rle_stream_free(&stream);
+                free(out);
+            }
+            rle_bw_free(&adaptive);
+        }
+    }
+    if (adapt_block) {
+        rle_adapt_free(&plan);
+        free(adapt_blocks);
+    }
+
+    RLE_PROF_REPORT_PHASES();
+    RLE_PROF_CLOSE();
+
+    rle_pool_stop(&pool);
+    if (use_mask) rle_mask_free(&mask);
+
+    if (use_mmap) {
+        munmap(volume - input.offset, input.offset + NUM_VOXELS);
+    } else if (use_numa) {
+        munmap(volume, NUM_VOXELS);
+    } else {
+        free(volume);
+    }
+    return status;
 }
\ No newline at end of file
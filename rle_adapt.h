@@ -0,0 +1,303 @@
+// Per-block adaptive packet width.
+//
+// One global N is a compromise: air slices want long packets, noisy bone
+// slices short ones. Here the volume is cut into fixed blocks (a slice, a
+// group of rows, or any voxel count) and every block gets the cost vector of
+// its own runs, clipped at the block edges. A dynamic program then picks the
+// N of every block, paying for each change of N in the stream:
+//
+//   every block after the first starts with 1 flag bit; 0 keeps the N of the
+//   previous block, 1 is followed by 4 bits holding the new N - 2
+//
+// The first block's N is the one in the file header. Runs never cross a
+// block edge, so each block is a self-contained piece of the packet stream
+// and a decoder only has to count voxels to know where the next flag is.
+//
+// Block summaries are plain RleSummary values: pieces of one block scanned
+// separately (chunks, ranks) stitch with rle_summary_merge(), and folding all
+// blocks in order gives back the unclipped global costs.
+//
+// Adaptive file layout: "RLA2" magic, then the RLE2 header fields (N is the
+// first block's), then uint64 block size in voxels, then the payload.
+#ifndef RLE_ADAPT_H
+#define RLE_ADAPT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle_simd.h"
+#include "rle_summary.h"
+#include "rle_encode.h"
+#include "rle_decode.h"
+
+#define RLE_ADAPT_MAGIC "RLA2"
+#define RLE_ADAPT_HEADER_BYTES (RLE_HEADER_BYTES + 8)
+
+// Stream cost of a block edge: the flag, plus the new N on a switch
+#define RLE_ADAPT_FLAG_BITS 1
+#define RLE_ADAPT_SWITCH_BITS 4
+
+// Smallest voxel-count block, which keeps the number of summaries (and the
+// MPI reduction) small. Slice and row blocks are taken as they are.
+#define RLE_ADAPT_MIN_BLOCK 4096
+
+typedef struct {
+    uint64_t block_voxels;
+    uint64_t num_blocks;
+    uint8_t *n;             // chosen N of every block
+    uint64_t bits;          // whole adaptive stream, flags included
+    uint64_t switches;
+} RleAdaptPlan;
+
+// Parses the block size: "slice", "rows:K" (K rows of x voxels) or a plain
+// voxel count of at least RLE_ADAPT_MIN_BLOCK. Slices and rows fit volumes
+// of any size, so they need not be multiples of 64; a scan from a bit mask
+// needs one (rle_adapt_mask_ok()). Returns 0 on success.
+static inline int rle_adapt_parse(const char *text, uint64_t x, uint64_t y, uint64_t *block_voxels) {
+    char *end;
+    uint64_t v;
+    if (strcmp(text, "slice") == 0) {
+        v = x * y;
+    } else if (strncmp(text, "rows:", 5) == 0) {
+        v = strtoull(text + 5, &end, 10) * x;
+        if (end == text + 5 || *end) return 1;
+    } else {
+        v = strtoull(text, &end, 10);
+        if (end == text || *end || v < RLE_ADAPT_MIN_BLOCK) return 1;
+    }
+    if (v == 0) return 1;
+    *block_voxels = v;
+    return 0;
+}
+
+// 1 if blocks of 'block_voxels' can be scanned from a bit mask (rle_mask.h):
+// every block, and so every chunk cut at a block edge, starts on a mask word.
+static inline int rle_adapt_mask_ok(uint64_t block_voxels) {
+    return block_voxels % 64 == 0;
+}
+
+static inline uint64_t rle_adapt_num_blocks(uint64_t num_voxels, uint64_t block_voxels) {
+    return (num_voxels + block_voxels - 1) / block_voxels;
+}
+
+// Picks the N of every block from the block summaries so that block costs
+// plus flag and switch bits are minimal. Returns 0 on success.
+static inline int rle_adapt_plan(const RleSummary *blocks, uint64_t num_blocks,
+                                 uint64_t block_voxels, RleAdaptPlan *plan) {
+    plan->block_voxels = block_voxels;
+    plan->num_blocks = num_blocks;
+    plan->bits = 0;
+    plan->switches = 0;
+    plan->n = (uint8_t *)malloc(num_blocks ? num_blocks : 1);
+    // from[b][i]: N index of block b-1 on the cheapest path with N index i at b
+    uint8_t (*from)[RLE_SUMMARY_VARIANTS] =
+        (uint8_t (*)[RLE_SUMMARY_VARIANTS])malloc((num_blocks ? num_blocks : 1) * RLE_SUMMARY_VARIANTS);
+    if (!plan->n || !from) {
+        free(plan->n);
+        free(from);
+        plan->n = NULL;
+        return 1;
+    }
+    if (num_blocks == 0) {
+        free(from);
+        return 0;
+    }
+
+    uint64_t best[RLE_SUMMARY_VARIANTS];
+    for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) best[i] = blocks[0].costs[i];
+
+    for (uint64_t b = 1; b < num_blocks; ++b) {
+        int cheapest = 0;
+        for (int i = 1; i < RLE_SUMMARY_VARIANTS; ++i) {
+            if (best[i] < best[cheapest]) cheapest = i;
+        }
+        uint64_t switched = best[cheapest] + RLE_ADAPT_SWITCH_BITS;
+
+        for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) {
+            uint64_t keep = best[i];
+            from[b][i] = (uint8_t)(keep <= switched ? i : cheapest);
+            best[i] = (keep <= switched ? keep : switched) + RLE_ADAPT_FLAG_BITS + blocks[b].costs[i];
+        }
+    }
+
+    int i = 0;
+    for (int k = 1; k < RLE_SUMMARY_VARIANTS; ++k) {
+        if (best[k] < best[i]) i = k;
+    }
+    plan->bits = best[i];
+
+    for (uint64_t b = num_blocks; b-- > 0;) {
+        plan->n[b] = (uint8_t)(i + RLE_SUMMARY_MIN_N);
+        if (b > 0) {
+            int prev = from[b][i];
+            if (prev != i) plan->switches++;
+            i = prev;
+        }
+    }
+    free(from);
+    return 0;
+}
+
+static inline void rle_adapt_free(RleAdaptPlan *plan) {
+    free(plan->n);
+    plan->n = NULL;
+}
+
+// The plan against the best single N ('global' holds the unclipped costs).
+static inline void rle_adapt_print(const RleAdaptPlan *plan, const uint64_t *global) {
+    int best = 0;
+    for (int i = 1; i < RLE_SUMMARY_VARIANTS; ++i) {
+        if (global[i] < global[best]) best = i;
+    }
+    uint64_t per_n[RLE_SUMMARY_VARIANTS] = { 0 };
+    for (uint64_t b = 0; b < plan->num_blocks; ++b) per_n[plan->n[b] - RLE_SUMMARY_MIN_N]++;
+
+    uint64_t header_bits = (plan->num_blocks ? plan->num_blocks - 1 : 0) * RLE_ADAPT_FLAG_BITS +
+                           plan->switches * RLE_ADAPT_SWITCH_BITS;
+    double saving = 100.0 * ((double)global[best] - (double)plan->bits) / (double)global[best];
+
+    printf("\n--- Adaptive N (%lu blocks of %lu voxels) ---\n", plan->num_blocks, plan->block_voxels);
+    printf("Global N=%2d:  %12lu bits (%.2f MB)\n", best + RLE_SUMMARY_MIN_N, global[best],
+           (double)global[best] / 8.0 / 1024.0 / 1024.0);
+    printf("Adaptive:     %12lu bits (%.2f MB), %lu switches, %lu header bits\n", plan->bits,
+           (double)plan->bits / 8.0 / 1024.0 / 1024.0, plan->switches, header_bits);
+    printf("Saving:       %12.2f %%\n", saving);
+    printf("Blocks per N:");
+    for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) {
+        if (per_n[i]) printf(" N=%d:%lu", i + RLE_SUMMARY_MIN_N, per_n[i]);
+    }
+    printf("\n");
+}
+
+// Writes the edge in front of block b (b >= 1): the flag, and the new N if
+// it changes.
+static inline void rle_adapt_put_edge(RleBitWriter *w, const RleAdaptPlan *plan, uint64_t b) {
+    if (plan->n[b] == plan->n[b - 1]) {
+        rle_bw_put(w, 0, RLE_ADAPT_FLAG_BITS);
+    } else {
+        rle_bw_put(w, 1, RLE_ADAPT_FLAG_BITS);
+        rle_bw_put(w, (uint64_t)(plan->n[b] - RLE_SUMMARY_MIN_N), RLE_ADAPT_SWITCH_BITS);
+    }
+}
+
+// Same as rle_write_file(), with the "RLA2" header. Returns 0 on success.
+static inline int rle_adapt_write_file(const char *filename, RleHeader hdr, uint64_t block_voxels,
+                                       const RleBitWriter *w) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) return 1;
+
+    uint8_t head[RLE_ADAPT_HEADER_BYTES];
+    rle_put_header(head, RLE_ADAPT_MAGIC, hdr, rle_bw_bits(w));
+    rle_put_le(head + RLE_HEADER_BYTES, block_voxels, 8);
+
+    int err = fwrite(head, 1, sizeof(head), f) != sizeof(head);
+    if (!err) err = rle_write_payload(f, w);
+
+    if (fclose(f) != 0) err = 1;
+    return err;
+}
+
+// Decodes a whole adaptive stream ('s->hdr.n_bits' is the first block's N)
+// into one byte per voxel. Returns 0 on success, 1 on a corrupt stream.
+static inline int rle_adapt_decode(const RleStream *s, uint64_t block_voxels, uint8_t *out) {
+    unsigned n = s->hdr.n_bits;
+    uint64_t bitpos = 0;
+    uint64_t voxel = 0;
+    uint64_t block_end = block_voxels < s->num_voxels ? block_voxels : s->num_voxels;
+    const uint8_t *limit = out + s->num_voxels;
+
+    while (voxel < s->num_voxels) {
+        if (voxel == block_end) {
+            if (bitpos + RLE_ADAPT_FLAG_BITS > s->hdr.total_bits) return 1;
+            uint64_t flag = rle_peek_bits(s->data, bitpos, RLE_ADAPT_FLAG_BITS);
+            bitpos += RLE_ADAPT_FLAG_BITS;
+            if (flag) {
+                if (bitpos + RLE_ADAPT_SWITCH_BITS > s->hdr.total_bits) return 1;
+                n = (unsigned)rle_peek_bits(s->data, bitpos, RLE_ADAPT_SWITCH_BITS) + RLE_SUMMARY_MIN_N;
+                bitpos += RLE_ADAPT_SWITCH_BITS;
+            }
+            block_end = block_end + block_voxels < s->num_voxels ? block_end + block_voxels : s->num_voxels;
+        }
+
+        unsigned packet = n + 1;
+        if (bitpos + packet > s->hdr.total_bits) return 1;
+        uint64_t p = rle_peek_bits(s->data, bitpos, packet);
+        uint64_t len = p & ((1ULL << n) - 1);
+        bitpos += packet;
+
+        // A packet never crosses a block edge
+        if (len == 0 || voxel + len > block_end) return 1;
+        rle_fill(out + voxel, (uint8_t)(p >> n), (size_t)len, limit);
+        voxel += len;
+    }
+    return bitpos == s->hdr.total_bits ? 0 : 1;
+}
+
+// Scans a segment [first, ...) of the volume into the summaries of the
+// blocks it touches, clipping runs at the block edges. For engines that see
+// their segment as a sequence of buffers (the MPI ranks); 'blocks' starts as
+// empty summaries.
+typedef struct {
+    RleSummary *blocks;
+    uint64_t block_voxels;
+    uint64_t pos;           // volume index of the next voxel
+    uint8_t thr;
+    RleOpenRun run;
+    RleSummary piece;       // open piece of block pos / block_voxels
+} RleBlockScan;
+
+static inline void rle_block_scan_add_run(void *ctx, size_t len) {
+    rle_summary_add_run((RleSummary *)ctx, len);
+}
+
+static inline void rle_block_scan_begin(RleBlockScan *bs, RleSummary *blocks, uint64_t block_voxels,
+                                        uint64_t first, uint8_t thr) {
+    bs->blocks = blocks;
+    bs->block_voxels = block_voxels;
+    bs->pos = first;
+    bs->thr = thr;
+    bs->run.val = 0;
+    bs->run.len = 0;
+    rle_summary_init(&bs->piece);
+}
+
+// Closes the open piece and stitches it onto its block.
+static inline void rle_block_scan_close(RleBlockScan *bs, uint64_t block) {
+    RleSummary *s = &bs->piece;
+    if (s->empty) return;
+    rle_summary_add_run(s, bs->run.len);
+    s->last_val = bs->run.val;
+    s->last_len = bs->run.len;
+    s->single_run = (s->runs == 1);
+    bs->blocks[block] = rle_summary_merge(&bs->blocks[block], s);
+    rle_summary_init(s);
+}
+
+static inline void rle_block_scan_feed(RleBlockScan *bs, const uint8_t *p, uint64_t n) {
+    while (n > 0) {
+        uint64_t block = bs->pos / bs->block_voxels;
+        uint64_t room = (block + 1) * bs->block_voxels - bs->pos;
+        uint64_t take = n < room ? n : room;
+
+        if (bs->piece.empty) {
+            bs->run.val = (p[0] > bs->thr) ? 1 : 0;
+            bs->run.len = 0;
+            bs->piece.first_val = bs->run.val;
+            bs->piece.empty = 0;
+        }
+        rle_scan_range(p, (size_t)take, bs->thr, &bs->run, rle_block_scan_add_run, &bs->piece);
+
+        bs->pos += take;
+        p += take;
+        n -= take;
+        if (take == room) rle_block_scan_close(bs, block);
+    }
+}
+
+static inline void rle_block_scan_finish(RleBlockScan *bs) {
+    if (!bs->piece.empty) rle_block_scan_close(bs, (bs->pos - 1) / bs->block_voxels);
+}
+
+#endif
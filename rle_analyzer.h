@@ -0,0 +1,167 @@
+// Push-style RLE analyzer: the scan as a context object that is fed the
+// volume piece by piece.
+//
+//   RleAnalyzer a;
+//   rle_begin(&a, threshold);
+//   for (each slice as it comes off the reconstruction)
+//       rle_feed(&a, slice, X * Y);
+//   RleSummary s = rle_finish(&a);       // s.costs[N - 2] = bits for N
+//
+// The open run and the per-N costs live in the context, so pieces can have
+// any size (a slice, a read block, a single voxel) and nothing is buffered:
+// every call thresholds its voxels with the SIMD kernel (rle_simd.h) and
+// returns. The result is the same RleSummary as from one scan of all the
+// pieces together, which also makes it a segment that stitches with
+// rle_summary_merge(); a chunk, a rank's slab and a whole volume are all
+// scanned the same way.
+//
+// Two optional outputs, set between rle_begin() and the first feed:
+//   rle_count_into()   counts the runs in a histogram instead of costing
+//                      them (rle_hist.h)
+//   rle_encode_into()  writes every run as packets of one N (rle_encode.h),
+//                      so the stream is ready at rle_finish(); its size is
+//                      the cost for that N
+// In both modes the summary has no costs, only its runs and edge runs, so
+// the 16 divides per run are not paid for numbers nobody reads.
+#ifndef RLE_ANALYZER_H
+#define RLE_ANALYZER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rle_simd.h"
+#include "rle_mask.h"
+#include "rle_hist.h"
+#include "rle_encode.h"
+#include "rle_summary.h"
+
+typedef struct {
+    uint8_t thr;
+    RleOpenRun run;
+    RleSummary sum;         // sum.empty until the first voxel
+
+    RleHist *hist;          // NULL: cost every run as it closes
+    RleBitWriter *out;      // NULL: no encoding
+    int n_bits;
+    uint8_t out_val;        // value of the run that closes next
+} RleAnalyzer;
+
+// The run callbacks, one per mode, so every scan loop is specialised for
+// its mode and has no per-run branch on it.
+static inline void rle_analyzer_edge(RleAnalyzer *a, size_t len) {
+    if (a->sum.runs == 0) a->sum.first_len = len;
+    a->sum.runs++;
+}
+
+static inline void rle_analyzer_cost(void *ctx, size_t len) {
+    rle_summary_add_run(&((RleAnalyzer *)ctx)->sum, len);
+}
+
+static inline void rle_analyzer_count(void *ctx, size_t len) {
+    RleAnalyzer *a = (RleAnalyzer *)ctx;
+    rle_analyzer_edge(a, len);
+    rle_hist_add(a->hist, len, 1);
+}
+
+static inline void rle_analyzer_encode(void *ctx, size_t len) {
+    RleAnalyzer *a = (RleAnalyzer *)ctx;
+    rle_analyzer_edge(a, len);
+    if (a->hist) rle_hist_add(a->hist, len, 1);
+    rle_encode_run(a->out, a->out_val, len, a->n_bits);
+    a->out_val ^= 1;
+}
+
+static inline void rle_begin(RleAnalyzer *a, uint8_t thr) {
+    a->thr = thr;
+    a->run.val = 0;
+    a->run.len = 0;
+    rle_summary_init(&a->sum);
+    a->hist = NULL;
+    a->out = NULL;
+    a->n_bits = 0;
+    a->out_val = 0;
+}
+
+// Histogram mode: closed runs go into 'hist' (initialised by the caller,
+// which also frees it).
+static inline void rle_count_into(RleAnalyzer *a, RleHist *hist) {
+    a->hist = hist;
+}
+
+// Encodes the runs with 'n_bits' into 'w' as they close.
+static inline void rle_encode_into(RleAnalyzer *a, RleBitWriter *w, int n_bits) {
+    a->out = w;
+    a->n_bits = n_bits;
+}
+
+static inline void rle_analyzer_start(RleAnalyzer *a, uint8_t first) {
+    a->run.val = first;
+    a->sum.empty = 0;
+    a->sum.first_val = first;
+    a->out_val = first;
+}
+
+// Scans the next n voxels. The first call seeds the open run from p[0],
+// later calls continue where the previous one stopped.
+static inline void rle_feed(RleAnalyzer *a, const uint8_t *p, size_t n) {
+    if (n == 0) return;
+    if (a->sum.empty) rle_analyzer_start(a, (p[0] > a->thr) ? 1 : 0);
+    if (a->out) {
+        rle_scan_range(p, n, a->thr, &a->run, rle_analyzer_encode, a);
+    } else if (a->hist) {
+        rle_scan_range(p, n, a->thr, &a->run, rle_analyzer_count, a);
+    } else {
+        rle_scan_range(p, n, a->thr, &a->run, rle_analyzer_cost, a);
+    }
+}
+
+// Same for voxels [first, last) of an already thresholded mask (rle_mask.h).
+// 'first' has to be a multiple of 64.
+static inline void rle_feed_mask(RleAnalyzer *a, const RleMask *mask, uint64_t first, uint64_t last) {
+    if (first >= last) return;
+    if (a->sum.empty) rle_analyzer_start(a, rle_mask_get(mask, first));
+    if (a->out) {
+        rle_mask_scan(mask, first, last, &a->run, rle_analyzer_encode, a);
+    } else if (a->hist) {
+        rle_mask_scan(mask, first, last, &a->run, rle_analyzer_count, a);
+    } else {
+        rle_mask_scan(mask, first, last, &a->run, rle_analyzer_cost, a);
+    }
+}
+
+// Closes the open run and returns the summary of everything fed since
+// rle_begin(). An analyzer that was never fed returns an empty summary.
+static inline RleSummary rle_finish(RleAnalyzer *a) {
+    if (a->sum.empty) return a->sum;
+    if (a->out) {
+        rle_analyzer_encode(a, a->run.len);
+    } else if (a->hist) {
+        rle_analyzer_count(a, a->run.len);
+    } else {
+        rle_analyzer_cost(a, a->run.len);
+    }
+    a->sum.last_val = a->run.val;
+    a->sum.last_len = a->run.len;
+    a->sum.single_run = (a->sum.runs == 1);
+    return a->sum;
+}
+
+// One-shot scan of voxels [first, last): of 'volume', or of 'mask' if it is
+// not NULL ('first' a multiple of 64 then). With 'hist' the runs are counted
+// into it instead of costed. This is the chunk kernel of the threaded
+// engines, which stitch the chunk summaries in order with
+// rle_summary_merge(), and the whole-volume scan of the single-threaded ones.
+static inline RleSummary rle_analyze_range(const uint8_t *volume, const RleMask *mask, uint64_t first,
+                                           uint64_t last, uint8_t thr, RleHist *hist) {
+    RleAnalyzer a;
+    rle_begin(&a, thr);
+    if (hist) rle_count_into(&a, hist);
+    if (mask) {
+        rle_feed_mask(&a, mask, first, last);
+    } else if (last > first) {
+        rle_feed(&a, volume + first, (size_t)(last - first));
+    }
+    return rle_finish(&a);
+}
+
+#endif
@@ -0,0 +1,217 @@
+// Variable-length run-length codes, as an alternative to N-bit packets.
+//
+// The packet model pays N + 1 bits per packet and splits long runs into
+// packets of 2^N - 1. The codes here write every run as one codeword
+// instead. Runs alternate between 0 and 1, so only the first value is
+// stored (1 bit for the whole stream):
+//
+//   gamma     Elias gamma: 2 floor(log2 L) + 1 bits
+//   delta     Elias delta: floor(log2 L) + 2 floor(log2(floor(log2 L) + 1)) + 1
+//   rice      Golomb-Rice with parameter k: (L - 1) >> k in unary, then k bits
+//   escape    S-bit count for L < 2^S, otherwise S zero bits and gamma(L)
+//
+// A model is a bits-per-run function plus a parameter range; every
+// parameter is one variant, and the print shows the best one. Adding a model
+// means adding a row to rle_code_models[].
+//
+// Costs are additive per run, so they are evaluated from a run-length
+// histogram (rle_hist.h) once at the end, and the scan itself is unchanged.
+// Runs split at a chunk or rank seam are fixed the same way as the packet
+// costs: remove the two halves, add the merged run (rle_codes_stitch()).
+// RleCodeSummary carries the code costs next to the segment summary, and
+// rle_codes_merge() joins two of them associatively like
+// rle_summary_merge(), so ranks can stitch them in a tree reduction.
+//
+// Included after <mpi.h>, this also provides the matching MPI datatype and
+// reduction operator.
+#ifndef RLE_CODES_H
+#define RLE_CODES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "rle_hist.h"
+#include "rle_summary.h"
+
+// Largest number of variants over all models
+#define RLE_CODE_MAX_VARIANTS 64
+
+// Bits stored once per stream: the value of the first run
+#define RLE_CODE_HEADER_BITS 1
+
+typedef uint64_t (*rle_code_bits_fn)(uint64_t len, unsigned k);
+
+typedef struct {
+    const char *name;
+    rle_code_bits_fn bits;
+    unsigned min_k, max_k;  // parameter range, one variant per value
+} RleCodeModel;
+
+static inline unsigned rle_code_log2(uint64_t v) {
+    return 63 - (unsigned)__builtin_clzll(v);
+}
+
+static inline uint64_t rle_code_gamma(uint64_t len, unsigned k) {
+    (void)k;
+    return 2 * (uint64_t)rle_code_log2(len) + 1;
+}
+
+static inline uint64_t rle_code_delta(uint64_t len, unsigned k) {
+    (void)k;
+    unsigned l = rle_code_log2(len);
+    return l + 2 * (uint64_t)rle_code_log2(l + 1) + 1;
+}
+
+static inline uint64_t rle_code_rice(uint64_t len, unsigned k) {
+    return ((len - 1) >> k) + 1 + k;
+}
+
+static inline uint64_t rle_code_escape(uint64_t len, unsigned k) {
+    return len < (1ULL << k) ? k : k + rle_code_gamma(len, 0);
+}
+
+static const RleCodeModel rle_code_models[] = {
+    { "gamma", rle_code_gamma, 0, 0 },
+    { "delta", rle_code_delta, 0, 0 },
+    { "rice", rle_code_rice, 0, 24 },
+    { "escape", rle_code_escape, 1, 24 },
+};
+
+#define RLE_CODE_MODELS ((int)(sizeof(rle_code_models) / sizeof(rle_code_models[0])))
+
+// Number of variants, i.e. entries of a costs array
+static inline int rle_codes_variants(void) {
+    int count = 0;
+    for (int m = 0; m < RLE_CODE_MODELS; ++m) {
+        count += (int)(rle_code_models[m].max_k - rle_code_models[m].min_k + 1);
+    }
+    return count;
+}
+
+// costs[v] += count * bits of a run of 'len' for every variant v. 'count'
+// may be a two's complement negative, like rle_hist_add().
+static inline void rle_codes_add_run(uint64_t *costs, uint64_t len, uint64_t count) {
+    int v = 0;
+    for (int m = 0; m < RLE_CODE_MODELS; ++m) {
+        const RleCodeModel *model = &rle_code_models[m];
+        for (unsigned k = model->min_k; k <= model->max_k; ++k) costs[v++] += count * model->bits(len, k);
+    }
+}
+
+// Costs of every run counted in 'h'.
+static inline void rle_codes_from_hist(const RleHist *h, uint64_t *costs) {
+    for (int v = 0; v < rle_codes_variants(); ++v) costs[v] = 0;
+
+    for (uint64_t len = 1; len < RLE_HIST_DENSE; ++len) {
+        if (h->dense[len]) rle_codes_add_run(costs, len, h->dense[len]);
+    }
+    for (size_t i = 0; i < h->sparse_cap; ++i) {
+        if (h->sparse[i].len && h->sparse[i].count) {
+            rle_codes_add_run(costs, h->sparse[i].len, h->sparse[i].count);
+        }
+    }
+}
+
+// Corrects 'costs' for joining segment 'left' with the segment 'right'
+// that follows it: if the touching runs have the same value they are one run.
+// Call before left = rle_summary_merge(left, right).
+static inline void rle_codes_seam(uint64_t *costs, const RleSummary *left, const RleSummary *right) {
+    if (left->empty || right->empty || left->last_val != right->first_val) return;
+    rle_codes_add_run(costs, left->last_len, (uint64_t)-1);
+    rle_codes_add_run(costs, right->first_len, (uint64_t)-1);
+    rle_codes_add_run(costs, left->last_len + right->first_len, 1);
+}
+
+// Folds the segment summaries in order and applies rle_codes_seam() at
+// every seam, so 'costs' counted per segment become the whole stream's.
+static inline void rle_codes_stitch(const RleSummary *segs, size_t count, uint64_t *costs) {
+    RleSummary acc;
+    rle_summary_init(&acc);
+    for (size_t i = 0; i < count; ++i) {
+        rle_codes_seam(costs, &acc, &segs[i]);
+        acc = rle_summary_merge(&acc, &segs[i]);
+    }
+}
+
+// A segment's code costs with the summary whose edge runs fix its seams
+typedef struct {
+    RleSummary sum;
+    uint64_t costs[RLE_CODE_MAX_VARIANTS];  // rle_codes_variants() used, rest 0
+} RleCodeSummary;
+
+// Segment 'a' directly followed by segment 'b'.
+static inline RleCodeSummary rle_codes_merge(const RleCodeSummary *a, const RleCodeSummary *b) {
+    RleCodeSummary r;
+    for (int v = 0; v < RLE_CODE_MAX_VARIANTS; ++v) r.costs[v] = a->costs[v] + b->costs[v];
+    rle_codes_seam(r.costs, &a->sum, &b->sum);
+    r.sum = rle_summary_merge(&a->sum, &b->sum);
+    return r;
+}
+
+#if defined(MPI_VERSION)
+#include <stddef.h>
+
+// MPI_Op callback: inout = in (+) inout, 'in' being the segment on the left.
+static inline void rle_codes_mpi_merge(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    RleCodeSummary *left = (RleCodeSummary *)in;
+    RleCodeSummary *right = (RleCodeSummary *)inout;
+    for (int i = 0; i < *len; ++i) right[i] = rle_codes_merge(&left[i], &right[i]);
+}
+
+// RleCodeSummary as one derived datatype: the summary (rle_summary_mpi_type()),
+// then the costs. Free with MPI_Type_free().
+static inline MPI_Datatype rle_codes_mpi_type(void) {
+    MPI_Datatype sum_type = rle_summary_mpi_type();
+    int lengths[2] = { 1, RLE_CODE_MAX_VARIANTS };
+    MPI_Aint displs[2] = { offsetof(RleCodeSummary, sum), offsetof(RleCodeSummary, costs) };
+    MPI_Datatype types[2] = { sum_type, MPI_UINT64_T };
+
+    MPI_Datatype tmp, type;
+    MPI_Type_create_struct(2, lengths, displs, types, &tmp);
+    MPI_Type_create_resized(tmp, 0, sizeof(RleCodeSummary), &type);
+    MPI_Type_free(&tmp);
+    MPI_Type_free(&sum_type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+// The stitching reduction for code costs, not commutative like
+// rle_summary_mpi_op(). Free with MPI_Op_free().
+static inline MPI_Op rle_codes_mpi_op(void) {
+    MPI_Op op;
+    MPI_Op_create(rle_codes_mpi_merge, 0, &op);
+    return op;
+}
+#endif
+
+// One row per model with its best parameter, next to the best N-bit packet
+// size ('best_packets' bits).
+static inline void rle_codes_print(const uint64_t *costs, uint64_t best_packets) {
+    printf("\n--- Run-length Codes ---\n");
+    int v = 0;
+    for (int m = 0; m < RLE_CODE_MODELS; ++m) {
+        const RleCodeModel *model = &rle_code_models[m];
+        int best = v;
+        unsigned best_k = model->min_k;
+        for (unsigned k = model->min_k; k <= model->max_k; ++k, ++v) {
+            if (costs[v] < costs[best]) {
+                best = v;
+                best_k = k;
+            }
+        }
+
+        uint64_t bits = costs[best] + RLE_CODE_HEADER_BITS;
+        char label[32];
+        if (model->min_k == model->max_k) {
+            snprintf(label, sizeof(label), "%s", model->name);
+        } else {
+            snprintf(label, sizeof(label), "%s k=%u", model->name, best_k);
+        }
+        printf("%-18s %12lu bits (%.2f MB), %+.2f %% vs best N\n", label, bits,
+               (double)bits / 8.0 / 1024.0 / 1024.0,
+               100.0 * ((double)bits - (double)best_packets) / (double)best_packets);
+    }
+}
+
+#endif
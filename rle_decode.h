@@ -0,0 +1,288 @@
+// Decoder for the packet stream written by rle_encode.h, with a seek index
+// for random access.
+//
+// The index stores one entry every K voxels (e.g. a few per Z-slice):
+// the bit offset of the packet that covers voxel k*K, and how many voxels of
+// that packet lie before k*K. Any voxel range can then be decoded by jumping
+// to the nearest entry at or before its start, so viewers can pull single
+// slices or slabs without touching the rest of the stream, and a big range
+// can be split across threads that decode independently.
+//
+// Index file layout (little-endian): "RLEI" magic, uint64 K, uint64 entry
+// count, then (uint64 bit offset, uint64 skip) per entry.
+#ifndef RLE_DECODE_H
+#define RLE_DECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "rle_encode.h"
+
+#define RLE_INDEX_MAGIC "RLEI"
+
+// The stream in memory. 'data' has 8 zero bytes of padding past the payload
+// so rle_peek_bits() may always load a full word.
+typedef struct {
+    RleHeader hdr;
+    uint8_t *data;
+    uint64_t num_voxels;
+} RleStream;
+
+typedef struct {
+    uint64_t bit_offset;
+    uint64_t skip;
+} RleIndexEntry;
+
+typedef struct {
+    uint64_t step;      // K, voxels between entries
+    uint64_t count;
+    RleIndexEntry *entries;
+} RleIndex;
+
+static inline uint64_t rle_get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Returns 'nbits' (1..57) bits starting at 'bitpos', MSB first.
+static inline uint64_t rle_peek_bits(const uint8_t *data, uint64_t bitpos, unsigned nbits) {
+    const uint8_t *p = data + (bitpos >> 3);
+    uint64_t w = 0;
+    for (int b = 0; b < 8; ++b) w = (w << 8) | p[b];
+    return (w << (bitpos & 7)) >> (64 - nbits);
+}
+
+// Loads a file written by rle_write_file(). Returns 0 on success.
+static inline int rle_read_file(const char *filename, RleStream *s) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return 1;
+
+    uint8_t head[RLE_HEADER_BYTES] = {0};
+    if (fread(head, 1, RLE_HEADER_BYTES_V1, f) != RLE_HEADER_BYTES_V1) {
+        fclose(f);
+        return 1;
+    }
+    int v2 = memcmp(head, RLE_FILE_MAGIC, 4) == 0;
+    if (v2 ? fread(head + RLE_HEADER_BYTES_V1, 1, RLE_HEADER_BYTES - RLE_HEADER_BYTES_V1, f) !=
+                 RLE_HEADER_BYTES - RLE_HEADER_BYTES_V1
+           : memcmp(head, RLE_FILE_MAGIC_V1, 4) != 0) {
+        fclose(f);
+        return 1;
+    }
+    s->hdr.x = (uint32_t)rle_get_le(head + 4, 4);
+    s->hdr.y = (uint32_t)rle_get_le(head + 8, 4);
+    s->hdr.z = (uint32_t)rle_get_le(head + 12, 4);
+    s->hdr.threshold = head[16];
+    s->hdr.n_bits = head[17];
+    s->hdr.flags = v2 ? head[18] : 0;
+    s->hdr.total_bits = rle_get_le(head + 20, 8);
+    s->hdr.window_lo = (int32_t)(uint32_t)rle_get_le(head + 28, 4);
+    s->hdr.window_hi = (int32_t)(uint32_t)rle_get_le(head + 32, 4);
+    s->num_voxels = (uint64_t)s->hdr.x * s->hdr.y * s->hdr.z;
+
+    size_t nbytes = (size_t)((s->hdr.total_bits + 7) / 8);
+    s->data = (uint8_t *)calloc(nbytes + 8, 1);
+    if (!s->data) { fclose(f); return 1; }
+    if (fread(s->data, 1, nbytes, f) != nbytes) {
+        free(s->data); s->data = NULL; fclose(f); return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+// Wraps an in-memory writer as a stream (copies the words out big-endian).
+static inline int rle_stream_from_writer(RleStream *s, RleHeader hdr, const RleBitWriter *w) {
+    hdr.total_bits = rle_bw_bits(w);
+    s->hdr = hdr;
+    s->num_voxels = (uint64_t)hdr.x * hdr.y * hdr.z;
+
+    size_t nbytes = (size_t)((hdr.total_bits + 7) / 8);
+    s->data = (uint8_t *)calloc(nbytes + 16, 1);
+    if (!s->data) return 1;
+
+    for (size_t i = 0; i < w->nwords; ++i) {
+        for (int b = 0; b < 8; ++b) s->data[8 * i + b] = (uint8_t)(w->words[i] >> (56 - 8 * b));
+    }
+    if (w->acc_bits) {
+        uint64_t tail = w->acc << (64 - w->acc_bits);
+        for (int b = 0; b < 8; ++b) s->data[8 * w->nwords + b] = (uint8_t)(tail >> (56 - 8 * b));
+    }
+    return 0;
+}
+
+static inline void rle_stream_free(RleStream *s) {
+    free(s->data);
+    s->data = NULL;
+}
+
+// One pass over the packet headers, recording an entry every 'step' voxels.
+// Cost is proportional to the number of packets, not voxels.
+static inline int rle_build_index(const RleStream *s, uint64_t step, RleIndex *idx) {
+    unsigned n = s->hdr.n_bits;
+    unsigned packet = n + 1;
+
+    idx->step = step;
+    idx->count = (s->num_voxels + step - 1) / step;
+    idx->entries = (RleIndexEntry *)malloc(idx->count * sizeof(RleIndexEntry));
+    if (!idx->entries) return 1;
+
+    uint64_t bitpos = 0;
+    uint64_t voxel = 0;     // first voxel of the current packet
+    uint64_t next = 0;      // next voxel that needs an entry
+    uint64_t k = 0;
+
+    while (k < idx->count && bitpos + packet <= s->hdr.total_bits) {
+        uint64_t len = rle_peek_bits(s->data, bitpos, packet) & ((1ULL << n) - 1);
+
+        // One packet can cover several entry points if K is small
+        while (k < idx->count && next < voxel + len) {
+            idx->entries[k].bit_offset = bitpos;
+            idx->entries[k].skip = next - voxel;
+            k++;
+            next += step;
+        }
+
+        voxel += len;
+        bitpos += packet;
+    }
+
+    if (k != idx->count) {
+        free(idx->entries);
+        idx->entries = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+static inline void rle_index_free(RleIndex *idx) {
+    free(idx->entries);
+    idx->entries = NULL;
+}
+
+static inline int rle_write_index(const char *filename, const RleIndex *idx) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) return 1;
+
+    uint8_t head[20];
+    memcpy(head, RLE_INDEX_MAGIC, 4);
+    rle_put_le(head + 4, idx->step, 8);
+    rle_put_le(head + 12, idx->count, 8);
+    int err = fwrite(head, 1, sizeof(head), f) != sizeof(head);
+
+    uint8_t buf[16];
+    for (uint64_t k = 0; !err && k < idx->count; ++k) {
+        rle_put_le(buf, idx->entries[k].bit_offset, 8);
+        rle_put_le(buf + 8, idx->entries[k].skip, 8);
+        err = fwrite(buf, 1, sizeof(buf), f) != sizeof(buf);
+    }
+
+    if (fclose(f) != 0) err = 1;
+    return err;
+}
+
+// Loads an index written by rle_write_index() for a stream of 'num_voxels'
+// voxels. Returns 0 on success, 1 if the file cannot be read or does not
+// describe such a stream: a step of 0, an entry count other than
+// ceil(num_voxels / step), or a file size that does not match the count.
+static inline int rle_read_index(const char *filename, uint64_t num_voxels, RleIndex *idx) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return 1;
+
+    uint8_t head[20];
+    struct stat st;
+    if (fread(head, 1, sizeof(head), f) != sizeof(head) ||
+        memcmp(head, RLE_INDEX_MAGIC, 4) != 0 || fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        return 1;
+    }
+    idx->step = rle_get_le(head + 4, 8);
+    idx->count = rle_get_le(head + 12, 8);
+    // 16 bytes per entry after the head; the count is at most num_voxels,
+    // so the size check cannot overflow
+    if (idx->step == 0 || idx->count != num_voxels / idx->step + (num_voxels % idx->step != 0) ||
+        (uint64_t)st.st_size != sizeof(head) + idx->count * 16) {
+        fclose(f);
+        return 1;
+    }
+    idx->entries = (RleIndexEntry *)malloc(idx->count * sizeof(RleIndexEntry));
+    if (!idx->entries) { fclose(f); return 1; }
+
+    uint8_t buf[16];
+    for (uint64_t k = 0; k < idx->count; ++k) {
+        if (fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+            free(idx->entries); idx->entries = NULL; fclose(f); return 1;
+        }
+        idx->entries[k].bit_offset = rle_get_le(buf, 8);
+        idx->entries[k].skip = rle_get_le(buf + 8, 8);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Writes 'len' copies of 'val' at 'dst'. Short runs (the common case on noisy
+// data) are written with 16-byte stores that may spill past the run; the
+// spill is overwritten by the next run. 'limit' is the end of the buffer this
+// caller owns, the stores never go beyond it.
+static inline void rle_fill(uint8_t *dst, uint8_t val, size_t len, const uint8_t *limit) {
+#if defined(__SSE2__)
+    if (len <= 64 && dst + 64 <= limit) {
+        __m128i v = _mm_set1_epi8((char)val);
+        for (size_t i = 0; i < len; i += 16) _mm_storeu_si128((__m128i *)(dst + i), v);
+        return;
+    }
+#else
+    (void)limit;
+#endif
+    memset(dst, val, len);
+}
+
+// Expands voxels [first, last) into out[0 .. last-first) as 0/1 bytes.
+// Returns 0 on success, 1 if the range is outside the volume, the index does
+// not cover it or the stream ends early.
+static inline int rle_decode_range(const RleStream *s, const RleIndex *idx,
+                                   uint64_t first, uint64_t last, uint8_t *out) {
+    if (first > last || last > s->num_voxels) return 1;
+    if (first == last) return 0;
+
+    unsigned n = s->hdr.n_bits;
+    unsigned packet = n + 1;
+    uint64_t count_mask = (1ULL << n) - 1;
+
+    if (idx->step == 0 || first / idx->step >= idx->count) return 1;
+    const RleIndexEntry *e = &idx->entries[first / idx->step];
+    uint64_t bitpos = e->bit_offset;
+    uint64_t voxel = (first / idx->step) * idx->step;
+    if (e->skip > voxel) return 1;
+    voxel -= e->skip;
+
+    uint8_t *dst = out;
+    const uint8_t *limit = out + (last - first);
+
+    while (voxel < last) {
+        if (bitpos + packet > s->hdr.total_bits) return 1; // truncated stream
+
+        uint64_t p = rle_peek_bits(s->data, bitpos, packet);
+        uint8_t val = (uint8_t)(p >> n);
+        uint64_t len = p & count_mask;
+        bitpos += packet;
+
+        uint64_t a = voxel > first ? voxel : first;
+        uint64_t b = voxel + len < last ? voxel + len : last;
+        if (a < b) {
+            rle_fill(dst, val, (size_t)(b - a), limit);
+            dst += b - a;
+        }
+        voxel += len;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,267 @@
+// Bit-packed RLE encoder for the (value bit, N-bit count) packet stream
+// that calc_bits_for_run() models.
+//
+// A run of length L is written as ceil(L / (2^N - 1)) packets. Every packet is
+// 1 value bit followed by an N-bit count in 1..2^N-1; all packets but the last
+// one of a run carry the full count. Bits are packed MSB first, so the stream
+// can be read back as a plain big-endian bit sequence.
+//
+// File layout (all integers little-endian):
+//   "RLE2" magic, uint32 X, uint32 Y, uint32 Z, uint8 threshold, uint8 N,
+//   uint8 flags, 1 reserved byte, uint64 number of payload bits, int32 window
+//   low, int32 window high, payload bytes.
+// Flag bit 0 marks a 16-bit volume that was windowed to 0/1 on load
+// (rle_volume.h): the voxels inside [low, high] are 1 and the threshold is
+// 0. rle_read_file() also reads the older "RLE1" files, which are 8 bytes
+// shorter and have no flags or window.
+#ifndef RLE_ENCODE_H
+#define RLE_ENCODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RLE_FILE_MAGIC "RLE2"
+#define RLE_HEADER_BYTES 36
+
+// "RLE1" files, from before the window was stored
+#define RLE_FILE_MAGIC_V1 "RLE1"
+#define RLE_HEADER_BYTES_V1 28
+
+// Header flags
+#define RLE_HEADER_WINDOWED 1
+
+typedef struct {
+    uint32_t x, y, z;
+    uint8_t threshold;
+    uint8_t n_bits;
+    uint64_t total_bits;
+    uint8_t flags;                  // RLE_HEADER_WINDOWED
+    int32_t window_lo, window_hi;   // only with RLE_HEADER_WINDOWED
+} RleHeader;
+
+// Word-buffered bit writer. Full 64-bit words go to 'words', the
+// not-yet-full tail lives right-aligned in 'acc'.
+typedef struct {
+    uint64_t *words;
+    size_t nwords;
+    size_t cap_words;
+    uint64_t acc;
+    unsigned acc_bits;
+} RleBitWriter;
+
+static inline int rle_bw_init(RleBitWriter *w, size_t cap_words) {
+    if (cap_words == 0) cap_words = 1024;
+    w->words = (uint64_t *)malloc(cap_words * sizeof(uint64_t));
+    w->nwords = 0;
+    w->cap_words = cap_words;
+    w->acc = 0;
+    w->acc_bits = 0;
+    return w->words ? 0 : 1;
+}
+
+static inline void rle_bw_free(RleBitWriter *w) {
+    free(w->words);
+    w->words = NULL;
+    w->nwords = w->cap_words = 0;
+}
+
+static inline uint64_t rle_bw_bits(const RleBitWriter *w) {
+    return (uint64_t)w->nwords * 64 + w->acc_bits;
+}
+
+static inline void rle_bw_push_word(RleBitWriter *w, uint64_t word) {
+    if (w->nwords == w->cap_words) {
+        size_t cap = w->cap_words * 2;
+        uint64_t *grown = (uint64_t *)realloc(w->words, cap * sizeof(uint64_t));
+        if (!grown) {
+            perror("realloc");
+            exit(1);
+        }
+        w->words = grown;
+        w->cap_words = cap;
+    }
+    w->words[w->nwords++] = word;
+}
+
+// Appends the low 'nbits' bits of 'value' (1..64), most significant first.
+static inline void rle_bw_put(RleBitWriter *w, uint64_t value, unsigned nbits) {
+    unsigned room = 64 - w->acc_bits;
+
+    if (nbits < room) {
+        w->acc = (w->acc << nbits) | value;
+        w->acc_bits += nbits;
+        return;
+    }
+
+    // The word fills up: top part of 'value' completes it, the rest carries over
+    unsigned rest = nbits - room;
+    uint64_t word = (w->acc_bits ? (w->acc << room) : 0) | (value >> rest);
+    rle_bw_push_word(w, word);
+
+    w->acc = rest ? (value & ((1ULL << rest) - 1)) : 0;
+    w->acc_bits = rest;
+}
+
+// Appends everything written to 'src' to the end of 'dst', at whatever bit
+// alignment 'dst' is currently at.
+static inline void rle_bw_append(RleBitWriter *dst, const RleBitWriter *src) {
+    for (size_t i = 0; i < src->nwords; ++i) rle_bw_put(dst, src->words[i], 64);
+    if (src->acc_bits) rle_bw_put(dst, src->acc, src->acc_bits);
+}
+
+// Emits the packets for one run of 'len' voxels with value 'val'.
+static inline void rle_encode_run(RleBitWriter *w, uint8_t val, uint64_t len, int n_bits) {
+    uint64_t max_cap = (1ULL << n_bits) - 1;
+    uint64_t full = ((uint64_t)val << n_bits) | max_cap;
+
+    while (len > max_cap) {
+        rle_bw_put(w, full, (unsigned)n_bits + 1);
+        len -= max_cap;
+    }
+    rle_bw_put(w, ((uint64_t)val << n_bits) | len, (unsigned)n_bits + 1);
+}
+
+// One chunk of a parallel encode. The first and the last run of a chunk may
+// continue in the neighbouring chunk, so only the runs strictly between them
+// are encoded into 'body'; the two edge runs are written by rle_join_chunks().
+typedef struct {
+    RleBitWriter body;
+    int n_bits;
+
+    uint8_t first_val;
+    uint64_t first_len;
+    uint8_t last_val;
+    uint64_t last_len;
+
+    uint8_t cur_val;    // value of the run that closes next
+    size_t runs;        // closed runs seen so far
+} RleEncChunk;
+
+// Callback for rle_scan_range(): a run inside the chunk just closed.
+static inline void rle_chunk_encode_run(void *ctx, size_t len) {
+    RleEncChunk *c = (RleEncChunk *)ctx;
+
+    if (c->runs == 0) {
+        c->first_len = len;
+    } else {
+        rle_encode_run(&c->body, c->cur_val, len, c->n_bits);
+    }
+
+    c->cur_val ^= 1;
+    c->runs++;
+}
+
+// Records the run still open at the end of the chunk. If no run closed
+// inside the chunk, that one run is both its first and its last run.
+static inline void rle_chunk_finish(RleEncChunk *c, uint8_t open_val, uint64_t open_len) {
+    c->last_val = open_val;
+    c->last_len = open_len;
+    if (c->runs == 0) c->first_len = open_len;
+}
+
+// Joins the chunk bodies in order and writes the seam runs. If the last run
+// of chunk t has the same value as the first run of chunk t+1 they are one
+// run, exactly like the boundary fix in analyze_results(). The result is
+// bit-identical to encoding the whole volume serially.
+static inline void rle_join_chunks(const RleEncChunk *chunks, int count, int n_bits,
+                                   RleBitWriter *out) {
+    int have_carry = 0;
+    uint8_t carry_val = 0;
+    uint64_t carry_len = 0;
+
+    for (int t = 0; t < count; ++t) {
+        const RleEncChunk *c = &chunks[t];
+
+        if (c->last_len == 0) continue; // empty chunk
+
+        // A chunk made of a single run only extends (or replaces) the carry
+        if (c->runs == 0) {
+            if (have_carry && carry_val == c->last_val) {
+                carry_len += c->last_len;
+            } else {
+                if (have_carry) rle_encode_run(out, carry_val, carry_len, n_bits);
+                carry_val = c->last_val;
+                carry_len = c->last_len;
+                have_carry = 1;
+            }
+            continue;
+        }
+
+        if (have_carry && carry_val == c->first_val) {
+            rle_encode_run(out, carry_val, carry_len + c->first_len, n_bits);
+        } else {
+            if (have_carry) rle_encode_run(out, carry_val, carry_len, n_bits);
+            rle_encode_run(out, c->first_val, c->first_len, n_bits);
+        }
+
+        rle_bw_append(out, &c->body);
+
+        carry_val = c->last_val;
+        carry_len = c->last_len;
+        have_carry = 1;
+    }
+
+    if (have_carry) rle_encode_run(out, carry_val, carry_len, n_bits);
+}
+
+static inline void rle_put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// Writes the payload bytes. Returns 0 on success, 1 on any I/O error.
+static inline int rle_write_payload(FILE *f, const RleBitWriter *w) {
+    int err = 0;
+
+    // Words are stored big-endian so the file is one continuous MSB-first stream
+    uint8_t buf[8 * 1024];
+    size_t i = 0;
+    while (!err && i < w->nwords) {
+        size_t n = 0;
+        for (; i < w->nwords && n < sizeof(buf); ++i, n += 8) {
+            for (int b = 0; b < 8; ++b) buf[n + b] = (uint8_t)(w->words[i] >> (56 - 8 * b));
+        }
+        err = fwrite(buf, 1, n, f) != n;
+    }
+    if (!err && w->acc_bits) {
+        uint64_t tail = w->acc << (64 - w->acc_bits);
+        size_t nbytes = (w->acc_bits + 7) / 8;
+        for (size_t b = 0; b < nbytes; ++b) buf[b] = (uint8_t)(tail >> (56 - 8 * b));
+        err = fwrite(buf, 1, nbytes, f) != nbytes;
+    }
+    return err;
+}
+
+// Fills the RLE_HEADER_BYTES of the header behind 'magic' for a payload of
+// 'bits' bits.
+static inline void rle_put_header(uint8_t *head, const char *magic, RleHeader hdr, uint64_t bits) {
+    memset(head, 0, RLE_HEADER_BYTES);
+    memcpy(head, magic, 4);
+    rle_put_le(head + 4, hdr.x, 4);
+    rle_put_le(head + 8, hdr.y, 4);
+    rle_put_le(head + 12, hdr.z, 4);
+    head[16] = hdr.threshold;
+    head[17] = hdr.n_bits;
+    head[18] = hdr.flags;
+    rle_put_le(head + 20, bits, 8);
+    rle_put_le(head + 28, (uint32_t)hdr.window_lo, 4);
+    rle_put_le(head + 32, (uint32_t)hdr.window_hi, 4);
+}
+
+// Writes header + payload. Returns 0 on success, 1 on any I/O error.
+static inline int rle_write_file(const char *filename, RleHeader hdr, const RleBitWriter *w) {
+    FILE *f = fopen(filename, "wb");
+    if (!f) return 1;
+
+    uint8_t head[RLE_HEADER_BYTES];
+    rle_put_header(head, RLE_FILE_MAGIC, hdr, rle_bw_bits(w));
+
+    int err = fwrite(head, 1, sizeof(head), f) != sizeof(head);
+    if (!err) err = rle_write_payload(f, w);
+
+    if (fclose(f) != 0) err = 1;
+    return err;
+}
+
+#endif
@@ -0,0 +1,379 @@
+// Grayscale (byte-value) RLE: PackBits cost and encoder.
+//
+// The binary analysis only sees voxel > threshold. For archiving the raw
+// uint8_t volume we want runs of identical bytes instead, optionally after
+// quantising every voxel to its top B bits (v & q). The format is PackBits:
+//
+//   header h in 0..127     h + 1 literal bytes follow
+//   header h in 129..255   the next byte repeats 257 - h times (2..128)
+//
+// A run of at least RLE_GRAY_MIN_REPEAT equal bytes becomes repeat packets
+// (2 bytes per 128), everything shorter is gathered into literal stretches
+// (1 header per 128 bytes). A 1-byte leftover of a long run is written as a
+// 1-byte literal packet, so the run still costs 2 bytes per started 128.
+//
+// Run boundaries come from a SIMD byte compare of each 64-byte block with
+// the same block shifted by one (rle_gray_edges64), walked with ctz exactly
+// like rle_scan_word().
+//
+// Chunks scan in parallel. A chunk's summary has its first and last run,
+// which may continue in the neighbours, and its interior: the literal bytes
+// before the first and after the last interior repeat ('lead', 'tail'), and
+// the cost of everything from the first to the last interior repeat, which
+// no seam can change. Only the edges are decided when the chunks are joined
+// in order (RleGrayJoin), which writes the same stream a serial encoder
+// would.
+#ifndef RLE_GRAY_H
+#define RLE_GRAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle_simd.h"
+
+#define RLE_GRAY_MIN_REPEAT 3
+#define RLE_GRAY_PACKET 128
+
+// Keeps the top 'bits' (1..8) bits of a voxel
+static inline uint8_t rle_gray_quant_mask(int bits) {
+    return (uint8_t)(0xFF << (8 - bits));
+}
+
+// Bit i is set if (p[i] ^ p[i-1]) & q is not zero, for i = 0..63. Reads
+// p[-1..63].
+static inline uint64_t rle_gray_edges64(const uint8_t *p, uint8_t q) {
+#if defined(__AVX512BW__)
+    __m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void *)p),
+                                 _mm512_loadu_si512((const void *)(p - 1)));
+    return (uint64_t)_mm512_test_epi8_mask(x, _mm512_set1_epi8((char)q));
+#elif defined(__AVX2__)
+    const __m256i qm = _mm256_set1_epi8((char)q);
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t same = 0;
+    for (int k = 0; k < 2; ++k) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + 32 * k)),
+                                     _mm256_loadu_si256((const __m256i *)(p + 32 * k - 1)));
+        x = _mm256_and_si256(x, qm);
+        same |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero)) << (32 * k);
+    }
+    return ~same;
+#elif defined(__SSE2__)
+    const __m128i qm = _mm_set1_epi8((char)q);
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t same = 0;
+    for (int k = 0; k < 4; ++k) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 16 * k)),
+                                  _mm_loadu_si128((const __m128i *)(p + 16 * k - 1)));
+        x = _mm_and_si128(x, qm);
+        same |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) << (16 * k);
+    }
+    return ~same;
+#else
+    uint64_t m = 0;
+    for (int k = 0; k < 64; ++k) m |= (uint64_t)(((p[k] ^ p[k - 1]) & q) != 0) << k;
+    return m;
+#endif
+}
+
+// Scans p[0..n) for runs of equal (quantised) bytes, same contract as
+// rle_scan_range(): 'run->val' is seeded with p[0] & q before the first call
+// and the open run stays in 'run'.
+static inline void rle_gray_scan(const uint8_t *p, size_t n, uint8_t q, RleOpenRun *run,
+                                 rle_emit_fn emit, void *ctx) {
+    if (n == 0) return;
+
+    // Voxel 0 against the carried-in value, after that p[-1] is readable
+    if ((p[0] & q) == run->val) {
+        run->len++;
+    } else {
+        emit(ctx, run->len);
+        run->len = 1;
+    }
+
+    size_t i = 1;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t edges = rle_gray_edges64(p + i, q);
+        if (edges == 0) {
+            run->len += 64;
+            continue;
+        }
+
+        size_t len = run->len;
+        unsigned pos = 0;
+        do {
+            unsigned b = (unsigned)__builtin_ctzll(edges);
+            emit(ctx, len + (b - pos));
+            len = 0;
+            pos = b;
+            edges &= edges - 1;
+        } while (edges);
+        run->len = 64 - pos;
+    }
+
+    for (; i < n; ++i) {
+        if ((p[i] & q) == (p[i - 1] & q)) {
+            run->len++;
+        } else {
+            emit(ctx, run->len);
+            run->len = 1;
+        }
+    }
+    run->val = p[n - 1] & q;
+}
+
+static inline uint64_t rle_gray_repeat_bytes(uint64_t len) {
+    return 2 * ((len + RLE_GRAY_PACKET - 1) / RLE_GRAY_PACKET);
+}
+
+static inline uint64_t rle_gray_literal_bytes(uint64_t len) {
+    return len + (len + RLE_GRAY_PACKET - 1) / RLE_GRAY_PACKET;
+}
+
+// Growable output buffer
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} RleByteBuf;
+
+static inline int rle_bb_init(RleByteBuf *b, size_t cap) {
+    if (cap == 0) cap = 4096;
+    b->data = (uint8_t *)malloc(cap);
+    b->len = 0;
+    b->cap = cap;
+    return b->data ? 0 : 1;
+}
+
+static inline void rle_bb_free(RleByteBuf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+static inline uint8_t *rle_bb_reserve(RleByteBuf *b, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap * 2 > b->len + n ? b->cap * 2 : b->len + n;
+        uint8_t *grown = (uint8_t *)realloc(b->data, cap);
+        if (!grown) {
+            perror("realloc");
+            exit(1);
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    uint8_t *p = b->data + b->len;
+    b->len += n;
+    return p;
+}
+
+static inline void rle_gray_put_repeat(RleByteBuf *b, uint8_t val, uint64_t len) {
+    while (len > 0) {
+        uint64_t n = len < RLE_GRAY_PACKET ? len : RLE_GRAY_PACKET;
+        uint8_t *p = rle_bb_reserve(b, 2);
+        p[0] = n == 1 ? 0 : (uint8_t)(257 - n);
+        p[1] = val;
+        len -= n;
+    }
+}
+
+static inline void rle_gray_put_literals(RleByteBuf *b, const uint8_t *src, uint64_t len, uint8_t q) {
+    while (len > 0) {
+        uint64_t n = len < RLE_GRAY_PACKET ? len : RLE_GRAY_PACKET;
+        uint8_t *p = rle_bb_reserve(b, (size_t)n + 1);
+        p[0] = (uint8_t)(n - 1);
+        for (uint64_t k = 0; k < n; ++k) p[k + 1] = src[k] & q;
+        src += n;
+        len -= n;
+    }
+}
+
+typedef struct {
+    uint64_t bytes;         // from the first to the last interior repeat
+    uint64_t first_len;
+    uint64_t last_len;
+    uint64_t lead;          // literal bytes before the first interior repeat
+    uint64_t tail;          // literal bytes after the last interior repeat
+    uint64_t runs;          // closed runs
+    uint8_t first_val;
+    uint8_t last_val;
+    uint8_t has_repeat;     // 1 if some interior run is a repeat
+    uint8_t empty;
+} RleGraySummary;
+
+// Scan state of one chunk. With 'body' set, the packets from the first to
+// the last interior repeat are written into it.
+typedef struct {
+    RleGraySummary sum;
+    const uint8_t *src;     // first voxel of the chunk
+    uint8_t q;
+    RleByteBuf *body;
+    uint64_t pos;           // chunk offset of the next run
+    uint64_t lit_start;     // chunk offset of the open tail literals
+} RleGrayChunk;
+
+static inline void rle_gray_chunk_run(void *ctx, size_t len) {
+    RleGrayChunk *c = (RleGrayChunk *)ctx;
+    RleGraySummary *s = &c->sum;
+    uint64_t at = c->pos;
+    c->pos += len;
+
+    if (s->runs++ == 0) {
+        s->first_len = len;
+        return;
+    }
+
+    if (len < RLE_GRAY_MIN_REPEAT) {
+        if (s->has_repeat) {
+            s->tail += len;
+        } else {
+            s->lead += len;
+        }
+        return;
+    }
+
+    if (s->has_repeat) {
+        s->bytes += rle_gray_literal_bytes(s->tail);
+        if (c->body) rle_gray_put_literals(c->body, c->src + c->lit_start, s->tail, c->q);
+    }
+    s->has_repeat = 1;
+    s->bytes += rle_gray_repeat_bytes(len);
+    if (c->body) rle_gray_put_repeat(c->body, c->src[at] & c->q, len);
+    s->tail = 0;
+    c->lit_start = c->pos;
+}
+
+// Scans the n voxels at 'src' into c->sum.
+static inline void rle_gray_chunk_scan(RleGrayChunk *c, const uint8_t *src, size_t n, uint8_t q,
+                                       RleByteBuf *body) {
+    memset(&c->sum, 0, sizeof(c->sum));
+    c->src = src;
+    c->q = q;
+    c->body = body;
+    c->pos = 0;
+    c->lit_start = 0;
+    if (n == 0) {
+        c->sum.empty = 1;
+        return;
+    }
+
+    c->sum.first_val = src[0] & q;
+    RleOpenRun run = { c->sum.first_val, 0 };
+    rle_gray_scan(src, n, q, &run, rle_gray_chunk_run, c);
+
+    c->sum.last_val = run.val;
+    c->sum.last_len = run.len;
+    if (c->sum.runs == 0) c->sum.first_len = run.len;
+}
+
+// Serial join of the chunk summaries in volume order. Tracks the run that
+// may still grow and the literal stretch that may still grow; with 'out'
+// set it also writes the stream.
+typedef struct {
+    uint64_t bytes;
+    const uint8_t *volume;
+    uint8_t q;
+    RleByteBuf *out;
+
+    int have_run;
+    uint8_t run_val;
+    uint64_t run_start, run_len;
+
+    uint64_t lit_start, lit_len;
+} RleGrayJoin;
+
+static inline void rle_gray_join_begin(RleGrayJoin *j, const uint8_t *volume, uint8_t q, RleByteBuf *out) {
+    memset(j, 0, sizeof(*j));
+    j->volume = volume;
+    j->q = q;
+    j->out = out;
+}
+
+static inline void rle_gray_join_literals(RleGrayJoin *j, uint64_t start, uint64_t len) {
+    if (len == 0) return;
+    if (j->lit_len == 0) j->lit_start = start;
+    j->lit_len += len;
+}
+
+static inline void rle_gray_join_flush(RleGrayJoin *j) {
+    j->bytes += rle_gray_literal_bytes(j->lit_len);
+    if (j->out) rle_gray_put_literals(j->out, j->volume + j->lit_start, j->lit_len, j->q);
+    j->lit_len = 0;
+}
+
+// The open run is complete: a repeat, or more literals.
+static inline void rle_gray_join_close(RleGrayJoin *j) {
+    if (!j->have_run) return;
+    j->have_run = 0;
+    if (j->run_len < RLE_GRAY_MIN_REPEAT) {
+        rle_gray_join_literals(j, j->run_start, j->run_len);
+        return;
+    }
+    rle_gray_join_flush(j);
+    j->bytes += rle_gray_repeat_bytes(j->run_len);
+    if (j->out) rle_gray_put_repeat(j->out, j->run_val, j->run_len);
+}
+
+static inline void rle_gray_join_run(RleGrayJoin *j, uint8_t val, uint64_t start, uint64_t len) {
+    if (j->have_run && j->run_val == val) {
+        j->run_len += len;
+        return;
+    }
+    rle_gray_join_close(j);
+    j->have_run = 1;
+    j->run_val = val;
+    j->run_start = start;
+    j->run_len = len;
+}
+
+// Appends chunk [start, end) with summary 's' and, when writing, its body.
+static inline void rle_gray_join_chunk(RleGrayJoin *j, const RleGraySummary *s, uint64_t start,
+                                       uint64_t end, const RleByteBuf *body) {
+    if (s->empty) return;
+
+    rle_gray_join_run(j, s->first_val, start, s->first_len);
+    if (s->runs == 0) return;
+
+    // The interior's first run differs from the chunk's first run, so the
+    // open run is complete
+    rle_gray_join_close(j);
+    rle_gray_join_literals(j, start + s->first_len, s->lead);
+    if (s->has_repeat) {
+        rle_gray_join_flush(j);
+        j->bytes += s->bytes;
+        if (j->out) memcpy(rle_bb_reserve(j->out, body->len), body->data, body->len);
+        rle_gray_join_literals(j, end - s->last_len - s->tail, s->tail);
+    }
+    rle_gray_join_run(j, s->last_val, end - s->last_len, s->last_len);
+}
+
+static inline void rle_gray_join_finish(RleGrayJoin *j) {
+    rle_gray_join_close(j);
+    rle_gray_join_flush(j);
+}
+
+// Decodes a PackBits stream into 'num_voxels' bytes. Returns 0 on success,
+// 1 if the stream is corrupt or does not fill the output exactly.
+static inline int rle_gray_decode(const uint8_t *data, size_t len, uint8_t *out, uint64_t num_voxels) {
+    size_t i = 0;
+    uint64_t o = 0;
+    while (i < len) {
+        uint8_t h = data[i++];
+        if (h < 128) {
+            uint64_t n = (uint64_t)h + 1;
+            if (i + n > len || o + n > num_voxels) return 1;
+            memcpy(out + o, data + i, (size_t)n);
+            i += n;
+            o += n;
+        } else if (h > 128) {
+            uint64_t n = 257 - (uint64_t)h;
+            if (i >= len || o + n > num_voxels) return 1;
+            memset(out + o, data[i++], (size_t)n);
+            o += n;
+        }
+    }
+    return o == num_voxels ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,184 @@
+// Run-length histogram for deferred cost evaluation.
+//
+// Charging every closed run to all 16 N variants costs 16 divides per run.
+// In histogram mode the scan only counts how often each run length occurs,
+// and the costs for every N are computed once at the end from the counts.
+//
+// Short runs (the common case on noisy slices) go into a dense table that
+// fits in L1. The few long runs (air, solid bone) go into a small open
+// addressing map keyed by length.
+//
+// Histograms from different threads/ranks merge by plain addition, and the
+// boundary fix is "remove the two split runs, add the merged one".
+#ifndef RLE_HIST_H
+#define RLE_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Run lengths below this are counted in the dense table
+#define RLE_HIST_DENSE 4096
+
+typedef struct {
+    uint64_t len;   // 0 marks an empty slot
+    uint64_t count;
+} RleHistEntry;
+
+typedef struct {
+    uint64_t dense[RLE_HIST_DENSE];
+
+    RleHistEntry *sparse;
+    size_t sparse_cap;  // always a power of two
+    size_t sparse_used;
+} RleHist;
+
+static inline size_t rle_hist_slot(uint64_t len, size_t cap) {
+    return (size_t)((len * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+// Returns 0 on success, 1 if the sparse map could not be allocated.
+static inline int rle_hist_init(RleHist *h) {
+    memset(h->dense, 0, sizeof(h->dense));
+    h->sparse_cap = 256;
+    h->sparse_used = 0;
+    h->sparse = (RleHistEntry *)calloc(h->sparse_cap, sizeof(RleHistEntry));
+    return h->sparse ? 0 : 1;
+}
+
+static inline void rle_hist_free(RleHist *h) {
+    free(h->sparse);
+    h->sparse = NULL;
+    h->sparse_cap = 0;
+    h->sparse_used = 0;
+}
+
+// Empties the histogram for the next scan, keeping the sparse map it grew.
+static inline void rle_hist_clear(RleHist *h) {
+    memset(h->dense, 0, sizeof(h->dense));
+    memset(h->sparse, 0, h->sparse_cap * sizeof(RleHistEntry));
+    h->sparse_used = 0;
+}
+
+static inline void rle_hist_add_sparse(RleHist *h, uint64_t len, uint64_t delta);
+
+static inline void rle_hist_grow(RleHist *h) {
+    RleHistEntry *old = h->sparse;
+    size_t old_cap = h->sparse_cap;
+
+    h->sparse_cap = old_cap * 2;
+    h->sparse_used = 0;
+    h->sparse = (RleHistEntry *)calloc(h->sparse_cap, sizeof(RleHistEntry));
+    if (!h->sparse) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (old[i].len) rle_hist_add_sparse(h, old[i].len, old[i].count);
+    }
+    free(old);
+}
+
+static inline void rle_hist_add_sparse(RleHist *h, uint64_t len, uint64_t delta) {
+    // Keep the load factor under 1/2 so probe chains stay short
+    if (2 * (h->sparse_used + 1) > h->sparse_cap) rle_hist_grow(h);
+
+    size_t i = rle_hist_slot(len, h->sparse_cap);
+    while (h->sparse[i].len && h->sparse[i].len != len) {
+        i = (i + 1) & (h->sparse_cap - 1);
+    }
+    if (!h->sparse[i].len) {
+        h->sparse[i].len = len;
+        h->sparse_used++;
+    }
+    h->sparse[i].count += delta;
+}
+
+// Adds 'delta' runs of length 'len'. A negative delta (passed as its two's
+// complement) removes runs, which is what the boundary fix needs.
+static inline void rle_hist_add(RleHist *h, uint64_t len, uint64_t delta) {
+    if (len < RLE_HIST_DENSE) {
+        h->dense[len] += delta;
+    } else {
+        rle_hist_add_sparse(h, len, delta);
+    }
+}
+
+// dst += src
+static inline void rle_hist_merge(RleHist *dst, const RleHist *src) {
+    for (size_t i = 0; i < RLE_HIST_DENSE; ++i) dst->dense[i] += src->dense[i];
+    for (size_t i = 0; i < src->sparse_cap; ++i) {
+        if (src->sparse[i].len) rle_hist_add_sparse(dst, src->sparse[i].len, src->sparse[i].count);
+    }
+}
+
+// Replaces two runs split at a seam with one merged run.
+static inline void rle_hist_fix_seam(RleHist *h, uint64_t len_a, uint64_t len_b) {
+    rle_hist_add(h, len_a, (uint64_t)-1);
+    rle_hist_add(h, len_b, (uint64_t)-1);
+    rle_hist_add(h, len_a + len_b, 1);
+}
+
+// Number of distinct long run lengths, i.e. how many (len, count) pairs
+// rle_hist_export_sparse() will write.
+static inline size_t rle_hist_sparse_count(const RleHist *h) {
+    return h->sparse_used;
+}
+
+// Writes the long runs as flat (len, count) pairs, for sending over MPI.
+static inline void rle_hist_export_sparse(const RleHist *h, uint64_t *pairs) {
+    size_t k = 0;
+    for (size_t i = 0; i < h->sparse_cap; ++i) {
+        if (h->sparse[i].len) {
+            pairs[2 * k] = h->sparse[i].len;
+            pairs[2 * k + 1] = h->sparse[i].count;
+            k++;
+        }
+    }
+}
+
+static inline void rle_hist_import_sparse(RleHist *h, const uint64_t *pairs, size_t n) {
+    for (size_t k = 0; k < n; ++k) rle_hist_add(h, pairs[2 * k], pairs[2 * k + 1]);
+}
+
+static inline uint64_t rle_hist_packets(uint64_t len, int n_bits) {
+    uint64_t max_cap = (1ULL << n_bits) - 1;
+    return (len + max_cap - 1) / max_cap;
+}
+
+// Total bit cost for every N in [min_n, max_n], same model as
+// calc_bits_for_run(): ceil(L / (2^N - 1)) packets of N + 1 bits.
+static inline void rle_hist_costs(const RleHist *h, int min_n, int max_n, uint64_t *costs) {
+    for (int n = min_n; n <= max_n; ++n) costs[n - min_n] = 0;
+
+    for (uint64_t len = 1; len < RLE_HIST_DENSE; ++len) {
+        uint64_t c = h->dense[len];
+        if (!c) continue;
+        for (int n = min_n; n <= max_n; ++n) {
+            costs[n - min_n] += c * rle_hist_packets(len, n) * (uint64_t)(n + 1);
+        }
+    }
+
+    for (size_t i = 0; i < h->sparse_cap; ++i) {
+        uint64_t len = h->sparse[i].len;
+        uint64_t c = h->sparse[i].count;
+        if (!len || !c) continue;
+        for (int n = min_n; n <= max_n; ++n) {
+            costs[n - min_n] += c * rle_hist_packets(len, n) * (uint64_t)(n + 1);
+        }
+    }
+}
+
+// Total number of runs counted
+static inline uint64_t rle_hist_runs(const RleHist *h) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < RLE_HIST_DENSE; ++i) total += h->dense[i];
+    for (size_t i = 0; i < h->sparse_cap; ++i) {
+        if (h->sparse[i].len) total += h->sparse[i].count;
+    }
+    return total;
+}
+
+#endif
@@ -0,0 +1,229 @@
+// Streaming volume ingestion: scan the file while it is still being read.
+//
+// load_volume() reads the whole file before the scan starts, so peak memory
+// is the full volume and wall time is read time + scan time. The two
+// functions here feed the file to the SIMD kernel block by block instead,
+// carrying the open run over from one block to the next:
+//
+//  - rle_stream_mmap(): maps the file, tells the kernel we read it
+//    sequentially, prefetches the next block while scanning the current one
+//    and unmaps every block once it is done, so resident memory stays at a
+//    couple of blocks even for volumes bigger than RAM.
+//  - rle_stream_read(): a reader thread fills two buffers in turn while the
+//    caller scans the other one. This also reports how long the scan had to
+//    wait for I/O. If the thread cannot be started, the caller reads and
+//    scans in turn instead.
+//
+// Needs _POSIX_C_SOURCE >= 200112L for posix_madvise().
+#ifndef RLE_IO_H
+#define RLE_IO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rle_simd.h"
+
+// Default block size for both streaming modes
+#define RLE_IO_BLOCK ((size_t)64 * 1024 * 1024)
+
+typedef struct {
+    double total;       // open to last voxel scanned
+    double scan;        // time spent inside the kernel
+    double io_wait;     // time the scan waited for data (read mode only)
+    uint64_t bytes;     // voxels scanned
+} RleIoStats;
+
+static inline double rle_io_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Scans one block, seeding the open run from the very first voxel of the file.
+static inline void rle_io_scan_block(const uint8_t *p, size_t n, int first, uint8_t thr,
+                                     RleOpenRun *run, rle_emit_fn emit, void *ctx) {
+    if (n == 0) return;
+    if (first) {
+        run->val = (p[0] > thr) ? 1 : 0;
+        run->len = 0;
+    }
+    rle_scan_range(p, n, thr, run, emit, ctx);
+}
+
+// mmap variant. 'block' must be a multiple of the page size.
+// On return 'run' holds the last (still open) run. Returns 0 on success.
+static inline int rle_stream_mmap(const char *filename, size_t block, uint8_t thr,
+                                  RleOpenRun *run, rle_emit_fn emit, void *ctx,
+                                  RleIoStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    double start = rle_io_now();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return 1; }
+    size_t size = (size_t)st.st_size;
+
+    uint8_t *map = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    for (size_t off = 0; off < size; off += block) {
+        size_t n = (size - off < block) ? size - off : block;
+
+        // Ask for the next block now so it is read while we scan this one
+        if (off + n < size) {
+            size_t next = (size - off - n < block) ? size - off - n : block;
+            posix_madvise(map + off + n, next, POSIX_MADV_WILLNEED);
+        }
+
+        double t0 = rle_io_now();
+        rle_io_scan_block(map + off, n, off == 0, thr, run, emit, ctx);
+        stats->scan += rle_io_now() - t0;
+
+        // Done with this block, drop it from our address space
+        munmap(map + off, n);
+    }
+
+    stats->bytes = size;
+    stats->total = rle_io_now() - start;
+    return 0;
+}
+
+// Shared state between the scanner and the reader thread
+typedef struct {
+    FILE *f;
+    size_t block;
+    uint8_t *buf[2];
+    size_t len[2];
+    int full[2];        // 1 = filled by the reader, not yet scanned
+    int done;           // reader hit EOF (or an error)
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} RleReader;
+
+static inline void *rle_reader_main(void *arg) {
+    RleReader *r = (RleReader *)arg;
+
+    for (int k = 0;; k ^= 1) {
+        pthread_mutex_lock(&r->lock);
+        while (r->full[k]) pthread_cond_wait(&r->cond, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+
+        size_t n = fread(r->buf[k], 1, r->block, r->f);
+        int err = ferror(r->f);
+
+        pthread_mutex_lock(&r->lock);
+        r->len[k] = n;
+        r->full[k] = n > 0;
+        if (n < r->block) {
+            r->done = 1;
+            r->error = err;
+        }
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+
+        if (n < r->block) break;
+    }
+    return NULL;
+}
+
+// Fallback when the reader thread cannot be started: read a block, scan
+// it, read the next one, all on the calling thread with buf[0].
+static inline void rle_reader_sync(RleReader *r, uint8_t thr, RleOpenRun *run, rle_emit_fn emit, void *ctx,
+                                   RleIoStats *stats) {
+    for (int first = 1;; first = 0) {
+        double t0 = rle_io_now();
+        size_t n = fread(r->buf[0], 1, r->block, r->f);
+        stats->io_wait += rle_io_now() - t0;
+
+        double t1 = rle_io_now();
+        rle_io_scan_block(r->buf[0], n, first, thr, run, emit, ctx);
+        stats->scan += rle_io_now() - t1;
+        stats->bytes += n;
+
+        if (n < r->block) {
+            r->error = ferror(r->f);
+            break;
+        }
+    }
+}
+
+// Double-buffered read() variant. Returns 0 on success.
+static inline int rle_stream_read(const char *filename, size_t block, uint8_t thr,
+                                  RleOpenRun *run, rle_emit_fn emit, void *ctx,
+                                  RleIoStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    double start = rle_io_now();
+
+    RleReader r;
+    memset(&r, 0, sizeof(r));
+    r.block = block;
+    r.f = fopen(filename, "rb");
+    if (!r.f) return 1;
+    setvbuf(r.f, NULL, _IONBF, 0);
+
+    r.buf[0] = (uint8_t *)malloc(block);
+    r.buf[1] = (uint8_t *)malloc(block);
+    if (!r.buf[0] || !r.buf[1]) {
+        free(r.buf[0]); free(r.buf[1]); fclose(r.f);
+        return 1;
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+
+    pthread_t tid;
+    int threaded = pthread_create(&tid, NULL, rle_reader_main, &r) == 0;
+    if (!threaded) rle_reader_sync(&r, thr, run, emit, ctx, stats);
+
+    int first = 1;
+    for (int k = 0; threaded; k ^= 1) {
+        double t0 = rle_io_now();
+        pthread_mutex_lock(&r.lock);
+        // Buffers are filled and scanned in the same order, so once the
+        // reader is done an empty slot means there is nothing left.
+        while (!r.full[k] && !r.done) {
+            pthread_cond_wait(&r.cond, &r.lock);
+        }
+        int have = r.full[k];
+        pthread_mutex_unlock(&r.lock);
+        stats->io_wait += rle_io_now() - t0;
+
+        if (!have) break;
+
+        double t1 = rle_io_now();
+        rle_io_scan_block(r.buf[k], r.len[k], first, thr, run, emit, ctx);
+        stats->scan += rle_io_now() - t1;
+        stats->bytes += r.len[k];
+        first = 0;
+
+        pthread_mutex_lock(&r.lock);
+        r.full[k] = 0;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+    }
+
+    if (threaded) pthread_join(tid, NULL);
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.cond);
+    free(r.buf[0]);
+    free(r.buf[1]);
+    fclose(r.f);
+
+    stats->total = rle_io_now() - start;
+    return r.error ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,346 @@
+// Alternative scan orders: the RLE cost of the volume read along X (file
+// order), Y, Z, a Morton curve and a Hilbert curve.
+//
+// Every order is cut into chunks that are contiguous pieces of its own voxel
+// sequence, so the chunks can be scanned by different threads and stitched
+// in order with rle_summary_merge() exactly like the X chunks:
+//
+//   X        one slice per chunk, read in place
+//   Y        one slice per chunk, x major and y fastest
+//   Z        one row of columns (fixed y) per chunk, z fastest
+//   Morton   one cube of RLE_ORDER_CUBE^3 curve positions per chunk
+//   Hilbert  the same cubes along a Hilbert curve
+//
+// Nothing walks the volume with a large stride voxel by voxel. Y and Z are
+// gathered into a per-worker buffer tile by tile (RLE_ORDER_TILE wide, so a
+// tile touches a handful of pages and the writes stay in L1/L2), and the
+// curves visit 8x8x8 bricks: 64 short rows of one brick are read for 512
+// voxels. The gathered bytes then go through the usual SIMD run kernel.
+//
+// The curves are defined on the smallest power-of-two cube covering the
+// volume; positions outside the volume are skipped, so the runs simply
+// continue over them.
+#ifndef RLE_ORDER_H
+#define RLE_ORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rle_simd.h"
+#include "rle_summary.h"
+
+// Edge of a Y/Z gather tile in voxels
+#define RLE_ORDER_TILE 64
+// Edge of the cube of curve positions one Morton/Hilbert chunk covers
+#define RLE_ORDER_CUBE 128
+// Edge of a curve brick (fixed, the brick tables are 8x8x8)
+#define RLE_ORDER_BRICK 8
+
+typedef enum {
+    RLE_ORDER_X,
+    RLE_ORDER_Y,
+    RLE_ORDER_Z,
+    RLE_ORDER_MORTON,
+    RLE_ORDER_HILBERT,
+    RLE_ORDER_COUNT
+} RleOrder;
+
+static const char *const rle_order_names[RLE_ORDER_COUNT] = { "X", "Y", "Z", "Morton", "Hilbert" };
+
+typedef struct {
+    const uint8_t *voxels;
+    uint32_t x, y, z;
+    unsigned bits;          // curve cube edge is 1 << bits
+} RleVolume;
+
+// Voxel coordinates of the canonical 8x8x8 Morton and Hilbert bricks, filled
+// by rle_order_init()
+static uint8_t rle_morton_brick[512][3];
+static uint8_t rle_hilbert_brick[512][3];
+// Positions of the canonical Hilbert brick at (0,0,0), (1,0,0), (0,1,0),
+// (0,0,1), which pin down how a brick of the full curve is turned
+static unsigned rle_hilbert_probe[4];
+
+// Curve index 'code' to coordinates. Bit 3k+i of the code is bit k of
+// coordinate i (x, y, z).
+static inline void rle_morton_decode(uint64_t code, unsigned bits, uint32_t c[3]) {
+    c[0] = c[1] = c[2] = 0;
+    for (unsigned k = 0; k < bits; ++k) {
+        for (int i = 0; i < 3; ++i) c[i] |= (uint32_t)((code >> (3 * k + i)) & 1) << k;
+    }
+}
+
+// Skilling's transpose-to-axes ("Programming the Hilbert curve", 2004) for 3
+// dimensions. Only used per brick, not per voxel.
+static inline void rle_hilbert_decode(uint64_t code, unsigned bits, uint32_t c[3]) {
+    // Transposed index: the code's bits from the top go to x, y, z in turn
+    uint32_t t[3] = { 0, 0, 0 };
+    for (unsigned k = 0; k < bits; ++k) {
+        for (int i = 0; i < 3; ++i) t[i] |= (uint32_t)((code >> (3 * k + 2 - i)) & 1) << k;
+    }
+
+    // Gray decode
+    uint32_t h = t[2] >> 1;
+    for (int i = 2; i > 0; --i) t[i] ^= t[i - 1];
+    t[0] ^= h;
+
+    // Undo the excess work
+    uint32_t top = 2U << (bits - 1);
+    for (uint32_t q = 2; q != top; q <<= 1) {
+        uint32_t p = q - 1;
+        for (int i = 2; i >= 0; --i) {
+            if (t[i] & q) {
+                t[0] ^= p;
+            } else {
+                uint32_t s = (t[0] ^ t[i]) & p;
+                t[0] ^= s;
+                t[i] ^= s;
+            }
+        }
+    }
+    for (int i = 0; i < 3; ++i) c[i] = t[i];
+}
+
+// Fills the brick tables and the curve size. Call once per volume.
+static inline void rle_order_init(RleVolume *vol, const uint8_t *voxels, uint32_t x, uint32_t y,
+                                  uint32_t z) {
+    vol->voxels = voxels;
+    vol->x = x;
+    vol->y = y;
+    vol->z = z;
+
+    uint32_t edge = x > y ? x : y;
+    if (z > edge) edge = z;
+    vol->bits = 3;
+    while ((1U << vol->bits) < edge) vol->bits++;
+
+    for (unsigned i = 0; i < 512; ++i) {
+        uint32_t c[3];
+        rle_morton_decode(i, 3, c);
+        for (int k = 0; k < 3; ++k) rle_morton_brick[i][k] = (uint8_t)c[k];
+
+        rle_hilbert_decode(i, 3, c);
+        for (int k = 0; k < 3; ++k) rle_hilbert_brick[i][k] = (uint8_t)c[k];
+        int probe = -1;
+        if (c[0] + c[1] + c[2] == 0) probe = 0;
+        else if (c[0] == 1 && c[1] + c[2] == 0) probe = 1;
+        else if (c[1] == 1 && c[0] + c[2] == 0) probe = 2;
+        else if (c[2] == 1 && c[0] + c[1] == 0) probe = 3;
+        if (probe >= 0) rle_hilbert_probe[probe] = i;
+    }
+}
+
+static inline uint64_t rle_order_cube(const RleVolume *vol) {
+    uint64_t edge = 1ULL << vol->bits;
+    return edge < RLE_ORDER_CUBE ? edge : RLE_ORDER_CUBE;
+}
+
+static inline uint64_t rle_order_chunks(const RleVolume *vol, RleOrder order) {
+    switch (order) {
+    case RLE_ORDER_X:
+    case RLE_ORDER_Y:
+        return vol->z;
+    case RLE_ORDER_Z:
+        return vol->y;
+    default: {
+        uint64_t per_edge = (1ULL << vol->bits) / rle_order_cube(vol);
+        return per_edge * per_edge * per_edge;
+    }
+    }
+}
+
+// Scratch bytes one worker needs for any order
+static inline size_t rle_order_buffer_size(const RleVolume *vol) {
+    size_t slice = (size_t)vol->x * vol->y;
+    size_t row = (size_t)vol->x * vol->z;
+    size_t size = slice > row ? slice : row;
+    return size > 512 ? size : 512;
+}
+
+// Open scan of one chunk: the run kernel plus the summary bookkeeping.
+typedef struct {
+    RleSummary sum;
+    RleOpenRun run;
+    uint8_t thr;
+} RleOrderScan;
+
+static inline void rle_order_add_run(void *ctx, size_t len) {
+    rle_summary_add_run((RleSummary *)ctx, len);
+}
+
+static inline void rle_order_feed(RleOrderScan *sc, const uint8_t *p, size_t n) {
+    if (n == 0) return;
+    if (sc->sum.empty) {
+        sc->run.val = (p[0] > sc->thr) ? 1 : 0;
+        sc->run.len = 0;
+        sc->sum.first_val = sc->run.val;
+        sc->sum.empty = 0;
+    }
+    rle_scan_range(p, n, sc->thr, &sc->run, rle_order_add_run, &sc->sum);
+}
+
+// Y: slice z transposed, 'out' gets x major and y fastest
+static inline void rle_order_gather_y(const RleVolume *vol, uint32_t z, uint8_t *out) {
+    const uint8_t *slice = vol->voxels + (uint64_t)z * vol->x * vol->y;
+    for (uint32_t y0 = 0; y0 < vol->y; y0 += RLE_ORDER_TILE) {
+        uint32_t y1 = y0 + RLE_ORDER_TILE < vol->y ? y0 + RLE_ORDER_TILE : vol->y;
+        for (uint32_t x0 = 0; x0 < vol->x; x0 += RLE_ORDER_TILE) {
+            uint32_t x1 = x0 + RLE_ORDER_TILE < vol->x ? x0 + RLE_ORDER_TILE : vol->x;
+            for (uint32_t x = x0; x < x1; ++x) {
+                uint8_t *col = out + (uint64_t)x * vol->y;
+                for (uint32_t y = y0; y < y1; ++y) col[y] = slice[(uint64_t)y * vol->x + x];
+            }
+        }
+    }
+}
+
+// Z: the columns of row y, 'out' gets one column after the other
+static inline void rle_order_gather_z(const RleVolume *vol, uint32_t y, uint8_t *out) {
+    uint64_t slice = (uint64_t)vol->x * vol->y;
+    const uint8_t *row = vol->voxels + (uint64_t)y * vol->x;
+    for (uint32_t x0 = 0; x0 < vol->x; x0 += RLE_ORDER_TILE) {
+        uint32_t x1 = x0 + RLE_ORDER_TILE < vol->x ? x0 + RLE_ORDER_TILE : vol->x;
+        for (uint32_t z = 0; z < vol->z; ++z) {
+            const uint8_t *src = row + z * slice;
+            for (uint32_t x = x0; x < x1; ++x) out[(uint64_t)x * vol->z + z] = src[x];
+        }
+    }
+}
+
+// One 8x8x8 brick of a curve, starting at curve index 'code'. The brick's
+// voxels are brick[i] turned by the axes a[] and moved to 'origin'; voxels
+// outside the volume are left out. Returns the number written to 'out'.
+static inline size_t rle_order_gather_brick(const RleVolume *vol, const uint8_t (*brick)[3],
+                                            const int64_t origin[3], const int64_t a[3][3],
+                                            uint8_t *out) {
+    // Bounding corner of the brick, which is aligned to 8
+    int64_t lo[3], dims[3] = { vol->x, vol->y, vol->z };
+    int inside = 1;
+    for (int k = 0; k < 3; ++k) {
+        lo[k] = origin[k];
+        for (int j = 0; j < 3; ++j) if (a[j][k] < 0) lo[k] -= 7;
+        if (lo[k] >= dims[k]) return 0;
+        if (lo[k] + RLE_ORDER_BRICK > dims[k]) inside = 0;
+    }
+
+    // Voxel offsets of one step along each brick axis
+    int64_t sx = 1, sy = vol->x, sz = (int64_t)vol->x * vol->y;
+    int64_t step[3], base = origin[0] * sx + origin[1] * sy + origin[2] * sz;
+    for (int j = 0; j < 3; ++j) step[j] = a[j][0] * sx + a[j][1] * sy + a[j][2] * sz;
+
+    size_t n = 0;
+    for (int i = 0; i < 512; ++i) {
+        const uint8_t *b = brick[i];
+        if (!inside) {
+            int skip = 0;
+            for (int k = 0; k < 3; ++k) {
+                int64_t c = origin[k] + b[0] * a[0][k] + b[1] * a[1][k] + b[2] * a[2][k];
+                if (c >= dims[k]) skip = 1;
+            }
+            if (skip) continue;
+        }
+        out[n++] = vol->voxels[base + b[0] * step[0] + b[1] * step[1] + b[2] * step[2]];
+    }
+    return n;
+}
+
+// Walks the bricks of curve chunk 'chunk'
+static inline void rle_order_scan_curve(const RleVolume *vol, RleOrder order, uint64_t chunk,
+                                        uint8_t *buf, RleOrderScan *sc) {
+    uint64_t cube = rle_order_cube(vol);
+    uint64_t bricks = cube * cube * cube / 512;
+    uint64_t first = chunk * cube * cube * cube;
+
+    // Whole chunk outside the volume? Its positions fill an aligned cube.
+    uint32_t c[3];
+    if (order == RLE_ORDER_MORTON) rle_morton_decode(first, vol->bits, c);
+    else rle_hilbert_decode(first, vol->bits, c);
+    if ((c[0] & ~(uint32_t)(cube - 1)) >= vol->x || (c[1] & ~(uint32_t)(cube - 1)) >= vol->y ||
+        (c[2] & ~(uint32_t)(cube - 1)) >= vol->z) {
+        return;
+    }
+
+    for (uint64_t b = 0; b < bricks; ++b) {
+        uint64_t code = first + b * 512;
+        int64_t origin[3], a[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        size_t n;
+
+        if (order == RLE_ORDER_MORTON) {
+            rle_morton_decode(code, vol->bits, c);
+            for (int k = 0; k < 3; ++k) origin[k] = c[k];
+            n = rle_order_gather_brick(vol, (const uint8_t (*)[3])rle_morton_brick, origin, a, buf);
+        } else {
+            // Every Hilbert brick is the canonical one turned and moved: the
+            // probes give the origin and where each unit axis went
+            uint32_t p[4][3];
+            for (int k = 0; k < 4; ++k) rle_hilbert_decode(code + rle_hilbert_probe[k], vol->bits, p[k]);
+            for (int k = 0; k < 3; ++k) {
+                origin[k] = p[0][k];
+                for (int j = 0; j < 3; ++j) a[j][k] = (int64_t)p[j + 1][k] - (int64_t)p[0][k];
+            }
+            n = rle_order_gather_brick(vol, (const uint8_t (*)[3])rle_hilbert_brick, origin, a, buf);
+        }
+        rle_order_feed(sc, buf, n);
+    }
+}
+
+// Summary of chunk 'chunk' of 'order' at threshold 'thr'. 'buf' is scratch of
+// rle_order_buffer_size() bytes.
+static inline RleSummary rle_order_scan_chunk(const RleVolume *vol, RleOrder order, uint64_t chunk,
+                                              uint8_t thr, uint8_t *buf) {
+    RleOrderScan sc;
+    rle_summary_init(&sc.sum);
+    sc.run.val = 0;
+    sc.run.len = 0;
+    sc.thr = thr;
+
+    uint64_t slice = (uint64_t)vol->x * vol->y;
+    switch (order) {
+    case RLE_ORDER_X:
+        rle_order_feed(&sc, vol->voxels + chunk * slice, slice);
+        break;
+    case RLE_ORDER_Y:
+        rle_order_gather_y(vol, (uint32_t)chunk, buf);
+        rle_order_feed(&sc, buf, slice);
+        break;
+    case RLE_ORDER_Z:
+        rle_order_gather_z(vol, (uint32_t)chunk, buf);
+        rle_order_feed(&sc, buf, (size_t)vol->x * vol->z);
+        break;
+    default:
+        rle_order_scan_curve(vol, order, chunk, buf, &sc);
+        break;
+    }
+
+    if (!sc.sum.empty) {
+        rle_summary_add_run(&sc.sum, sc.run.len);
+        sc.sum.last_val = sc.run.val;
+        sc.sum.last_len = sc.run.len;
+        sc.sum.single_run = (sc.sum.runs == 1);
+    }
+    return sc.sum;
+}
+
+// One row per N, one column per order (MB), and the cheapest N of each order.
+static inline void rle_order_print(const RleSummary *sums) {
+    printf("\n--- Scan Orders (MB per N) ---\n");
+    printf("N   ");
+    for (int o = 0; o < RLE_ORDER_COUNT; ++o) printf(" %10s", rle_order_names[o]);
+    printf("\n");
+
+    int best[RLE_ORDER_COUNT] = { 0 };
+    for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) {
+        printf("N=%-2d", i + RLE_SUMMARY_MIN_N);
+        for (int o = 0; o < RLE_ORDER_COUNT; ++o) {
+            printf(" %10.2f", (double)sums[o].costs[i] / 8.0 / 1024.0 / 1024.0);
+            if (sums[o].costs[i] < sums[o].costs[best[o]]) best[o] = i;
+        }
+        printf("\n");
+    }
+    printf("best");
+    for (int o = 0; o < RLE_ORDER_COUNT; ++o) printf("       N=%-2d", best[o] + RLE_SUMMARY_MIN_N);
+    printf("\n");
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Synthetic CT phantoms with controlled run-length distributions.
+//
+// Benchmarks should not depend on having one particular 330 MB scan, and
+// the scan speed depends mostly on how many runs there are. Each phantom is
+// an 8-bit volume built from a seeded generator, so the same kind, size and
+// seed always give the same bytes:
+//
+//   air      long runs of air (mean 8192 voxels) with short objects (mean 48)
+//   noisy    runs of mean 3 and 2, about one transition every 2.5 voxels
+//   spheres  a box with 2-voxel walls holding random spheres, on air
+//
+// Air voxels are random values up to the threshold and object voxels random
+// values above it, so a gray-level scan sees noise while the mask sees only
+// the intended runs.
+#ifndef RLE_PHANTOM_H
+#define RLE_PHANTOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+typedef enum { RLE_PHANTOM_AIR, RLE_PHANTOM_NOISY, RLE_PHANTOM_SPHERES, RLE_PHANTOM_COUNT } RlePhantomKind;
+
+static const char *const rle_phantom_names[RLE_PHANTOM_COUNT] = { "air", "noisy", "spheres" };
+
+// Mean run lengths of the run-based phantoms: below, above the threshold
+static const double rle_phantom_means[RLE_PHANTOM_COUNT][2] = {
+    { 8192.0, 48.0 },
+    { 3.0, 2.0 },
+    { 0.0, 0.0 },
+};
+
+#define RLE_PHANTOM_SPHERE_COUNT 24
+#define RLE_PHANTOM_WALL 2
+
+// xorshift64*, seeded through splitmix64 so that small seeds are fine
+static inline uint64_t rle_phantom_seed(uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+static inline uint64_t rle_phantom_next(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in (0, 1]
+static inline double rle_phantom_unit(uint64_t *s) {
+    return (double)((rle_phantom_next(s) >> 11) + 1) / 9007199254740992.0;
+}
+
+// Geometric run length with the given mean (at least 1)
+static inline uint64_t rle_phantom_run(uint64_t *s, double mean) {
+    if (mean <= 1.0) return 1;
+    return 1 + (uint64_t)(log(rle_phantom_unit(s)) / log(1.0 - 1.0 / mean));
+}
+
+// Fills p[0..n) with air (1 = object) voxel values.
+static inline void rle_phantom_fill(uint8_t *p, size_t n, int object, uint8_t thr, uint64_t *s) {
+    unsigned span = object ? 255u - thr : thr + 1u;
+    unsigned base = object ? thr + 1u : 0u;
+    for (size_t i = 0; i < n; ++i) p[i] = (uint8_t)(base + (unsigned)(rle_phantom_next(s) >> 40) % span);
+}
+
+// Alternating air / object runs with geometric lengths.
+static inline void rle_phantom_runs(uint8_t *p, size_t n, const double *means, uint8_t thr, uint64_t *s) {
+    int object = 0;
+    for (size_t i = 0; i < n; object = !object) {
+        uint64_t len = rle_phantom_run(s, means[object]);
+        if (len > n - i) len = n - i;
+        rle_phantom_fill(p + i, (size_t)len, object, thr, s);
+        i += (size_t)len;
+    }
+}
+
+static inline void rle_phantom_spheres(uint8_t *p, uint32_t x, uint32_t y, uint32_t z, uint8_t thr,
+                                       uint64_t *s) {
+    rle_phantom_fill(p, (size_t)x * y * z, 0, thr, s);
+
+    double cx[RLE_PHANTOM_SPHERE_COUNT], cy[RLE_PHANTOM_SPHERE_COUNT];
+    double cz[RLE_PHANTOM_SPHERE_COUNT], r[RLE_PHANTOM_SPHERE_COUNT];
+    uint32_t min_edge = x < y ? (x < z ? x : z) : (y < z ? y : z);
+    for (int k = 0; k < RLE_PHANTOM_SPHERE_COUNT; ++k) {
+        r[k] = min_edge * (0.05 + 0.2 * rle_phantom_unit(s));
+        cx[k] = x * rle_phantom_unit(s);
+        cy[k] = y * rle_phantom_unit(s);
+        cz[k] = z * rle_phantom_unit(s);
+    }
+
+    for (uint32_t k = 0; k < z; ++k) {
+        for (uint32_t j = 0; j < y; ++j) {
+            uint8_t *row = p + ((size_t)k * y + j) * x;
+
+            // The box walls: whole rows at the y edges, a few voxels at the x edges
+            if (j < RLE_PHANTOM_WALL || j + RLE_PHANTOM_WALL >= y) {
+                rle_phantom_fill(row, x, 1, thr, s);
+                continue;
+            }
+            rle_phantom_fill(row, x < RLE_PHANTOM_WALL ? x : RLE_PHANTOM_WALL, 1, thr, s);
+            if (x > RLE_PHANTOM_WALL) rle_phantom_fill(row + x - RLE_PHANTOM_WALL, RLE_PHANTOM_WALL, 1, thr, s);
+
+            for (int b = 0; b < RLE_PHANTOM_SPHERE_COUNT; ++b) {
+                double dz = k + 0.5 - cz[b], dy = j + 0.5 - cy[b];
+                double h2 = r[b] * r[b] - dz * dz - dy * dy;
+                if (h2 <= 0.0) continue;
+                double h = sqrt(h2);
+                long lo = (long)ceil(cx[b] - h - 0.5), hi = (long)floor(cx[b] + h - 0.5);
+                if (lo < 0) lo = 0;
+                if (hi >= (long)x) hi = (long)x - 1;
+                if (lo <= hi) rle_phantom_fill(row + lo, (size_t)(hi - lo + 1), 1, thr, s);
+            }
+        }
+    }
+}
+
+// Generates phantom 'kind' of x * y * z voxels into 'out'.
+static inline void rle_phantom_generate(RlePhantomKind kind, uint32_t x, uint32_t y, uint32_t z,
+                                        uint8_t thr, uint64_t seed, uint8_t *out) {
+    uint64_t s = rle_phantom_seed(seed * RLE_PHANTOM_COUNT + (uint64_t)kind);
+    if (kind == RLE_PHANTOM_SPHERES) {
+        rle_phantom_spheres(out, x, y, z, thr, &s);
+    } else {
+        rle_phantom_runs(out, (size_t)x * y * z, rle_phantom_means[kind], thr, &s);
+    }
+}
+
+// "air" -> RLE_PHANTOM_AIR, -1 if unknown
+static inline int rle_phantom_parse(const char *name, size_t len) {
+    for (int k = 0; k < RLE_PHANTOM_COUNT; ++k) {
+        if (strlen(rle_phantom_names[k]) == len && strncmp(name, rle_phantom_names[k], len) == 0) return k;
+    }
+    return -1;
+}
+
+#endif
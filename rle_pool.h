@@ -0,0 +1,198 @@
+// Long-lived worker pool shared by the threaded engines.
+//
+// Threads are started once and then sleep until rle_pool_run() hands them a
+// job, so thread creation is not part of any timed region. A job runs on
+// workers 0..k-1 for any k up to the pool size, which lets one pool serve a
+// whole scaling sweep.
+//
+// Needs _GNU_SOURCE (defined before the first include) for the CPU affinity
+// calls.
+#ifndef RLE_POOL_H
+#define RLE_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle_prof.h"
+
+// Largest pool rle_pool_start() accepts
+#define RLE_POOL_MAX 256
+
+// NUMA nodes looked up in sysfs for pinning
+#define RLE_POOL_MAX_NODES 64
+
+typedef void (*rle_pool_job_fn)(int worker, void *arg);
+
+struct RlePool;
+
+typedef struct {
+    struct RlePool *pool;
+    int id;
+} RlePoolArg;
+
+typedef struct RlePool {
+    pthread_t tids[RLE_POOL_MAX];
+    RlePoolArg args[RLE_POOL_MAX];
+    int size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+
+    unsigned generation;    // bumped for every job
+    int active;             // workers with id < active take part in the job
+    int running;            // workers still busy with the current job
+    int shutdown;
+
+    rle_pool_job_fn job;
+    void *arg;
+
+    int pinned;             // 1 if the workers are pinned to their nodes
+    int num_cpus;           // CPUs the workers were spread over
+    int num_nodes;          // NUMA nodes those CPUs are on
+} RlePool;
+
+static inline void *rle_pool_worker(void *arg) {
+    RlePool *pool = ((RlePoolArg *)arg)->pool;
+    int id = ((RlePoolArg *)arg)->id;
+    unsigned seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            RLE_PROF_CLOSE();
+            return NULL;
+        }
+        seen = pool->generation;
+        int take_part = id < pool->active;
+        rle_pool_job_fn job = pool->job;
+        void *job_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!take_part) continue;
+
+        RLE_PROF_ENTER(id);
+        job(id, job_arg);
+        RLE_PROF_LEAVE(id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) pthread_cond_signal(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Reads the CPU list of NUMA node 'node' ("0-3,8-11") from sysfs into 'set'.
+// Returns 0 on success, 1 if the node does not exist.
+static inline int rle_pool_node_cpus(int node, cpu_set_t *set) {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) return 1;
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok) return 1;
+
+    CPU_ZERO(set);
+    for (char *p = list; *p >= '0' && *p <= '9';) {
+        long lo = strtol(p, &p, 10), hi = lo;
+        if (*p == '-') hi = strtol(p + 1, &p, 10);
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; ++c) CPU_SET((int)c, set);
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+// The CPUs this process may use, grouped by NUMA node: nodes[0..return)
+// hold the allowed CPUs of every node that has any. Without the sysfs node
+// directory all of them count as one node. Returns 0 if the affinity mask
+// cannot be read.
+static inline int rle_pool_nodes(cpu_set_t *nodes, int *num_cpus) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 0;
+    *num_cpus = CPU_COUNT(&allowed);
+
+    int count = 0;
+    for (int n = 0; n < RLE_POOL_MAX_NODES; ++n) {
+        cpu_set_t node;
+        if (rle_pool_node_cpus(n, &node) != 0) continue;
+        CPU_AND(&nodes[count], &node, &allowed);
+        if (CPU_COUNT(&nodes[count]) > 0) count++;
+    }
+    if (count == 0) {
+        nodes[0] = allowed;
+        count = 1;
+    }
+    return count;
+}
+
+// Starts 'size' workers. The pool must not move in memory until
+// rle_pool_stop(). With pin = 1, worker i may run on any CPU of node
+// i % num_nodes (only the CPUs this process may use), so consecutive workers
+// go to different nodes and every worker stays next to the memory it
+// first-touched while the scheduler still balances inside the node. Under
+// mpirun with per-socket binding that is the rank's own socket. Returns 0 on
+// success.
+static inline int rle_pool_start(RlePool *pool, int size, int pin) {
+    if (size < 1 || size > RLE_POOL_MAX) return 1;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->size = size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    cpu_set_t nodes[RLE_POOL_MAX_NODES];
+    int num_nodes = pin ? rle_pool_nodes(nodes, &pool->num_cpus) : 0;
+    pool->num_nodes = num_nodes;
+
+    for (int i = 0; i < size; ++i) {
+        pool->args[i].pool = pool;
+        pool->args[i].id = i;
+        if (pthread_create(&pool->tids[i], NULL, rle_pool_worker, &pool->args[i]) != 0) {
+            // Run with the workers we got
+            pool->size = i;
+            break;
+        }
+
+        if (num_nodes > 0 &&
+            pthread_setaffinity_np(pool->tids[i], sizeof(cpu_set_t), &nodes[i % num_nodes]) == 0) {
+            pool->pinned = 1;
+        }
+    }
+    return pool->size == size ? 0 : 1;
+}
+
+// Runs job(worker, arg) on workers 0..num_workers-1 and waits for all of them.
+static inline void rle_pool_run(RlePool *pool, int num_workers, rle_pool_job_fn job, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->arg = arg;
+    pool->active = num_workers;
+    pool->running = num_workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cv);
+    while (pool->running > 0) pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline void rle_pool_stop(RlePool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->size; ++i) pthread_join(pool->tids[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start_cv);
+    pthread_cond_destroy(&pool->done_cv);
+}
+
+#endif
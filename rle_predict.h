@@ -0,0 +1,171 @@
+// Predictive RLE: code every row as the XOR with the row above, or every
+// slice as the XOR with the slice before, instead of the plain 1D stream.
+//
+// Where neighbouring rows (slices) of the mask agree, the residual is 0, so
+// an edge that moves little from one row to the next leaves two short runs
+// of 1s in a long run of 0s. The residual is decodable in order, since the
+// reference has always been decoded already.
+//
+// Every voxel is thresholded exactly once. The masks of the last Y rows are
+// kept in a rolling window of one slice (X * Y bits, 128 KB for c8), which
+// holds both references: the row above, already replaced by this slice, and
+// the same row of the previous slice, not yet replaced. One pass therefore
+// feeds all three streams (plain, row XOR, slice XOR).
+//
+// The first row of every slice has no row above and slice 0 has no slice
+// before; both are XORed with 0, i.e. coded as they are. A scan that starts
+// in the middle of the volume (a chunk of slices) primes the window with the
+// slice before its first one, so its residuals are the same as in a scan of
+// the whole volume. The streams of consecutive chunks are stitched with
+// rle_summary_merge().
+#ifndef RLE_PREDICT_H
+#define RLE_PREDICT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle_simd.h"
+#include "rle_mask.h"
+#include "rle_summary.h"
+
+typedef enum { RLE_PREDICT_PLAIN, RLE_PREDICT_ROW, RLE_PREDICT_SLICE, RLE_PREDICT_MODES } RlePredictMode;
+
+static const char *const rle_predict_names[RLE_PREDICT_MODES] = { "plain", "row XOR", "slice XOR" };
+
+typedef struct {
+    uint32_t x, y;
+    size_t row_words;       // ceil(x / 64)
+    uint64_t *window;       // y rows of row_words mask words
+    uint8_t thr;
+
+    int have_slice;         // the window holds the previous slice
+    RleOpenRun run[RLE_PREDICT_MODES];
+    RleSummary sum[RLE_PREDICT_MODES];
+} RlePredict;
+
+// Words of the rolling window for rows of 'x' voxels and 'y' rows per slice.
+static inline size_t rle_predict_window_words(uint32_t x, uint32_t y) {
+    return ((size_t)x + 63) / 64 * y;
+}
+
+// Starts a scan. 'window' holds rle_predict_window_words() words and can be
+// reused from one scan to the next.
+static inline void rle_predict_begin(RlePredict *p, uint32_t x, uint32_t y, uint8_t thr, uint64_t *window) {
+    p->x = x;
+    p->y = y;
+    p->row_words = ((size_t)x + 63) / 64;
+    p->window = window;
+    p->thr = thr;
+    p->have_slice = 0;
+    for (int m = 0; m < RLE_PREDICT_MODES; ++m) {
+        p->run[m].val = 0;
+        p->run[m].len = 0;
+        rle_summary_init(&p->sum[m]);
+    }
+}
+
+static inline void rle_predict_add_run(void *ctx, size_t len) {
+    rle_summary_add_run((RleSummary *)ctx, len);
+}
+
+// Threshold mask of n <= 64 voxels, bit i for voxel i.
+static inline uint64_t rle_predict_mask(const uint8_t *v, unsigned n, uint8_t thr) {
+    if (n == 64) return rle_mask64(v, thr);
+    uint64_t m = 0;
+    for (unsigned i = 0; i < n; ++i) m |= (uint64_t)(v[i] > thr) << i;
+    return m;
+}
+
+// Feeds 'n' residual bits of 'm' into stream 'mode'.
+static inline void rle_predict_feed(RlePredict *p, int mode, uint64_t m, unsigned n) {
+    RleOpenRun *run = &p->run[mode];
+    RleSummary *sum = &p->sum[mode];
+    if (sum->empty) {
+        sum->empty = 0;
+        sum->first_val = (uint8_t)(m & 1);
+        run->val = sum->first_val;
+    }
+    if (n == 64) {
+        rle_scan_word(m, run, rle_predict_add_run, sum);
+    } else {
+        // The partial word at the end of a row whose length is not a multiple of 64
+        rle_scan_bits(m, n, run, rle_predict_add_run, sum);
+    }
+}
+
+// Fills the window with 'slice' (x * y voxels) without coding it: the
+// reference for a scan that starts at the slice after it.
+static inline void rle_predict_prime(RlePredict *p, const uint8_t *slice) {
+    for (uint32_t r = 0; r < p->y; ++r) {
+        const uint8_t *row = slice + (size_t)r * p->x;
+        uint64_t *w = p->window + r * p->row_words;
+        for (size_t k = 0; k < p->row_words; ++k) {
+            unsigned n = p->x - 64 * k < 64 ? (unsigned)(p->x - 64 * k) : 64;
+            w[k] = rle_predict_mask(row + 64 * k, n, p->thr);
+        }
+    }
+    p->have_slice = 1;
+}
+
+// Codes one slice (x * y voxels) into all three streams.
+static inline void rle_predict_slice(RlePredict *p, const uint8_t *slice) {
+    for (uint32_t r = 0; r < p->y; ++r) {
+        const uint8_t *row = slice + (size_t)r * p->x;
+        uint64_t *w = p->window + r * p->row_words;
+        const uint64_t *up = (r > 0) ? w - p->row_words : NULL;
+
+        for (size_t k = 0; k < p->row_words; ++k) {
+            unsigned n = p->x - 64 * k < 64 ? (unsigned)(p->x - 64 * k) : 64;
+            uint64_t m = rle_predict_mask(row + 64 * k, n, p->thr);
+
+            rle_predict_feed(p, RLE_PREDICT_PLAIN, m, n);
+            rle_predict_feed(p, RLE_PREDICT_ROW, up ? m ^ up[k] : m, n);
+            rle_predict_feed(p, RLE_PREDICT_SLICE, p->have_slice ? m ^ w[k] : m, n);
+            w[k] = m;
+        }
+    }
+    p->have_slice = 1;
+}
+
+// Closes the open runs. p->sum[] then summarises the three streams of the
+// slices scanned since rle_predict_begin().
+static inline void rle_predict_finish(RlePredict *p) {
+    for (int m = 0; m < RLE_PREDICT_MODES; ++m) {
+        RleSummary *sum = &p->sum[m];
+        if (sum->empty) continue;
+        rle_summary_add_run(sum, p->run[m].len);
+        sum->last_val = p->run[m].val;
+        sum->last_len = p->run[m].len;
+        sum->single_run = (sum->runs == 1);
+    }
+}
+
+// Bits per N of the three streams side by side, and each one's best N.
+static inline void rle_predict_print(const RleSummary *sums) {
+    printf("\n--- Predictive RLE (bits) ---\n");
+    printf("     %14s %14s %9s %14s %9s\n", rle_predict_names[0], rle_predict_names[1], "",
+           rle_predict_names[2], "");
+    for (int n = RLE_SUMMARY_MIN_N; n <= RLE_SUMMARY_MAX_N; ++n) {
+        int v = n - RLE_SUMMARY_MIN_N;
+        double plain = (double)sums[RLE_PREDICT_PLAIN].costs[v];
+        printf("N=%2d %14lu", n, sums[RLE_PREDICT_PLAIN].costs[v]);
+        for (int m = RLE_PREDICT_ROW; m <= RLE_PREDICT_SLICE; ++m) {
+            printf(" %14lu %+8.2f%%", sums[m].costs[v], 100.0 * ((double)sums[m].costs[v] - plain) / plain);
+        }
+        printf("\n");
+    }
+
+    for (int m = 0; m < RLE_PREDICT_MODES; ++m) {
+        int best = 0;
+        for (int v = 1; v < RLE_SUMMARY_VARIANTS; ++v) {
+            if (sums[m].costs[v] < sums[m].costs[best]) best = v;
+        }
+        printf("Best %-10s N=%2d: %12lu bits (%.2f MB), %lu runs\n", rle_predict_names[m],
+               best + RLE_SUMMARY_MIN_N, sums[m].costs[best],
+               (double)sums[m].costs[best] / 8.0 / 1024.0 / 1024.0, sums[m].runs);
+    }
+}
+
+#endif
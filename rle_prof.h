@@ -0,0 +1,303 @@
+// Optional phase timers and hardware counters, built with -DRLE_PROF.
+//
+// The wall time of a program is split into phases (load, warm-up, scan,
+// stitch/reduce, report). The main thread opens and closes a phase with
+// RLE_PROF_BEGIN() / RLE_PROF_END(). Pool workers charge the time they spend
+// inside a job to the phase that is open on the main thread (rle_pool.h
+// calls RLE_PROF_ENTER() / RLE_PROF_LEAVE() around every job). The
+// per-thread table then shows how evenly the work was spread: the
+// imbalance is the slowest thread's busy time over the mean.
+//
+// Where perf_event_open() is allowed (Linux, perf_event_paranoid <= 2 for
+// user-space counting), every thread also counts cycles, instructions,
+// branch misses and LLC misses for itself. Counters that cannot be opened
+// (no PMU in a VM, stricter paranoid setting) are reported as "-", and the
+// times are still there.
+//
+// Without RLE_PROF every macro is empty, so the instrumentation costs
+// nothing at all, not even a branch.
+//
+// Needs _GNU_SOURCE or _DEFAULT_SOURCE (defined before the first include)
+// for syscall().
+//
+// Every thread that was counted closes its counters with RLE_PROF_CLOSE()
+// before it exits: the pool workers when the pool stops, the main thread
+// after its report.
+//
+// Included after <mpi.h>, RLE_PROF_REPORT_MPI() gathers the main thread's
+// counters of every rank on the root and prints them per rank.
+#ifndef RLE_PROF_H
+#define RLE_PROF_H
+
+enum { RLE_PROF_LOAD, RLE_PROF_WARMUP, RLE_PROF_SCAN, RLE_PROF_STITCH, RLE_PROF_REPORT, RLE_PROF_PHASES };
+
+#ifdef RLE_PROF
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define RLE_PROF_COUNTERS 4
+#define RLE_PROF_MAX_THREADS 256
+
+// Slot of the main thread, after the workers
+#define RLE_PROF_MAIN RLE_PROF_MAX_THREADS
+
+static const char *const rle_prof_phase_names[RLE_PROF_PHASES] = {
+    "load", "warm-up", "scan", "stitch", "report",
+};
+
+static const char *const rle_prof_counter_names[RLE_PROF_COUNTERS] = {
+    "cycles", "instr", "br-miss", "LLC-miss",
+};
+
+typedef struct {
+    double time;                        // seconds inside the phase
+    uint64_t count[RLE_PROF_COUNTERS];
+    int used;
+} RleProfSlot;
+
+// Per thread: the counters it opened and where the current section started
+typedef struct {
+    int opened;
+    int fd[RLE_PROF_COUNTERS];          // -1 if unavailable
+    double t0;
+    uint64_t c0[RLE_PROF_COUNTERS];
+} RleProfThread;
+
+static RleProfSlot rle_prof_slots[RLE_PROF_PHASES][RLE_PROF_MAX_THREADS + 1];
+static double rle_prof_wall[RLE_PROF_PHASES];
+static double rle_prof_wall_start[RLE_PROF_PHASES];
+static volatile int rle_prof_phase = -1;
+static int rle_prof_have_counters = 0;
+static __thread RleProfThread rle_prof_self;
+
+static inline double rle_prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline int rle_prof_open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // This thread, on whatever CPU it runs
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline void rle_prof_open(RleProfThread *t) {
+    t->fd[0] = rle_prof_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    t->fd[1] = rle_prof_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    t->fd[2] = rle_prof_open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    t->fd[3] = rle_prof_open_counter(PERF_TYPE_HW_CACHE,
+                                     PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) {
+        if (t->fd[c] >= 0) rle_prof_have_counters = 1;
+    }
+    t->opened = 1;
+}
+
+// Closes the calling thread's counters. A later section opens them again.
+static inline void rle_prof_close(void) {
+    RleProfThread *t = &rle_prof_self;
+    if (!t->opened) return;
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) {
+        if (t->fd[c] >= 0) close(t->fd[c]);
+        t->fd[c] = -1;
+    }
+    t->opened = 0;
+}
+
+static inline void rle_prof_read(const RleProfThread *t, uint64_t *v) {
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) {
+        v[c] = 0;
+        if (t->fd[c] >= 0 && read(t->fd[c], &v[c], sizeof(v[c])) != (ssize_t)sizeof(v[c])) v[c] = 0;
+    }
+}
+
+// The calling thread starts a section for slot 'slot'.
+static inline void rle_prof_enter(int slot) {
+    RleProfThread *t = &rle_prof_self;
+    (void)slot;
+    if (!t->opened) rle_prof_open(t);
+    rle_prof_read(t, t->c0);
+    t->t0 = rle_prof_now();
+}
+
+// ... and ends it, charging it to the open phase.
+static inline void rle_prof_leave(int slot) {
+    RleProfThread *t = &rle_prof_self;
+    double t1 = rle_prof_now();
+    uint64_t c1[RLE_PROF_COUNTERS];
+    rle_prof_read(t, c1);
+
+    int phase = rle_prof_phase;
+    if (phase < 0 || slot < 0 || slot > RLE_PROF_MAIN) return;
+    RleProfSlot *s = &rle_prof_slots[phase][slot];
+    s->time += t1 - t->t0;
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) s->count[c] += c1[c] - t->c0[c];
+    s->used = 1;
+}
+
+static inline void rle_prof_begin(int phase) {
+    rle_prof_phase = phase;
+    rle_prof_wall_start[phase] = rle_prof_now();
+    rle_prof_enter(RLE_PROF_MAIN);
+}
+
+static inline void rle_prof_end(int phase) {
+    rle_prof_leave(RLE_PROF_MAIN);
+    rle_prof_wall[phase] += rle_prof_now() - rle_prof_wall_start[phase];
+    rle_prof_phase = -1;
+}
+
+// Forgets the per-thread numbers of 'phase' (the wall time stays).
+static inline void rle_prof_reset(int phase) {
+    memset(rle_prof_slots[phase], 0, sizeof(rle_prof_slots[phase]));
+}
+
+static inline void rle_prof_print_row(const char *label, const RleProfSlot *s) {
+    printf("%-8s %10.6f", label, s->time);
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) {
+        if (rle_prof_have_counters) printf(" %14lu", s->count[c]);
+        else printf(" %14s", "-");
+    }
+    if (rle_prof_have_counters && s->count[0]) printf(" %6.2f", (double)s->count[1] / (double)s->count[0]);
+    printf("\n");
+}
+
+static inline void rle_prof_print_header(const char *first) {
+    printf("%-8s %10s", first, "seconds");
+    for (int c = 0; c < RLE_PROF_COUNTERS; ++c) printf(" %14s", rle_prof_counter_names[c]);
+    printf(" %6s\n", "IPC");
+}
+
+// One row per worker that took part in 'phase', the main thread, and the
+// imbalance of the workers' busy times.
+static inline void rle_prof_report_threads(int phase) {
+    printf("\n--- Profile: %s per thread ---\n", rle_prof_phase_names[phase]);
+    rle_prof_print_header("thread");
+    double max = 0.0, sum = 0.0;
+    int workers = 0;
+    for (int w = 0; w < RLE_PROF_MAX_THREADS; ++w) {
+        const RleProfSlot *s = &rle_prof_slots[phase][w];
+        if (!s->used) continue;
+        char label[16];
+        snprintf(label, sizeof(label), "%d", w);
+        rle_prof_print_row(label, s);
+        if (s->time > max) max = s->time;
+        sum += s->time;
+        workers++;
+    }
+    rle_prof_print_row("main", &rle_prof_slots[phase][RLE_PROF_MAIN]);
+    if (workers > 0 && sum > 0.0) {
+        printf("Imbalance: slowest worker %.6f s, mean %.6f s, max/mean %.3f\n", max, sum / workers,
+               max * workers / sum);
+    }
+    if (!rle_prof_have_counters) printf("(perf_event_open not available, times only)\n");
+}
+
+// Wall time of every phase, and the main thread's counters in it.
+static inline void rle_prof_report_phases(void) {
+    printf("\n--- Profile: phases (main thread) ---\n");
+    rle_prof_print_header("phase");
+    double total = 0.0;
+    for (int p = 0; p < RLE_PROF_PHASES; ++p) {
+        RleProfSlot s = rle_prof_slots[p][RLE_PROF_MAIN];
+        s.time = rle_prof_wall[p];
+        rle_prof_print_row(rle_prof_phase_names[p], &s);
+        total += rle_prof_wall[p];
+    }
+    printf("%-8s %10.6f\n", "total", total);
+}
+
+#define RLE_PROF_BEGIN(phase) rle_prof_begin(phase)
+#define RLE_PROF_END(phase) rle_prof_end(phase)
+#define RLE_PROF_ENTER(slot) rle_prof_enter(slot)
+#define RLE_PROF_LEAVE(slot) rle_prof_leave(slot)
+#define RLE_PROF_RESET(phase) rle_prof_reset(phase)
+#define RLE_PROF_REPORT_THREADS(phase) rle_prof_report_threads(phase)
+#define RLE_PROF_REPORT_PHASES() rle_prof_report_phases()
+#define RLE_PROF_CLOSE() rle_prof_close()
+
+#if defined(MPI_VERSION)
+// Every rank sends its main-thread slots to 'root', which prints one table
+// per phase with a row per rank and the imbalance between ranks.
+static inline void rle_prof_report_mpi(MPI_Comm comm, int root) {
+    int rank, nprocs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nprocs);
+
+    // time and counters of every phase as doubles, plus the wall times
+    enum { PER = RLE_PROF_PHASES * (RLE_PROF_COUNTERS + 1) };
+    double mine[PER];
+    for (int p = 0; p < RLE_PROF_PHASES; ++p) {
+        mine[p * (RLE_PROF_COUNTERS + 1)] = rle_prof_wall[p];
+        for (int c = 0; c < RLE_PROF_COUNTERS; ++c) {
+            mine[p * (RLE_PROF_COUNTERS + 1) + 1 + c] = (double)rle_prof_slots[p][RLE_PROF_MAIN].count[c];
+        }
+    }
+    int have = rle_prof_have_counters, all_have = 0;
+    MPI_Reduce(&have, &all_have, 1, MPI_INT, MPI_MIN, root, comm);
+
+    double *all = (rank == root) ? (double *)malloc((size_t)nprocs * PER * sizeof(double)) : NULL;
+    MPI_Gather(mine, PER, MPI_DOUBLE, all, PER, MPI_DOUBLE, root, comm);
+    if (rank != root) return;
+
+    rle_prof_have_counters = all_have;
+    for (int p = 0; p < RLE_PROF_PHASES; ++p) {
+        double max = 0.0, sum = 0.0;
+        for (int r = 0; r < nprocs; ++r) {
+            double t = all[r * PER + p * (RLE_PROF_COUNTERS + 1)];
+            if (t > max) max = t;
+            sum += t;
+        }
+        if (sum == 0.0) continue;
+
+        printf("\n--- Profile: %s per rank ---\n", rle_prof_phase_names[p]);
+        rle_prof_print_header("rank");
+        for (int r = 0; r < nprocs; ++r) {
+            RleProfSlot s;
+            const double *v = &all[r * PER + p * (RLE_PROF_COUNTERS + 1)];
+            s.time = v[0];
+            for (int c = 0; c < RLE_PROF_COUNTERS; ++c) s.count[c] = (uint64_t)v[1 + c];
+            char label[16];
+            snprintf(label, sizeof(label), "%d", r);
+            rle_prof_print_row(label, &s);
+        }
+        printf("Imbalance: slowest rank %.6f s, mean %.6f s, max/mean %.3f\n", max, sum / nprocs,
+               max * nprocs / sum);
+    }
+    if (!all_have) printf("(perf_event_open not available on every rank, times only)\n");
+    free(all);
+}
+
+#define RLE_PROF_REPORT_MPI(comm, root) rle_prof_report_mpi(comm, root)
+#endif
+
+#else
+
+#define RLE_PROF_BEGIN(phase) ((void)0)
+#define RLE_PROF_END(phase) ((void)0)
+#define RLE_PROF_ENTER(slot) ((void)0)
+#define RLE_PROF_LEAVE(slot) ((void)0)
+#define RLE_PROF_RESET(phase) ((void)0)
+#define RLE_PROF_REPORT_THREADS(phase) ((void)0)
+#define RLE_PROF_REPORT_PHASES() ((void)0)
+#define RLE_PROF_CLOSE() ((void)0)
+#define RLE_PROF_REPORT_MPI(comm, root) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+// Operations on masks in run form, without expanding them to voxels.
+//
+// A mask of n voxels is stored as its run lengths, alternating between 0
+// and 1 runs from 'first_val' on: the runs the scan finds anyway
+// (rle_scan_range() reports them one by one), or the packets of an encoded
+// .rle stream with the split runs joined again. Every operation here walks
+// the runs once, so its cost grows with the number of runs, not with the
+// number of voxels; on c8 that is 26 M runs against 329 M voxels, and a few
+// thousand for a smooth segmentation.
+//
+//   rle_runs_count()       foreground voxels
+//   rle_runs_hist()        histogram of foreground (or background) run lengths
+//   rle_runs_combine()     AND / OR / XOR of two masks, by merging their runs
+//   rle_runs_slice_area()  foreground voxels of every Z-slice
+//   rle_runs_crop()        the runs of a box, in the box's own raster order
+//
+// rle_runs_expand() is the way back to one byte per voxel.
+#ifndef RLE_RUNS_H
+#define RLE_RUNS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle_simd.h"
+#include "rle_hist.h"
+#include "rle_decode.h"
+
+typedef struct {
+    uint64_t *len;          // run lengths, never 0
+    size_t count, cap;
+    uint8_t first_val;      // value of run 0, the others alternate
+    uint64_t num_voxels;    // sum of the lengths
+} RleRuns;
+
+typedef enum { RLE_RUNS_AND, RLE_RUNS_OR, RLE_RUNS_XOR } RleRunsOp;
+
+// Returns 0 on success. 'cap' is a first guess of the run count.
+static inline int rle_runs_init(RleRuns *r, size_t cap) {
+    r->cap = cap ? cap : 16;
+    r->len = (uint64_t *)malloc(r->cap * sizeof(uint64_t));
+    r->count = 0;
+    r->first_val = 0;
+    r->num_voxels = 0;
+    return r->len ? 0 : 1;
+}
+
+static inline void rle_runs_free(RleRuns *r) {
+    free(r->len);
+    r->len = NULL;
+    r->count = r->cap = 0;
+}
+
+// Value of run i
+static inline uint8_t rle_runs_val(const RleRuns *r, size_t i) {
+    return (uint8_t)(r->first_val ^ (i & 1));
+}
+
+// Appends 'len' voxels of 'val', joining them to the last run if it has the
+// same value. Returns 0 on success.
+static inline int rle_runs_push(RleRuns *r, uint8_t val, uint64_t len) {
+    if (len == 0) return 0;
+    r->num_voxels += len;
+    if (r->count == 0) {
+        r->first_val = val;
+    } else if (rle_runs_val(r, r->count - 1) == val) {
+        r->len[r->count - 1] += len;
+        return 0;
+    }
+    if (r->count == r->cap) {
+        uint64_t *grown = (uint64_t *)realloc(r->len, 2 * r->cap * sizeof(uint64_t));
+        if (!grown) return 1;
+        r->len = grown;
+        r->cap *= 2;
+    }
+    r->len[r->count++] = len;
+    return 0;
+}
+
+// Callback for the scan kernel: a run just closed. Runs alternate, so its
+// value follows from the ones before.
+static inline void rle_runs_emit(void *ctx, size_t len) {
+    RleRuns *r = (RleRuns *)ctx;
+    uint8_t val = r->count ? (uint8_t)(rle_runs_val(r, r->count - 1) ^ 1) : r->first_val;
+    rle_runs_push(r, val, len);
+}
+
+// Runs of (p[i] > thr) for i = 0..n-1, from the SIMD scan. 'r' is
+// initialised. Returns 0 on success.
+static inline int rle_runs_from_volume(RleRuns *r, const uint8_t *p, size_t n, uint8_t thr) {
+    r->count = 0;
+    r->num_voxels = 0;
+    if (n == 0) return 0;
+    r->first_val = (p[0] > thr) ? 1 : 0;
+    RleOpenRun run = { r->first_val, 0 };
+    rle_scan_range(p, n, thr, &run, rle_runs_emit, r);
+    rle_runs_emit(r, run.len);
+    return r->num_voxels == n ? 0 : 1;
+}
+
+// Runs of an encoded stream (rle_decode.h): one packet at a time, the
+// packets of a run longer than 2^N - 1 joined back. Returns 0 on success.
+static inline int rle_runs_from_stream(RleRuns *r, const RleStream *s) {
+    unsigned n = s->hdr.n_bits;
+    unsigned packet = n + 1;
+    r->count = 0;
+    r->num_voxels = 0;
+    for (uint64_t bitpos = 0; bitpos + packet <= s->hdr.total_bits; bitpos += packet) {
+        uint64_t p = rle_peek_bits(s->data, bitpos, packet);
+        if (rle_runs_push(r, (uint8_t)(p >> n), p & ((1ULL << n) - 1)) != 0) return 1;
+    }
+    return r->num_voxels == s->num_voxels ? 0 : 1;
+}
+
+// Back to one byte (0/1) per voxel, out[0..num_voxels).
+static inline void rle_runs_expand(const RleRuns *r, uint8_t *out) {
+    for (size_t i = 0; i < r->count; ++i) {
+        memset(out, rle_runs_val(r, i), (size_t)r->len[i]);
+        out += r->len[i];
+    }
+}
+
+static inline uint64_t rle_runs_count(const RleRuns *r) {
+    uint64_t sum = 0;
+    for (size_t i = r->first_val ? 0 : 1; i < r->count; i += 2) sum += r->len[i];
+    return sum;
+}
+
+// Adds the lengths of the runs of value 'val' to 'hist'.
+static inline void rle_runs_hist(const RleRuns *r, uint8_t val, RleHist *hist) {
+    for (size_t i = (r->first_val == val) ? 0 : 1; i < r->count; i += 2) rle_hist_add(hist, r->len[i], 1);
+}
+
+static inline uint8_t rle_runs_apply(RleRunsOp op, uint8_t a, uint8_t b) {
+    return op == RLE_RUNS_AND ? (a & b) : op == RLE_RUNS_OR ? (a | b) : (uint8_t)(a ^ b);
+}
+
+// out = a (op) b for two masks of the same size. Both run lists are walked
+// together, each step up to the nearer run end; 'out' (initialised) gets
+// at most a->count + b->count runs. Returns 0 on success.
+static inline int rle_runs_combine(const RleRuns *a, const RleRuns *b, RleRunsOp op, RleRuns *out) {
+    out->count = 0;
+    out->num_voxels = 0;
+    if (a->num_voxels != b->num_voxels) return 1;
+
+    size_t i = 0, j = 0;
+    uint64_t left_a = a->count ? a->len[0] : 0, left_b = b->count ? b->len[0] : 0;
+    while (i < a->count && j < b->count) {
+        uint64_t step = left_a < left_b ? left_a : left_b;
+        if (rle_runs_push(out, rle_runs_apply(op, rle_runs_val(a, i), rle_runs_val(b, j)), step) != 0) {
+            return 1;
+        }
+        left_a -= step;
+        left_b -= step;
+        if (left_a == 0 && ++i < a->count) left_a = a->len[i];
+        if (left_b == 0 && ++j < b->count) left_b = b->len[j];
+    }
+    return 0;
+}
+
+// areas[k] = foreground voxels of slice k, for slices of 'slice_voxels'.
+// A run spanning several slices is split at the slice edges, so the cost is
+// runs + slices.
+static inline void rle_runs_slice_area(const RleRuns *r, uint64_t slice_voxels, uint64_t *areas) {
+    uint64_t num_slices = slice_voxels ? (r->num_voxels + slice_voxels - 1) / slice_voxels : 0;
+    memset(areas, 0, (size_t)num_slices * sizeof(uint64_t));
+
+    uint64_t pos = 0;
+    for (size_t i = 0; i < r->count; pos += r->len[i], ++i) {
+        if (!rle_runs_val(r, i)) continue;
+        uint64_t start = pos, end = pos + r->len[i];
+        while (start < end) {
+            uint64_t k = start / slice_voxels;
+            uint64_t edge = (k + 1) * slice_voxels;
+            uint64_t stop = end < edge ? end : edge;
+            areas[k] += stop - start;
+            start = stop;
+        }
+    }
+}
+
+// Runs of the box [x0, x1) x [y0, y1) x [z0, z1) of a mask of x * y * z
+// voxels, in the box's raster order. The rows of the box are visited in
+// order with one cursor moving forward through the runs, so the cost is the
+// runs up to the end of the box plus the rows of the box. Returns 0 on
+// success, 1 on a bad box or no memory.
+static inline int rle_runs_crop(const RleRuns *r, uint32_t x, uint32_t y, uint32_t z, const uint32_t *lo,
+                                const uint32_t *hi, RleRuns *out) {
+    out->count = 0;
+    out->num_voxels = 0;
+    if (lo[0] >= hi[0] || lo[1] >= hi[1] || lo[2] >= hi[2] || hi[0] > x || hi[1] > y || hi[2] > z ||
+        r->num_voxels != (uint64_t)x * y * z) {
+        return 1;
+    }
+
+    size_t i = 0;
+    uint64_t run_start = 0;     // first voxel of run i
+    for (uint32_t k = lo[2]; k < hi[2]; ++k) {
+        for (uint32_t j = lo[1]; j < hi[1]; ++j) {
+            uint64_t start = ((uint64_t)k * y + j) * x + lo[0];
+            uint64_t end = start + (hi[0] - lo[0]);
+
+            // Skip the runs that end before the row segment
+            while (run_start + r->len[i] <= start) run_start += r->len[i++];
+
+            for (uint64_t pos = start; pos < end;) {
+                uint64_t run_end = run_start + r->len[i];
+                uint64_t stop = run_end < end ? run_end : end;
+                if (rle_runs_push(out, rle_runs_val(r, i), stop - pos) != 0) return 1;
+                pos = stop;
+                if (pos == run_end) run_start += r->len[i++];
+            }
+        }
+    }
+    return 0;
+}
+
+// 1 if the two masks are the same
+static inline int rle_runs_equal(const RleRuns *a, const RleRuns *b) {
+    return a->count == b->count && a->num_voxels == b->num_voxels &&
+           (a->count == 0 || a->first_val == b->first_val) &&
+           memcmp(a->len, b->len, a->count * sizeof(uint64_t)) == 0;
+}
+
+#endif
@@ -0,0 +1,165 @@
+// Associative segment summary for stitching runs across seams.
+//
+// A scan of one contiguous segment (a chunk, a rank's slab) is described by
+// its cost for every N, its run count, and the two runs touching its ends.
+// Two neighbouring summaries merge into the summary of the joined segment:
+// if the touching runs have the same value they are really one run, so their
+// separate costs are replaced by the cost of the merged run.
+//
+// A segment that is a single run (an air slice) has its first run equal to its
+// last run, and a run merged into it keeps growing through to the next seam.
+// The 'single_run' flag carries that, which is what makes the merge correct
+// for any grouping: the merge is associative, so summaries can be folded left
+// to right or reduced in a tree (MPI_Reduce with a non-commutative MPI_Op).
+// It is not commutative, the left segment always comes first.
+//
+// Included after <mpi.h>, this also provides the matching MPI datatype and
+// reduction operator.
+#ifndef RLE_SUMMARY_H
+#define RLE_SUMMARY_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Same N range as the programs (N=2..17)
+#define RLE_SUMMARY_MIN_N 2
+#define RLE_SUMMARY_MAX_N 17
+#define RLE_SUMMARY_VARIANTS (RLE_SUMMARY_MAX_N - RLE_SUMMARY_MIN_N + 1)
+
+typedef struct {
+    uint64_t costs[RLE_SUMMARY_VARIANTS];  // bits for N = 2..17
+    uint64_t runs;          // runs in the segment, seams not yet merged away
+    uint64_t first_len;
+    uint64_t last_len;
+    uint8_t first_val;
+    uint8_t last_val;
+    uint8_t single_run;     // 1 if the whole segment is one run
+    uint8_t empty;          // 1 if the segment has no voxels
+} RleSummary;
+
+// Bits needed for a run of 'len' voxels: ceil(len / (2^N - 1)) packets of
+// N + 1 bits, the same model as calc_bits_for_run().
+static inline uint64_t rle_summary_run_bits(uint64_t len, int n_bits) {
+    uint64_t max_cap = (1ULL << n_bits) - 1;
+    return (len + max_cap - 1) / max_cap * (uint64_t)(n_bits + 1);
+}
+
+// Charges one closed run to the summary (first_val, last_* and single_run
+// are the scanner's job).
+static inline void rle_summary_add_run(RleSummary *s, uint64_t len) {
+    if (s->runs == 0) s->first_len = len;
+    for (int n = RLE_SUMMARY_MIN_N; n <= RLE_SUMMARY_MAX_N; ++n) {
+        s->costs[n - RLE_SUMMARY_MIN_N] += rle_summary_run_bits(len, n);
+    }
+    s->runs++;
+}
+
+// An empty summary, the identity of rle_summary_merge().
+static inline void rle_summary_init(RleSummary *s) {
+    memset(s, 0, sizeof(*s));
+    s->empty = 1;
+}
+
+// Summary of p[0..n) at threshold 'thr' from the original per-voxel loop,
+// one compare per voxel and no SIMD. This is the reference the vectorized
+// scans are checked against.
+static inline RleSummary rle_summary_scan_scalar(const uint8_t *p, size_t n, uint8_t thr) {
+    RleSummary s;
+    rle_summary_init(&s);
+    if (n == 0) return s;
+    s.empty = 0;
+
+    uint8_t val = (p[0] > thr) ? 1 : 0;
+    size_t len = 1;
+    s.first_val = val;
+    for (size_t i = 1; i < n; ++i) {
+        uint8_t next = (p[i] > thr) ? 1 : 0;
+        if (next == val) {
+            len++;
+        } else {
+            rle_summary_add_run(&s, len);
+            val = next;
+            len = 1;
+        }
+    }
+    rle_summary_add_run(&s, len);
+
+    s.last_val = val;
+    s.last_len = len;
+    s.single_run = (s.runs == 1);
+    return s;
+}
+
+// Summary of segment 'a' directly followed by segment 'b'.
+static inline RleSummary rle_summary_merge(const RleSummary *a, const RleSummary *b) {
+    if (a->empty) return *b;
+    if (b->empty) return *a;
+
+    RleSummary r;
+    for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) r.costs[i] = a->costs[i] + b->costs[i];
+    r.runs = a->runs + b->runs;
+    r.first_val = a->first_val;
+    r.last_val = b->last_val;
+    r.empty = 0;
+
+    if (a->last_val != b->first_val) {
+        r.first_len = a->first_len;
+        r.last_len = b->last_len;
+        r.single_run = 0;
+        return r;
+    }
+
+    // The run continues across the seam: remove the two split runs, add the
+    // merged one
+    uint64_t merged = a->last_len + b->first_len;
+    for (int n = RLE_SUMMARY_MIN_N; n <= RLE_SUMMARY_MAX_N; ++n) {
+        r.costs[n - RLE_SUMMARY_MIN_N] += rle_summary_run_bits(merged, n) -
+                                          rle_summary_run_bits(a->last_len, n) -
+                                          rle_summary_run_bits(b->first_len, n);
+    }
+    r.runs--;
+
+    // If a side is a single run, the merged run is also the edge run there
+    r.first_len = a->single_run ? merged : a->first_len;
+    r.last_len = b->single_run ? merged : b->last_len;
+    r.single_run = a->single_run && b->single_run;
+    return r;
+}
+
+#if defined(MPI_VERSION)
+#include <stddef.h>
+
+// MPI_Op callback: inout = in (+) inout, where 'in' holds the lower ranks,
+// i.e. the segment on the left.
+static inline void rle_summary_mpi_merge(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    RleSummary *left = (RleSummary *)in;
+    RleSummary *right = (RleSummary *)inout;
+    for (int i = 0; i < *len; ++i) right[i] = rle_summary_merge(&left[i], &right[i]);
+}
+
+// RleSummary as one derived datatype: the uint64 fields, then the 4 bytes.
+// Free with MPI_Type_free().
+static inline MPI_Datatype rle_summary_mpi_type(void) {
+    int lengths[2] = { RLE_SUMMARY_VARIANTS + 3, 4 };
+    MPI_Aint displs[2] = { offsetof(RleSummary, costs), offsetof(RleSummary, first_val) };
+    MPI_Datatype types[2] = { MPI_UINT64_T, MPI_UINT8_T };
+
+    MPI_Datatype tmp, type;
+    MPI_Type_create_struct(2, lengths, displs, types, &tmp);
+    MPI_Type_create_resized(tmp, 0, sizeof(RleSummary), &type);
+    MPI_Type_free(&tmp);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+// The stitching reduction. Not commutative, so MPI keeps the rank order.
+// Free with MPI_Op_free().
+static inline MPI_Op rle_summary_mpi_op(void) {
+    MPI_Op op;
+    MPI_Op_create(rle_summary_mpi_merge, 0, &op);
+    return op;
+}
+#endif
+
+#endif
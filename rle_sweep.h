@@ -0,0 +1,166 @@
+// Multi-threshold sweep: the cost tables for many thresholds in one pass.
+//
+// Picking a segmentation level used to mean one rebuild and one full scan of
+// the volume per THRESHOLD. Here every 64-voxel block is loaded once and
+// compared against all thresholds while it is still in registers; each
+// threshold then walks its own mask with rle_scan_word() and keeps its own
+// open run and RleSummary. Memory is read once per sweep, not once per
+// threshold.
+//
+// The result for every threshold is an RleSummary, so segments scanned by
+// different threads or ranks stitch per threshold with rle_summary_merge()
+// (or one MPI_Reduce over the whole array).
+#ifndef RLE_SWEEP_H
+#define RLE_SWEEP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rle_simd.h"
+#include "rle_summary.h"
+
+// Most thresholds one sweep takes
+#define RLE_SWEEP_MAX 32
+
+typedef struct {
+    int count;
+    int started;        // 1 once the first voxel has been seen
+    uint8_t thr[RLE_SWEEP_MAX];
+    RleOpenRun run[RLE_SWEEP_MAX];
+    RleSummary sum[RLE_SWEEP_MAX];
+} RleSweep;
+
+// Bit i of masks[t] is set if p[i] > thr[t], for i = 0..63. The 64 voxels
+// are loaded once for all thresholds.
+static inline void rle_mask64_multi(const uint8_t *p, const uint8_t *thr, int count,
+                                    uint64_t *masks) {
+#if defined(__AVX512BW__)
+    __m512i v = _mm512_loadu_si512((const void *)p);
+    for (int t = 0; t < count; ++t) {
+        masks[t] = (uint64_t)_mm512_cmpgt_epu8_mask(v, _mm512_set1_epi8((char)thr[t]));
+    }
+#elif defined(__AVX2__)
+    // Same sign-flip trick as rle_mask64()
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)p), bias);
+    __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + 32)), bias);
+    for (int t = 0; t < count; ++t) {
+        __m256i c = _mm256_set1_epi8((char)(thr[t] ^ 0x80));
+        uint32_t mlo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(lo, c));
+        uint32_t mhi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(hi, c));
+        masks[t] = ((uint64_t)mhi << 32) | mlo;
+    }
+#elif defined(__SSE2__)
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i v[4];
+    for (int k = 0; k < 4; ++k) v[k] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 16 * k)), bias);
+    for (int t = 0; t < count; ++t) {
+        __m128i c = _mm_set1_epi8((char)(thr[t] ^ 0x80));
+        uint64_t m = 0;
+        for (int k = 0; k < 4; ++k) {
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v[k], c)) << (16 * k);
+        }
+        masks[t] = m;
+    }
+#else
+    for (int t = 0; t < count; ++t) masks[t] = rle_mask64(p, thr[t]);
+#endif
+}
+
+// A run closed for one threshold ('ctx' is its RleSummary).
+static inline void rle_sweep_add_run(void *ctx, size_t len) {
+    rle_summary_add_run((RleSummary *)ctx, len);
+}
+
+static inline void rle_sweep_begin(RleSweep *sw, const uint8_t *thr, int count) {
+    sw->count = count;
+    sw->started = 0;
+    for (int t = 0; t < count; ++t) {
+        sw->thr[t] = thr[t];
+        sw->run[t].val = 0;
+        sw->run[t].len = 0;
+        rle_summary_init(&sw->sum[t]);
+    }
+}
+
+// Scans the next n voxels of the segment. The first call seeds every open
+// run from p[0], later calls continue where the previous one stopped.
+static inline void rle_sweep_feed(RleSweep *sw, const uint8_t *p, size_t n) {
+    if (n == 0) return;
+
+    if (!sw->started) {
+        sw->started = 1;
+        for (int t = 0; t < sw->count; ++t) {
+            sw->run[t].val = (p[0] > sw->thr[t]) ? 1 : 0;
+            sw->sum[t].first_val = sw->run[t].val;
+            sw->sum[t].empty = 0;
+        }
+    }
+
+    uint64_t masks[RLE_SWEEP_MAX];
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        rle_mask64_multi(p + i, sw->thr, sw->count, masks);
+        for (int t = 0; t < sw->count; ++t) {
+            rle_scan_word(masks[t], &sw->run[t], rle_sweep_add_run, &sw->sum[t]);
+        }
+    }
+
+    // Leftover voxels, one threshold at a time
+    for (int t = 0; t < sw->count && i < n; ++t) {
+        rle_scan_range(p + i, n - i, sw->thr[t], &sw->run[t], rle_sweep_add_run, &sw->sum[t]);
+    }
+}
+
+// Closes the open runs. sw->sum[t] is then the summary of the whole segment
+// for threshold t.
+static inline void rle_sweep_finish(RleSweep *sw) {
+    for (int t = 0; t < sw->count; ++t) {
+        RleSummary *s = &sw->sum[t];
+        if (s->empty) continue;
+        rle_sweep_add_run(s, sw->run[t].len);
+        s->last_val = sw->run[t].val;
+        s->last_len = sw->run[t].len;
+        s->single_run = (s->runs == 1);
+    }
+}
+
+// Parses a list like "8,16,25" into 'thr' (each 0..254, at most
+// RLE_SWEEP_MAX). Returns the number of thresholds, 0 on error.
+static inline int rle_sweep_parse(const char *text, uint8_t *thr) {
+    int count = 0;
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 0 || v > 254 || count == RLE_SWEEP_MAX) return 0;
+        thr[count++] = (uint8_t)v;
+        if (*end == ',') end++;
+        else if (*end) return 0;
+        p = end;
+    }
+    return count;
+}
+
+// One row per threshold: the cheapest N and the size in MB for every N.
+static inline void rle_sweep_print(const uint8_t *thr, int count, const RleSummary *sums) {
+    printf("\n--- Threshold Sweep (MB per N) ---\n");
+    printf("thr best ");
+    for (int n = RLE_SUMMARY_MIN_N; n <= RLE_SUMMARY_MAX_N; ++n) printf(" %6s%-2d", "N=", n);
+    printf("\n");
+
+    for (int t = 0; t < count; ++t) {
+        int best = 0;
+        for (int i = 1; i < RLE_SUMMARY_VARIANTS; ++i) {
+            if (sums[t].costs[i] < sums[t].costs[best]) best = i;
+        }
+        printf("%3d N=%-2d", thr[t], best + RLE_SUMMARY_MIN_N);
+        for (int i = 0; i < RLE_SUMMARY_VARIANTS; ++i) {
+            printf(" %8.2f", (double)sums[t].costs[i] / 8.0 / 1024.0 / 1024.0);
+        }
+        printf("\n");
+    }
+}
+
+#endif
@@ -0,0 +1,444 @@
+// Volume descriptors: dimensions, voxel type and data file read at run time.
+//
+// rle_volume_open() takes either
+//  - a MetaImage header (.mhd, or .mha with the voxels after the header),
+//  - a NRRD header (.nrrd with attached data, or a detached .nhdr),
+//  - or any other file, taken as the raw 8-bit 1024x1024x314 c8 dataset.
+//
+// Supported voxel types are u8, i16 and u16, uncompressed, in either byte
+// order. Every engine scans 8-bit data, so 16-bit volumes go through a typed
+// window kernel while they are read: a voxel becomes 1 if it lies inside
+// [window_lo, window_hi] (e.g. -500..300 HU) and 0 otherwise, and the scans
+// then run on that 0/1 volume with threshold 0. 8-bit volumes are read as
+// they are and keep the threshold (rle_mask64() is their kernel).
+//
+// Both come from RleVolumeParams, which the programs fill from --threshold T
+// and --window LO,HI (rle_volume_parse_arg()). Without them the threshold is
+// the program's default and the window RLE_WINDOW_LO..RLE_WINDOW_HI, which
+// can be changed at compile time:
+//
+//   gcc -O3 -march=native -DRLE_WINDOW_LO=-200 -DRLE_WINDOW_HI=1000 ...
+//
+// The limits are loop invariants, so each kernel still compiles to one
+// vectorised compare loop for its type; the type is dispatched once per block
+// (rle_volume_convert()), never per voxel. The window is in stored units, so
+// for u16 data that keeps HU + 1024 the limits have to include the 1024.
+//
+// Needs _POSIX_C_SOURCE >= 200809L for pread().
+#ifndef RLE_VOLUME_H
+#define RLE_VOLUME_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rle_encode.h"
+
+#ifndef RLE_WINDOW_LO
+#define RLE_WINDOW_LO (-500)
+#endif
+#ifndef RLE_WINDOW_HI
+#define RLE_WINDOW_HI 300
+#endif
+
+// Dimensions of a file without a header (c8.raw)
+#define RLE_VOLUME_RAW_X 1024
+#define RLE_VOLUME_RAW_Y 1024
+#define RLE_VOLUME_RAW_Z 314
+
+// 16-bit voxels are read and windowed this many at a time
+#define RLE_VOLUME_BLOCK ((size_t)1 << 22)
+
+#define RLE_VOLUME_PATH 4096
+
+typedef enum { RLE_VOXEL_U8, RLE_VOXEL_I16, RLE_VOXEL_U16 } RleVoxelType;
+
+typedef struct {
+    char path[RLE_VOLUME_PATH];  // file holding the voxels
+    uint32_t x, y, z;
+    RleVoxelType type;
+    uint8_t big_endian;
+    uint64_t offset;             // bytes before the first voxel
+    uint8_t threshold;           // threshold of the 8-bit scans
+    int32_t window_lo, window_hi; // 16-bit voxels inside become 1
+} RleVolumeDesc;
+
+// What the scans look for, as given on the command line
+typedef struct {
+    uint8_t threshold;           // 8-bit volumes: voxels above it are 1
+    int32_t window_lo, window_hi; // 16-bit volumes: voxels inside are 1
+} RleVolumeParams;
+
+static inline void rle_volume_params_init(RleVolumeParams *p, uint8_t threshold) {
+    p->threshold = threshold;
+    p->window_lo = RLE_WINDOW_LO;
+    p->window_hi = RLE_WINDOW_HI;
+}
+
+// Parses a whole decimal number in [lo, hi] up to 'end' (or the end of the
+// string if 'end' is NULL). Returns 0 on success.
+static inline int rle_volume_parse_long(const char *s, long lo, long hi, char **end, long *out) {
+    char *e;
+    *out = strtol(s, &e, 10);
+    if (e == s || *out < lo || *out > hi) return 1;
+    if (end) {
+        *end = e;
+        return 0;
+    }
+    return *e != '\0';
+}
+
+// Takes '--threshold T' (0..255) or '--window LO,HI' (stored 16-bit units)
+// at argv[*i] and moves *i to its value. Returns 1 if it did, 0 if argv[*i]
+// is some other option and -1 if the value is missing or bad.
+static inline int rle_volume_parse_arg(int argc, char **argv, int *i, RleVolumeParams *p) {
+    int is_thr = strcmp(argv[*i], "--threshold") == 0;
+    int is_win = strcmp(argv[*i], "--window") == 0;
+    if (!is_thr && !is_win) return 0;
+    if (*i + 1 >= argc) return -1;
+
+    const char *arg = argv[*i + 1];
+    long lo, hi;
+    if (is_thr) {
+        if (rle_volume_parse_long(arg, 0, 255, NULL, &lo) != 0) return -1;
+        p->threshold = (uint8_t)lo;
+    } else {
+        char *comma;
+        if (rle_volume_parse_long(arg, -32768, 65535, &comma, &lo) != 0 || *comma != ',' ||
+            rle_volume_parse_long(comma + 1, lo, 65535, NULL, &hi) != 0) {
+            return -1;
+        }
+        p->window_lo = (int32_t)lo;
+        p->window_hi = (int32_t)hi;
+    }
+    (*i)++;
+    return 1;
+}
+
+static inline size_t rle_volume_voxel_bytes(const RleVolumeDesc *d) {
+    return d->type == RLE_VOXEL_U8 ? 1 : 2;
+}
+
+static inline uint64_t rle_volume_voxels(const RleVolumeDesc *d) {
+    return (uint64_t)d->x * d->y * d->z;
+}
+
+// 1 if the voxels are windowed to 0/1 on load
+static inline int rle_volume_windowed(const RleVolumeDesc *d) {
+    return d->type != RLE_VOXEL_U8;
+}
+
+static inline const char *rle_volume_type_name(RleVoxelType type) {
+    return type == RLE_VOXEL_U8 ? "u8" : type == RLE_VOXEL_I16 ? "i16" : "u16";
+}
+
+// The typed window kernels, one per 16-bit type
+#define RLE_WINDOW_KERNEL(name, type)                                              \
+    static inline void name(const type *src, size_t n, int32_t lo, int32_t hi,      \
+                            uint8_t *restrict dst) {                                \
+        for (size_t i = 0; i < n; ++i) {                                            \
+            int32_t v = src[i];                                                     \
+            dst[i] = (uint8_t)((v >= lo) & (v <= hi));                              \
+        }                                                                           \
+    }
+
+RLE_WINDOW_KERNEL(rle_window_i16, int16_t)
+RLE_WINDOW_KERNEL(rle_window_u16, uint16_t)
+
+// Turns 'n' voxels as stored in the file ('raw', swapped in place if the byte
+// order differs from ours) into the bytes the scans take. 'out' must not
+// overlap 'raw' for 16-bit types.
+static inline void rle_volume_convert(const RleVolumeDesc *d, void *raw, size_t n, uint8_t *out) {
+    if (d->type == RLE_VOXEL_U8) {
+        if (out != raw) memcpy(out, raw, n);
+        return;
+    }
+
+    int host_big = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+    if (d->big_endian != host_big) {
+        uint16_t *w = (uint16_t *)raw;
+        for (size_t i = 0; i < n; ++i) w[i] = __builtin_bswap16(w[i]);
+    }
+    if (d->type == RLE_VOXEL_I16) {
+        rle_window_i16((const int16_t *)raw, n, d->window_lo, d->window_hi, out);
+    } else {
+        rle_window_u16((const uint16_t *)raw, n, d->window_lo, d->window_hi, out);
+    }
+}
+
+static inline int rle_volume_pread_all(int fd, void *buf, size_t len, uint64_t pos) {
+    uint8_t *p = (uint8_t *)buf;
+    while (len > 0) {
+        ssize_t got = pread(fd, p, len, (off_t)pos);
+        if (got <= 0) return 1;
+        p += got;
+        pos += (uint64_t)got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+// Reads voxels [first, first + count) from 'fd' (open on d->path) into 'out'
+// as scan bytes. Safe to call from several threads at once. Returns 0 on
+// success.
+static inline int rle_volume_pread(int fd, const RleVolumeDesc *d, uint64_t first, size_t count,
+                                   uint8_t *out) {
+    size_t vb = rle_volume_voxel_bytes(d);
+    if (vb == 1) return rle_volume_pread_all(fd, out, count, d->offset + first);
+
+    size_t block = count < RLE_VOLUME_BLOCK ? count : RLE_VOLUME_BLOCK;
+    void *raw = malloc(block * vb + 1);
+    if (!raw) return 1;
+
+    int err = 0;
+    for (size_t done = 0; done < count && !err; done += block) {
+        size_t n = count - done < block ? count - done : block;
+        err = rle_volume_pread_all(fd, raw, n * vb, d->offset + (first + done) * vb);
+        if (!err) rle_volume_convert(d, raw, n, out + done);
+    }
+    free(raw);
+    return err;
+}
+
+// Trims leading and trailing white space in place.
+static inline char *rle_volume_trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+// d->path = 'name' relative to the directory of 'header'
+static inline const char *rle_volume_set_path(RleVolumeDesc *d, const char *header, const char *name) {
+    const char *slash = strrchr(header, '/');
+    int dir = (name[0] != '/' && slash) ? (int)(slash - header + 1) : 0;
+    if ((size_t)snprintf(d->path, sizeof(d->path), "%.*s%s", dir, header, name) >= sizeof(d->path)) {
+        return "data file path too long";
+    }
+    return NULL;
+}
+
+static inline int rle_volume_dims(const char *s, RleVolumeDesc *d) {
+    unsigned long v[3];
+    char *end;
+    for (int i = 0; i < 3; ++i) {
+        v[i] = strtoul(s, &end, 10);
+        if (end == s || v[i] == 0 || v[i] > UINT32_MAX) return 1;
+        s = end;
+    }
+    if (*rle_volume_trim(end)) return 1;
+    d->x = (uint32_t)v[0];
+    d->y = (uint32_t)v[1];
+    d->z = (uint32_t)v[2];
+    return 0;
+}
+
+// MetaImage header. ElementDataFile has to be the last field; LOCAL means the
+// voxels follow it (and HeaderSize is ignored). Sets *skip to -1 for
+// "HeaderSize = -1" (the voxels are the last bytes of the file).
+static inline const char *rle_volume_parse_mhd(FILE *f, const char *header, RleVolumeDesc *d,
+                                               int64_t *skip) {
+    char line[RLE_VOLUME_PATH + 64];
+    int ndims = 0, have_type = 0, have_file = 0;
+
+    while (!have_file && fgets(line, sizeof(line), f)) {
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        char *key = rle_volume_trim(line);
+        char *val = rle_volume_trim(eq + 1);
+
+        if (strcmp(key, "NDims") == 0) {
+            ndims = atoi(val);
+        } else if (strcmp(key, "DimSize") == 0) {
+            if (rle_volume_dims(val, d) != 0) return "DimSize must be three positive sizes";
+        } else if (strcmp(key, "ElementType") == 0) {
+            if (strcmp(val, "MET_UCHAR") == 0) d->type = RLE_VOXEL_U8;
+            else if (strcmp(val, "MET_SHORT") == 0) d->type = RLE_VOXEL_I16;
+            else if (strcmp(val, "MET_USHORT") == 0) d->type = RLE_VOXEL_U16;
+            else return "ElementType must be MET_UCHAR, MET_SHORT or MET_USHORT";
+            have_type = 1;
+        } else if (strcmp(key, "ElementNumberOfChannels") == 0) {
+            if (atoi(val) != 1) return "only single-channel volumes are supported";
+        } else if (strcmp(key, "BinaryDataByteOrderMSB") == 0 || strcmp(key, "ElementByteOrderMSB") == 0) {
+            d->big_endian = strcasecmp(val, "True") == 0;
+        } else if (strcmp(key, "CompressedData") == 0) {
+            if (strcasecmp(val, "True") == 0) return "compressed MetaImage data is not supported";
+        } else if (strcmp(key, "HeaderSize") == 0) {
+            *skip = strtoll(val, NULL, 10);
+            if (*skip < -1) return "HeaderSize must be -1 or more";
+        } else if (strcmp(key, "ElementDataFile") == 0) {
+            if (strcmp(val, "LOCAL") == 0) {
+                if (strlen(header) >= sizeof(d->path)) return "path too long";
+                snprintf(d->path, sizeof(d->path), "%s", header);
+                d->offset = (uint64_t)ftell(f);
+                *skip = 0;
+            } else if (strcmp(val, "LIST") == 0 || strchr(val, '%') || strchr(val, ' ')) {
+                return "ElementDataFile must name a single file";
+            } else {
+                const char *err = rle_volume_set_path(d, header, val);
+                if (err) return err;
+            }
+            have_file = 1;
+        }
+    }
+    if (ndims != 3) return "NDims must be 3";
+    if (!d->x) return "DimSize missing";
+    if (!have_type) return "ElementType missing";
+    if (!have_file) return "ElementDataFile missing";
+    return NULL;
+}
+
+// NRRD header. Without a "data file" field the voxels follow the blank line
+// ending the header. Sets *skip to -1 for "byte skip: -1".
+static inline const char *rle_volume_parse_nrrd(FILE *f, const char *header, RleVolumeDesc *d,
+                                                int64_t *skip) {
+    char line[RLE_VOLUME_PATH + 64];
+    int dimension = 0, have_type = 0, have_file = 0, have_endian = 0;
+
+    if (!fgets(line, sizeof(line), f) || strncmp(line, "NRRD000", 7) != 0) return "not a NRRD file";
+
+    while (fgets(line, sizeof(line), f)) {
+        char *key = rle_volume_trim(line);
+        if (*key == '\0') break;     // end of the header
+        if (*key == '#') continue;
+        char *colon = strstr(key, ": ");
+        if (!colon) continue;        // key:=value pairs are not fields
+        *colon = '\0';
+        char *val = rle_volume_trim(colon + 2);
+
+        if (strcmp(key, "dimension") == 0) {
+            dimension = atoi(val);
+        } else if (strcmp(key, "sizes") == 0) {
+            if (rle_volume_dims(val, d) != 0) return "sizes must be three positive sizes";
+        } else if (strcmp(key, "type") == 0) {
+            if (!strcmp(val, "uchar") || !strcmp(val, "unsigned char") || !strcmp(val, "uint8") ||
+                !strcmp(val, "uint8_t")) {
+                d->type = RLE_VOXEL_U8;
+            } else if (!strcmp(val, "short") || !strcmp(val, "short int") || !strcmp(val, "signed short") ||
+                       !strcmp(val, "signed short int") || !strcmp(val, "int16") || !strcmp(val, "int16_t")) {
+                d->type = RLE_VOXEL_I16;
+            } else if (!strcmp(val, "ushort") || !strcmp(val, "unsigned short") ||
+                       !strcmp(val, "unsigned short int") || !strcmp(val, "uint16") || !strcmp(val, "uint16_t")) {
+                d->type = RLE_VOXEL_U16;
+            } else {
+                return "type must be an 8-bit unsigned or a 16-bit integer type";
+            }
+            have_type = 1;
+        } else if (strcmp(key, "endian") == 0) {
+            d->big_endian = strcmp(val, "big") == 0;
+            have_endian = 1;
+        } else if (strcmp(key, "encoding") == 0) {
+            if (strcmp(val, "raw") != 0) return "only raw NRRD encoding is supported";
+        } else if (strcmp(key, "byte skip") == 0) {
+            *skip = strtoll(val, NULL, 10);
+            if (*skip < -1) return "byte skip must be -1 or more";
+        } else if (strcmp(key, "line skip") == 0 || strcmp(key, "lineskip") == 0) {
+            if (atoi(val) != 0) return "line skip is not supported";
+        } else if (strcmp(key, "data file") == 0 || strcmp(key, "datafile") == 0) {
+            if (strncmp(val, "LIST", 4) == 0 || strchr(val, ' ')) return "data file must name a single file";
+            const char *err = rle_volume_set_path(d, header, val);
+            if (err) return err;
+            have_file = 1;
+        }
+    }
+    if (dimension != 3) return "dimension must be 3";
+    if (!d->x) return "sizes missing";
+    if (!have_type) return "type missing";
+    if (d->type != RLE_VOXEL_U8 && !have_endian) return "endian missing";
+    if (!have_file) {
+        snprintf(d->path, sizeof(d->path), "%s", header);
+        d->offset = (uint64_t)ftell(f);
+    }
+    return NULL;
+}
+
+static inline int rle_volume_has_ext(const char *path, const char *ext) {
+    size_t n = strlen(path), e = strlen(ext);
+    return n > e && strcasecmp(path + n - e, ext) == 0;
+}
+
+// Fills 'd' for the volume 'path' (see the top of the file). 8-bit volumes
+// are scanned at p->threshold, windowed ones through p's window at 0.
+// Returns NULL on success, otherwise what is wrong with the file.
+static inline const char *rle_volume_open(const char *path, const RleVolumeParams *p, RleVolumeDesc *d) {
+    memset(d, 0, sizeof(*d));
+    int64_t skip = 0;
+
+    if (rle_volume_has_ext(path, ".mhd") || rle_volume_has_ext(path, ".mha") ||
+        rle_volume_has_ext(path, ".nrrd") || rle_volume_has_ext(path, ".nhdr")) {
+        FILE *f = fopen(path, "rb");
+        if (!f) return "cannot open the header";
+        const char *err = (rle_volume_has_ext(path, ".mhd") || rle_volume_has_ext(path, ".mha"))
+            ? rle_volume_parse_mhd(f, path, d, &skip)
+            : rle_volume_parse_nrrd(f, path, d, &skip);
+        fclose(f);
+        if (err) return err;
+    } else {
+        if (strlen(path) >= sizeof(d->path)) return "path too long";
+        snprintf(d->path, sizeof(d->path), "%s", path);
+        d->x = RLE_VOLUME_RAW_X;
+        d->y = RLE_VOLUME_RAW_Y;
+        d->z = RLE_VOLUME_RAW_Z;
+        d->type = RLE_VOXEL_U8;
+    }
+
+    struct stat st;
+    if (stat(d->path, &st) != 0) return "cannot open the data file";
+    uint64_t bytes = rle_volume_voxels(d) * rle_volume_voxel_bytes(d);
+    if (skip == -1) {
+        if ((uint64_t)st.st_size < bytes) return "data file is too short";
+        d->offset = (uint64_t)st.st_size - bytes;
+    } else {
+        d->offset += (uint64_t)skip;
+    }
+    if ((uint64_t)st.st_size < d->offset + bytes) return "data file is too short";
+
+    d->threshold = rle_volume_windowed(d) ? 0 : p->threshold;
+    d->window_lo = p->window_lo;
+    d->window_hi = p->window_hi;
+    return NULL;
+}
+
+// Header of an encoded stream of 'd' (rle_encode.h): the dimensions, and how
+// the voxels were binarised, the threshold or the window.
+static inline RleHeader rle_volume_header(const RleVolumeDesc *d, int n_bits, uint64_t total_bits) {
+    RleHeader hdr = { d->x, d->y, d->z, d->threshold, (uint8_t)n_bits, total_bits, 0, 0, 0 };
+    if (rle_volume_windowed(d)) {
+        hdr.flags = RLE_HEADER_WINDOWED;
+        hdr.window_lo = d->window_lo;
+        hdr.window_hi = d->window_hi;
+    }
+    return hdr;
+}
+
+// Where an output of the volume 'path' goes: the same path with the file's
+// extension replaced by 'ext', so c8.raw gives c8.rle and ct.nhdr ct.rle.
+// Returns 0 on success, 1 if the name does not fit in 'cap'.
+static inline int rle_volume_output_path(const char *path, const char *ext, char *out, size_t cap) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strrchr(base, '.');
+    size_t stem = (dot && dot != base) ? (size_t)(dot - path) : strlen(path);
+    int n = snprintf(out, cap, "%.*s%s", (int)stem, path, ext);
+    return n < 0 || (size_t)n >= cap;
+}
+
+// "1024x1024x314 u8" plus the window for 16-bit volumes
+static inline void rle_volume_print(const RleVolumeDesc *d) {
+    printf("Volume %s: %ux%ux%u %s", d->path, d->x, d->y, d->z, rle_volume_type_name(d->type));
+    if (rle_volume_windowed(d)) {
+        printf(" (%s endian), window %d..%d", d->big_endian ? "big" : "little", d->window_lo, d->window_hi);
+    } else {
+        printf(", threshold %u", d->threshold);
+    }
+    printf("\n");
+}
+
+#endif
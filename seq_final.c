@@ -1,17 +1,36 @@
-// Defines for clock_gettime
-#define _POSIX_C_SOURCE 199309L
+// Defines for clock_gettime, posix_madvise and syscall (rle_prof.h)
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
 #include <string.h>
 
-// Dimensions specific to the c8.raw dataset
-#define X 1024
-#define Y 1024
-#define Z 314
-#define NUM_VOXELS ((size_t)X * Y * Z)
-#define THRESHOLD 25
+#include "rle_simd.h"
+#include "rle_analyzer.h"
+#include "rle_hist.h"
+#include "rle_codes.h"
+#include "rle_encode.h"
+#include "rle_io.h"
+#include "rle_mask.h"
+#include "rle_sweep.h"
+#include "rle_volume.h"
+#include "rle_cache.h"
+#include "rle_runs.h"
+#include "rle_prof.h"
+
+// Threshold for 8-bit volumes
+#define THRESHOLD_U8 25
+
+// The volume being scanned, c8.raw unless --input names another file.
+// 16-bit volumes are windowed to 0/1 on load and scanned at threshold 0.
+RleVolumeDesc input;
+#define X (input.x)
+#define Y (input.y)
+#define Z (input.z)
+#define NUM_VOXELS ((size_t)rle_volume_voxels(&input))
+#define THRESHOLD (input.threshold)
 
 // We are benchmarking RLE bit-widths from N=2 to N=17
 #define MIN_N 2
@@ -29,17 +48,18 @@ double get_time(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-int load_volume(const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) return 1;
+// Reads the volume described by 'input', windowing 16-bit voxels on the way.
+int load_volume(void) {
+    int fd = open(input.path, O_RDONLY);
+    if (fd < 0) return 1;
 
     volume = malloc(NUM_VOXELS);
-    if (!volume) { fclose(f); return 1; }
+    if (!volume) { close(fd); return 1; }
 
-    if (fread(volume, 1, NUM_VOXELS, f) != NUM_VOXELS) {
-        free(volume); fclose(f); return 1;
+    if (rle_volume_pread(fd, &input, 0, NUM_VOXELS, volume) != 0) {
+        free(volume); close(fd); return 1;
     }
-    fclose(f);
+    close(fd);
     return 0;
 }
 
@@ -55,75 +75,646 @@ static inline uint64_t calc_bits_for_run(size_t length, int n_bits) {
     return packets * (n_bits + 1);
 }
 
-void run_sequential_test(void) {
+void print_results(const uint64_t *bit_costs) {
+    printf("--- RLE Analysis Results ---\n");
+    for (int n = MIN_N; n <= MAX_N; ++n) {
+        int packet_bits = n + 1;
+        double mb = (double)bit_costs[n - MIN_N] / 8.0 / 1024.0 / 1024.0;
+        printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
+               n, packet_bits, bit_costs[n - MIN_N], mb);
+    }
+}
+
+// Scalar reference: one compare and one branch per voxel.
+// The SIMD path below has to produce exactly the same bit_costs.
+void run_sequential_test(uint64_t *bit_costs) {
     printf("\n=== Running Sequential Test ===\n");
 
-    uint64_t bit_costs[RLE_VARIANTS] = {0};
+    double start_time = get_time();
+
+    // The per-voxel loop (rle_summary.h): every run is costed for every N
+    // variant as soon as it ends, nothing is stored
+    RleSummary sum = rle_summary_scan_scalar(volume, NUM_VOXELS, THRESHOLD);
+    memcpy(bit_costs, sum.costs, RLE_VARIANTS * sizeof(uint64_t));
+
+    double end_time = get_time();
+
+    printf(">> Computation Time: %.6f seconds\n", end_time - start_time);
+
+    print_results(bit_costs);
+}
+
+// Callback for the streaming kernels: a run just closed, charge it to every N.
+static void add_run_cost(void *ctx, size_t len) {
+    uint64_t *bit_costs = (uint64_t *)ctx;
+    for (int n = MIN_N; n <= MAX_N; ++n) {
+        bit_costs[n - MIN_N] += calc_bits_for_run(len, n);
+    }
+}
+
+// Same analysis, but 64 voxels are thresholded at once and only the run
+// boundaries are visited (see rle_simd.h). The volume is fed to the analyzer
+// (rle_analyzer.h) one slice at a time, the way a live acquisition would.
+void run_simd_test(uint64_t *bit_costs) {
+    printf("\n=== Running SIMD Test (%s) ===\n", RLE_SIMD_NAME);
 
     double start_time = get_time();
 
-    size_t idx = 0;
+    RleAnalyzer an;
+    rle_begin(&an, THRESHOLD);
+    size_t slice = (size_t)X * Y;
+    for (size_t i = 0; i < NUM_VOXELS; i += slice) {
+        rle_feed(&an, volume + i, NUM_VOXELS - i < slice ? NUM_VOXELS - i : slice);
+    }
+    RleSummary sum = rle_finish(&an);
+    memcpy(bit_costs, sum.costs, RLE_VARIANTS * sizeof(uint64_t));
 
-    // Handle the first voxel separately to avoid checking "if (i==0)"
-    // inside the hot loop millions of times.
-    uint8_t current_val = (volume[0] > THRESHOLD) ? 1 : 0;
-    size_t current_len = 1;
+    double end_time = get_time();
 
-    // Scan the rest of the volume
-    for (size_t i = 1; i < NUM_VOXELS; ++i) {
-        uint8_t next_val = (volume[i] > THRESHOLD) ? 1 : 0;
+    printf(">> Computation Time: %.6f seconds (%.1f us per slice)\n", end_time - start_time,
+           (end_time - start_time) * 1e6 / (Z ? Z : 1));
 
-        if (next_val == current_val) {
-            current_len++;
-        } else {
-            // The run ended.
-            // Instead of saving this run to a list (which consumes memory),
-            // we immediately calculate how many bits this run would cost
-            // for every possible N variant (2..17).
-            for (int n = MIN_N; n <= MAX_N; ++n) {
-                bit_costs[n - MIN_N] += calc_bits_for_run(current_len, n);
-            }
-
-            // Reset for the new run
-            current_val = next_val;
-            current_len = 1;
-        }
+    print_results(bit_costs);
+}
+
+// Deferred variant: the scan only fills a run-length histogram and the
+// 16 cost variants are evaluated once per distinct length (see rle_hist.h).
+void run_histogram_test(uint64_t *bit_costs) {
+    printf("\n=== Running Histogram Test ===\n");
+
+    RleHist hist;
+    if (rle_hist_init(&hist) != 0) {
+        fprintf(stderr, "Error: cannot allocate the run-length histogram.\n");
+        exit(1);
+    }
+
+    double start_time = get_time();
+
+    rle_analyze_range(volume, NULL, 0, NUM_VOXELS, THRESHOLD, &hist);
+    rle_hist_costs(&hist, MIN_N, MAX_N, bit_costs);
+
+    double end_time = get_time();
+
+    printf(">> Computation Time: %.6f seconds\n", end_time - start_time);
+    printf("Runs: %lu (%zu distinct lengths >= %d)\n",
+           rle_hist_runs(&hist), rle_hist_sparse_count(&hist), RLE_HIST_DENSE);
+
+    print_results(bit_costs);
+
+    // The other run-length codes come from the same histogram
+    uint64_t best = bit_costs[0];
+    for (int i = 1; i < RLE_VARIANTS; ++i) if (bit_costs[i] < best) best = bit_costs[i];
+    uint64_t code_costs[RLE_CODE_MAX_VARIANTS];
+    rle_codes_from_hist(&hist, code_costs);
+    rle_codes_print(code_costs, best);
+
+    rle_hist_free(&hist);
+}
+
+// Thresholds the volume once into a 1-bit mask (rle_mask.h), then runs the
+// analysis from the mask. The build is timed on its own: it is paid once,
+// every later pass over the mask reads 8x less memory than a pass over the
+// volume.
+void run_mask_test(uint64_t *bit_costs) {
+    printf("\n=== Running Bit Mask Test ===\n");
+
+    RleMask mask;
+    if (rle_mask_alloc(&mask, NUM_VOXELS) != 0) {
+        fprintf(stderr, "Error: cannot allocate the bit mask.\n");
+        exit(1);
     }
 
-    // Don't forget the very last run after the loop finishes
+    double start_time = get_time();
+    rle_mask_build(&mask, volume, 0, NUM_VOXELS, THRESHOLD);
+    double built_time = get_time();
+
+    RleSummary sum = rle_analyze_range(NULL, &mask, 0, NUM_VOXELS, THRESHOLD, NULL);
+    memcpy(bit_costs, sum.costs, RLE_VARIANTS * sizeof(uint64_t));
+
+    double end_time = get_time();
+
+    printf(">> Mask Build Time: %.6f seconds (%.1f MB)\n", built_time - start_time,
+           (double)mask.nwords * 8.0 / 1024.0 / 1024.0);
+    printf(">> Computation Time: %.6f seconds (from the mask)\n", end_time - built_time);
+
+    print_results(bit_costs);
+    rle_mask_free(&mask);
+}
+
+// Cost tables for every threshold in 'thr', once in a single pass over the
+// volume (rle_sweep.h) and once with a separate scan per threshold, which is
+// what rebuilding with another THRESHOLD would do. Both have to agree.
+// Returns 0 on success.
+int run_sweep_test(const uint8_t *thr, int count) {
+    printf("\n=== Running Threshold Sweep (%d thresholds, %s) ===\n", count, RLE_SIMD_NAME);
+
+    RleSweep sweep;
+    double start_time = get_time();
+    rle_sweep_begin(&sweep, thr, count);
+    rle_sweep_feed(&sweep, volume, NUM_VOXELS);
+    rle_sweep_finish(&sweep);
+    double end_time = get_time();
+    printf(">> One pass:            %.6f seconds\n", end_time - start_time);
+
+    int mismatch = 0;
+    start_time = get_time();
+    for (int t = 0; t < count; ++t) {
+        RleAnalyzer an;
+        rle_begin(&an, thr[t]);
+        rle_feed(&an, volume, NUM_VOXELS);
+        RleSummary sum = rle_finish(&an);
+        if (memcmp(sum.costs, sweep.sum[t].costs, sizeof(sum.costs)) != 0) mismatch = 1;
+    }
+    end_time = get_time();
+    printf(">> One scan per threshold: %.6f seconds\n", end_time - start_time);
+
+    rle_sweep_print(thr, count, sweep.sum);
+
+    if (mismatch) {
+        fprintf(stderr, "Error: the sweep differs from the per-threshold scans.\n");
+        return 1;
+    }
+    printf("Sweep matches the per-threshold scans.\n");
+    return 0;
+}
+
+// Actually writes the packet stream for the cheapest N found by the analysis.
+// Returns 0 on success.
+int run_encode_test(const uint64_t *bit_costs, const char *out_name) {
+    int best_n = MIN_N;
     for (int n = MIN_N; n <= MAX_N; ++n) {
-        bit_costs[n - MIN_N] += calc_bits_for_run(current_len, n);
+        if (bit_costs[n - MIN_N] < bit_costs[best_n - MIN_N]) best_n = n;
+    }
+
+    printf("\n=== Encoding with N=%d ===\n", best_n);
+
+    RleBitWriter writer;
+    // Reserve the predicted size up front so the writer never has to grow
+    if (rle_bw_init(&writer, bit_costs[best_n - MIN_N] / 64 + 1) != 0) {
+        fprintf(stderr, "Error: cannot allocate the output buffer.\n");
+        return 1;
     }
 
+    double start_time = get_time();
+
+    RleAnalyzer an;
+    rle_begin(&an, THRESHOLD);
+    rle_encode_into(&an, &writer, best_n);
+    rle_feed(&an, volume, NUM_VOXELS);
+    rle_finish(&an);
+
     double end_time = get_time();
+    double secs = end_time - start_time;
 
-    printf(">> Computation Time: %.6f seconds\n", end_time - start_time);
+    uint64_t bits = rle_bw_bits(&writer);
+    printf(">> Encode Time: %.6f seconds (%.1f MB/s in, %.1f MB/s out)\n", secs,
+           (double)NUM_VOXELS / 1024.0 / 1024.0 / secs,
+           (double)bits / 8.0 / 1024.0 / 1024.0 / secs);
 
-    printf("--- RLE Analysis Results ---\n");
+    if (bits != bit_costs[best_n - MIN_N]) {
+        fprintf(stderr, "Error: encoded %lu bits, the cost model predicted %lu.\n",
+                bits, bit_costs[best_n - MIN_N]);
+        rle_bw_free(&writer);
+        return 1;
+    }
+
+    RleHeader hdr = rle_volume_header(&input, best_n, bits);
+    if (rle_write_file(out_name, hdr, &writer) != 0) {
+        fprintf(stderr, "Error: cannot write %s.\n", out_name);
+        rle_bw_free(&writer);
+        return 1;
+    }
+    printf("Wrote %s (%lu bits, %.2f MB).\n", out_name, bits,
+           (double)bits / 8.0 / 1024.0 / 1024.0);
+
+    rle_bw_free(&writer);
+    return 0;
+}
+
+// --cache: re-analysis from the per-slice sidecar (rle_cache.h). Only the
+// slices whose hash changed since the last run are scanned, the totals are
+// the cached slice summaries stitched in order. With 'verify' they are
+// checked against a full scan afterwards, which is not part of the timing.
+// Returns 0 on success.
+int run_cache_test(const char *cache_path, int verify) {
+    printf("\n=== Running Cached Re-analysis (%s) ===\n", cache_path);
+
+    RleCache cache;
+    if (rle_cache_init(&cache, X, Y, Z, THRESHOLD) != 0) {
+        fprintf(stderr, "Error: cannot allocate the slice cache.\n");
+        return 1;
+    }
+
+    double start_time = get_time();
+    int valid = rle_cache_load(cache_path, &cache) == 0;
+    double load_time = get_time();
+    uint32_t scanned = rle_cache_update(&cache, volume, valid);
+    RleSummary total = rle_cache_total(&cache);
+    double end_time = get_time();
+
+    int status = 0;
+    if (rle_cache_save(cache_path, &cache) != 0) {
+        fprintf(stderr, "Error: cannot write %s.\n", cache_path);
+        status = 1;
+    }
+    double save_time = get_time();
+
+    printf("Cache %s, %u of %u slices scanned.\n", valid ? "loaded" : "missing or stale", scanned, Z);
+    printf(">> Computation Time: %.6f seconds (hash, scan and stitch)\n", end_time - load_time);
+    printf(">> Sidecar I/O: %.6f seconds (load + save)\n", (load_time - start_time) + (save_time - end_time));
+    print_results(total.costs);
+
+    if (!verify) {
+        rle_cache_free(&cache);
+        return status;
+    }
+
+    RleAnalyzer an;
+    rle_begin(&an, THRESHOLD);
+    rle_feed(&an, volume, NUM_VOXELS);
+    RleSummary full = rle_finish(&an);
+    if (memcmp(full.costs, total.costs, sizeof(full.costs)) != 0 || full.runs != total.runs) {
+        fprintf(stderr, "Error: the cached totals differ from a full scan.\n");
+        status = 1;
+    } else {
+        printf("Cached totals match a full scan.\n");
+    }
+
+    rle_cache_free(&cache);
+    return status;
+}
+
+// Expanded-path histogram: the runs of one value in a 0/1 byte mask
+typedef struct {
+    RleHist *hist;
+    uint8_t val, want;
+} ValueHist;
+
+static void add_value_run(void *ctx, size_t len) {
+    ValueHist *v = (ValueHist *)ctx;
+    if (v->val == v->want) rle_hist_add(v->hist, len, 1);
+    v->val ^= 1;
+}
+
+static void print_runs_row(const char *op, double t_runs, double t_expanded, int ok) {
+    printf("%-12s %10.6f s %12.6f s %8.1fx  %s\n", op, t_runs, t_expanded,
+           t_runs > 0 ? t_expanded / t_runs : 0.0, ok ? "ok" : "MISMATCH");
+}
+
+// --runs: the run-domain mask operations (rle_runs.h) against expanding the
+// mask to one byte per voxel and working on the bytes. Mask A is the volume
+// at THRESHOLD, mask B at THRESHOLD + 35 for the two-mask operations (empty
+// on a windowed 16-bit volume). The expanded path includes the expansion and,
+// where the result is a mask, the scan back to runs; every result is checked
+// against it. Returns 0 on success.
+int run_runs_test(void) {
+    printf("\n=== Running Run-domain Operations ===\n");
+
+    uint8_t thr_b = THRESHOLD > 255 - 35 ? 255 : (uint8_t)(THRESHOLD + 35);
+    RleRuns a, b, out, check;
+    uint8_t *ea = malloc(NUM_VOXELS);
+    uint8_t *eb = malloc(NUM_VOXELS);
+    uint64_t *areas = malloc(2 * (size_t)Z * sizeof(uint64_t));
+    if (!ea || !eb || !areas || rle_runs_init(&a, 1 << 20) != 0 || rle_runs_init(&b, 1 << 20) != 0 ||
+        rle_runs_init(&out, 1 << 20) != 0 || rle_runs_init(&check, 1 << 20) != 0) {
+        fprintf(stderr, "Error: cannot allocate the run lists.\n");
+        exit(1);
+    }
+
+    double t0 = get_time();
+    rle_runs_from_volume(&a, volume, NUM_VOXELS, THRESHOLD);
+    double t1 = get_time();
+    rle_runs_from_volume(&b, volume, NUM_VOXELS, thr_b);
+    printf("Mask A (> %u): %zu runs, scanned in %.6f s\n", THRESHOLD, a.count, t1 - t0);
+    printf("Mask B (> %u): %zu runs\n", thr_b, b.count);
+    printf("%-12s %12s %15s %9s\n", "Operation", "Runs", "Expanded", "Speedup");
+
+    int failed = 0;
+    double t_runs, t_exp;
+
+    // Foreground count
+    t0 = get_time();
+    uint64_t fg = rle_runs_count(&a);
+    t_runs = get_time() - t0;
+    t0 = get_time();
+    rle_runs_expand(&a, ea);
+    uint64_t fg_exp = 0;
+    for (size_t i = 0; i < NUM_VOXELS; ++i) fg_exp += ea[i];
+    t_exp = get_time() - t0;
+    print_runs_row("count", t_runs, t_exp, fg == fg_exp);
+    failed |= fg != fg_exp;
+
+    // Foreground run-length histogram
+    RleHist h_runs, h_exp;
+    if (rle_hist_init(&h_runs) != 0 || rle_hist_init(&h_exp) != 0) {
+        fprintf(stderr, "Error: cannot allocate the run-length histogram.\n");
+        exit(1);
+    }
+    t0 = get_time();
+    rle_runs_hist(&a, 1, &h_runs);
+    t_runs = get_time() - t0;
+    t0 = get_time();
+    rle_runs_expand(&a, ea);
+    ValueHist vh = { &h_exp, ea[0], 1 };
+    RleOpenRun run = { ea[0], 0 };
+    rle_scan_range(ea, NUM_VOXELS, 0, &run, add_value_run, &vh);
+    add_value_run(&vh, run.len);
+    t_exp = get_time() - t0;
+    uint64_t c_runs[RLE_VARIANTS], c_exp[RLE_VARIANTS];
+    rle_hist_costs(&h_runs, MIN_N, MAX_N, c_runs);
+    rle_hist_costs(&h_exp, MIN_N, MAX_N, c_exp);
+    int ok = memcmp(h_runs.dense, h_exp.dense, sizeof(h_runs.dense)) == 0 &&
+             rle_hist_sparse_count(&h_runs) == rle_hist_sparse_count(&h_exp) &&
+             memcmp(c_runs, c_exp, sizeof(c_runs)) == 0;
+    print_runs_row("histogram", t_runs, t_exp, ok);
+    failed |= !ok;
+    rle_hist_free(&h_runs);
+    rle_hist_free(&h_exp);
+
+    // AND / OR / XOR of A and B
+    static const char *op_names[] = { "A and B", "A or B", "A xor B" };
+    for (int op = RLE_RUNS_AND; op <= RLE_RUNS_XOR; ++op) {
+        t0 = get_time();
+        int err = rle_runs_combine(&a, &b, (RleRunsOp)op, &out);
+        t_runs = get_time() - t0;
+        t0 = get_time();
+        rle_runs_expand(&a, ea);
+        rle_runs_expand(&b, eb);
+        for (size_t i = 0; i < NUM_VOXELS; ++i) ea[i] = rle_runs_apply((RleRunsOp)op, ea[i], eb[i]);
+        rle_runs_from_volume(&check, ea, NUM_VOXELS, 0);
+        t_exp = get_time() - t0;
+        ok = !err && rle_runs_equal(&out, &check);
+        print_runs_row(op_names[op], t_runs, t_exp, ok);
+        failed |= !ok;
+    }
+
+    // Foreground area of every slice
+    size_t slice = (size_t)X * Y;
+    t0 = get_time();
+    rle_runs_slice_area(&a, slice, areas);
+    t_runs = get_time() - t0;
+    t0 = get_time();
+    rle_runs_expand(&a, ea);
+    for (uint32_t k = 0; k < Z; ++k) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < slice; ++i) sum += ea[(size_t)k * slice + i];
+        areas[Z + k] = sum;
+    }
+    t_exp = get_time() - t0;
+    ok = memcmp(areas, areas + Z, (size_t)Z * sizeof(uint64_t)) == 0;
+    print_runs_row("slice area", t_runs, t_exp, ok);
+    failed |= !ok;
+
+    // The central box, half of the volume along every axis
+    uint32_t lo[3] = { X / 4, Y / 4, Z / 4 };
+    uint32_t hi[3] = { X - X / 4, Y - Y / 4, Z - Z / 4 };
+    size_t row = hi[0] - lo[0];
+    t0 = get_time();
+    int err = rle_runs_crop(&a, X, Y, Z, lo, hi, &out);
+    t_runs = get_time() - t0;
+    t0 = get_time();
+    rle_runs_expand(&a, ea);
+    uint8_t *dst = eb;
+    for (uint32_t k = lo[2]; k < hi[2]; ++k) {
+        for (uint32_t j = lo[1]; j < hi[1]; ++j, dst += row) {
+            memcpy(dst, ea + ((size_t)k * Y + j) * X + lo[0], row);
+        }
+    }
+    rle_runs_from_volume(&check, eb, (size_t)(dst - eb), 0);
+    t_exp = get_time() - t0;
+    ok = !err && rle_runs_equal(&out, &check);
+    print_runs_row("crop", t_runs, t_exp, ok);
+    failed |= !ok;
+    printf("Crop [%u,%u) x [%u,%u) x [%u,%u): %zu runs, %lu foreground voxels\n", lo[0], hi[0], lo[1],
+           hi[1], lo[2], hi[2], out.count, rle_runs_count(&out));
+
+    // A's runs read back from its packet stream, for the cheapest N
+    RleHist h_all;
+    if (rle_hist_init(&h_all) != 0) {
+        fprintf(stderr, "Error: cannot allocate the run-length histogram.\n");
+        exit(1);
+    }
+    rle_runs_hist(&a, 0, &h_all);
+    rle_runs_hist(&a, 1, &h_all);
+    rle_hist_costs(&h_all, MIN_N, MAX_N, c_runs);
+    rle_hist_free(&h_all);
+    int best_n = MIN_N;
     for (int n = MIN_N; n <= MAX_N; ++n) {
-        int packet_bits = n + 1;
-        double mb = (double)bit_costs[n - MIN_N] / 8.0 / 1024.0 / 1024.0;
-        printf("N=%2d (%2d b/packet): %12lu bits (%.2f MB)\n",
-               n, packet_bits, bit_costs[n - MIN_N], mb);
+        if (c_runs[n - MIN_N] < c_runs[best_n - MIN_N]) best_n = n;
+    }
+
+    RleBitWriter writer;
+    RleStream stream;
+    if (rle_bw_init(&writer, c_runs[best_n - MIN_N] / 64 + 1) != 0) {
+        fprintf(stderr, "Error: cannot allocate the output buffer.\n");
+        exit(1);
+    }
+    RleAnalyzer an;
+    rle_begin(&an, THRESHOLD);
+    rle_encode_into(&an, &writer, best_n);
+    rle_feed(&an, volume, NUM_VOXELS);
+    rle_finish(&an);
+    RleHeader hdr = rle_volume_header(&input, best_n, 0);
+    if (rle_stream_from_writer(&stream, hdr, &writer) != 0) {
+        fprintf(stderr, "Error: cannot allocate the stream.\n");
+        exit(1);
+    }
+    rle_bw_free(&writer);
+
+    t0 = get_time();
+    err = rle_runs_from_stream(&check, &stream);
+    t_runs = get_time() - t0;
+    ok = !err && rle_runs_equal(&a, &check);
+    printf("Runs from the N=%d stream: %.6f s, %s\n", best_n, t_runs, ok ? "same as mask A" : "MISMATCH");
+    failed |= !ok;
+    rle_stream_free(&stream);
+
+    rle_runs_free(&a);
+    rle_runs_free(&b);
+    rle_runs_free(&out);
+    rle_runs_free(&check);
+    free(ea);
+    free(eb);
+    free(areas);
+
+    if (failed) {
+        fprintf(stderr, "Error: a run-domain result differs from the expanded path.\n");
+        return 1;
     }
+    printf("Run-domain results match the expanded path.\n");
+    return 0;
 }
 
-int main(void) {
-    if (load_volume("c8.raw") != 0) {
-        fprintf(stderr, "Error: Make sure c8.raw exists (1024x1024x314).\n");
+// Streaming mode: no load_volume(), no warm-up pass. The file is scanned
+// block by block while it is being read, so the time printed here is the
+// real end-to-end time including I/O.
+int run_stream_test(const char *filename, int use_mmap) {
+    printf("\n=== Running Streaming Test (%s, %zu MB blocks) ===\n",
+           use_mmap ? "mmap" : "double-buffered read", RLE_IO_BLOCK >> 20);
+
+    uint64_t bit_costs[RLE_VARIANTS] = {0};
+    RleOpenRun run = { 0, 0 };
+    RleIoStats stats;
+
+    int err = use_mmap
+        ? rle_stream_mmap(filename, RLE_IO_BLOCK, THRESHOLD, &run, add_run_cost, bit_costs, &stats)
+        : rle_stream_read(filename, RLE_IO_BLOCK, THRESHOLD, &run, add_run_cost, bit_costs, &stats);
+    if (err) {
+        fprintf(stderr, "Error: cannot stream %s.\n", filename);
+        return 1;
+    }
+    add_run_cost(bit_costs, run.len);
+
+    double mb = (double)stats.bytes / 1024.0 / 1024.0;
+    printf(">> End-to-end Time (I/O + scan): %.6f seconds (%.1f MB/s)\n",
+           stats.total, mb / stats.total);
+    printf(">> Computation Time: %.6f seconds\n", stats.scan);
+    if (!use_mmap) printf(">> I/O Wait: %.6f seconds\n", stats.io_wait);
+
+    print_results(bit_costs);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint8_t sweep_thr[RLE_SWEEP_MAX];
+    int sweep_count = 0;
+    const char *stream = NULL;
+    const char *input_path = "c8.raw";
+    const char *cache_path = NULL;
+    int cache_verify = 0;
+    int runs = 0;
+    RleVolumeParams params;
+    rle_volume_params_init(&params, THRESHOLD_U8);
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc &&
+            (strcmp(argv[i + 1], "mmap") == 0 || strcmp(argv[i + 1], "read") == 0)) {
+            stream = argv[++i];
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc &&
+                   (sweep_count = rle_sweep_parse(argv[i + 1], sweep_thr)) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (rle_volume_parse_arg(argc, argv, &i, &params) > 0) {
+            // --threshold or --window
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache-verify") == 0) {
+            cache_verify = 1;
+        } else if (strcmp(argv[i], "--runs") == 0) {
+            runs = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--input FILE|HEADER.mhd|HEADER.nrrd] [--threshold T] [--window LO,HI] "
+                    "[--stream mmap|read | --sweep T1,T2,.. | --cache SIDECAR [--cache-verify] | --runs]\n"
+                    "The slice cache is only read and written by seq; the other programs always scan everything.\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (cache_verify && !cache_path) {
+        fprintf(stderr, "Error: --cache-verify needs --cache.\n");
+        return 1;
+    }
+    if (!!stream + (sweep_count > 0) + !!cache_path + runs > 1) {
+        fprintf(stderr, "Error: --stream, --sweep, --cache and --runs cannot be combined.\n");
+        return 1;
+    }
+
+    const char *err = rle_volume_open(input_path, &params, &input);
+    if (err) {
+        fprintf(stderr, "Error: %s: %s.\n", input_path, err);
+        return 1;
+    }
+    rle_volume_print(&input);
+
+    // The streaming scans read the stored bytes straight from the file, the
+    // sweep compares the loaded voxels against its own thresholds
+    if (stream && (rle_volume_windowed(&input) || input.offset != 0)) {
+        fprintf(stderr, "Error: --stream needs a headerless 8-bit volume.\n");
+        return 1;
+    }
+    if (sweep_count > 0 && rle_volume_windowed(&input)) {
+        fprintf(stderr, "Error: --sweep needs an 8-bit volume.\n");
+        return 1;
+    }
+    if (stream) return run_stream_test(input.path, strcmp(stream, "mmap") == 0);
+
+    RLE_PROF_BEGIN(RLE_PROF_LOAD);
+    if (load_volume() != 0) {
+        fprintf(stderr, "Error: cannot read %s (%ux%ux%u).\n", input.path, X, Y, Z);
         return 1;
     }
+    RLE_PROF_END(RLE_PROF_LOAD);
     printf("Volume loaded (%zu voxels).\n", NUM_VOXELS);
 
+    // The cached re-analysis is timed as it would run for real: the hash
+    // pass is the first to touch the voxels after the load
+    if (cache_path) {
+        int status = run_cache_test(cache_path, cache_verify);
+        free(volume);
+        return status;
+    }
+
     // We touch every byte of the volume before starting the timer.
     // This brings the data into the CPU cache/RAM, ensuring we measure
     // pure calculation speed rather than disk paging latency.
+    RLE_PROF_BEGIN(RLE_PROF_WARMUP);
     volatile uint64_t sum = 0;
     for(size_t i=0; i<NUM_VOXELS; i++) sum += volume[i];
+    RLE_PROF_END(RLE_PROF_WARMUP);
     printf("Cache warmed up.\n");
 
-    run_sequential_test();
+    if (sweep_count > 0) {
+        int status = run_sweep_test(sweep_thr, sweep_count);
+        free(volume);
+        return status;
+    }
+    if (runs) {
+        int status = run_runs_test();
+        free(volume);
+        return status;
+    }
+
+    uint64_t ref_costs[RLE_VARIANTS];
+    uint64_t simd_costs[RLE_VARIANTS];
+    uint64_t hist_costs[RLE_VARIANTS];
+    uint64_t mask_costs[RLE_VARIANTS];
+
+    // All four engines, one after the other
+    RLE_PROF_BEGIN(RLE_PROF_SCAN);
+    run_sequential_test(ref_costs);
+    run_simd_test(simd_costs);
+    run_histogram_test(hist_costs);
+    run_mask_test(mask_costs);
+    RLE_PROF_END(RLE_PROF_SCAN);
+
+    if (memcmp(ref_costs, simd_costs, sizeof(ref_costs)) != 0) {
+        fprintf(stderr, "Error: SIMD result differs from the scalar reference.\n");
+        free(volume);
+        return 1;
+    }
+    if (memcmp(ref_costs, hist_costs, sizeof(ref_costs)) != 0) {
+        fprintf(stderr, "Error: histogram result differs from the scalar reference.\n");
+        free(volume);
+        return 1;
+    }
+    if (memcmp(ref_costs, mask_costs, sizeof(ref_costs)) != 0) {
+        fprintf(stderr, "Error: bit mask result differs from the scalar reference.\n");
+        free(volume);
+        return 1;
+    }
+    printf("SIMD, histogram and bit mask results match the scalar reference.\n");
+
+    // The stream goes next to the volume, c8.raw -> c8.rle
+    char out_name[RLE_VOLUME_PATH + 8];
+    if (rle_volume_output_path(input_path, ".rle", out_name, sizeof(out_name)) != 0 ||
+        run_encode_test(ref_costs, out_name) != 0) {
+        free(volume);
+        return 1;
+    }
 
+    RLE_PROF_REPORT_PHASES();
+    RLE_PROF_CLOSE();
     free(volume);
     return 0;
 }